@@ -0,0 +1,151 @@
+/* arena.c
+ *
+ * bump allocator, see arena.h
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arena.h"
+
+
+
+void arena_init(ARENA *a, size_t block_size)
+{
+    a->first      = NULL;
+    a->current    = NULL;
+    a->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+
+void arena_reset(ARENA *a)
+{
+    // the other blocks are cleared when they become current again
+    a->current = a->first;
+    if (a->current) {
+        a->current->used = 0;
+    }
+}
+
+
+void arena_free(ARENA *a)
+{
+    ARENA_BLOCK *b = a->first;
+    while (b) {
+        ARENA_BLOCK *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->first   = NULL;
+    a->current = NULL;
+}
+
+
+
+static size_t align_up(size_t n, size_t align)
+{
+    return (n + align - 1) & ~(align - 1);
+}
+
+
+// move to the next free block which can hold size bytes, or add one after current
+static ARENA_BLOCK *arena_next_block(ARENA *a, size_t size)
+{
+    ARENA_BLOCK *next = a->current ? a->current->next : a->first;
+    if (next && next->size >= size) {
+        next->used = 0;
+        a->current = next;
+        return next;
+    }
+
+    // a larger request gets a block of its own size
+    size_t block_size = (size > a->block_size) ? size : a->block_size;
+    ARENA_BLOCK *b = malloc(sizeof(ARENA_BLOCK) + block_size);
+    if (!b) {
+        perror("malloc(arena)");
+        return NULL;
+    }
+    b->size = block_size;
+    b->used = 0;
+
+    // keep the free blocks behind the new one, they will be used later
+    if (a->current) {
+        b->next = a->current->next;
+        a->current->next = b;
+    } else {
+        b->next = a->first;
+        a->first = b;
+    }
+    a->current = b;
+
+    return b;
+}
+
+
+void *arena_alloc_align(ARENA *a, size_t size, size_t align)
+{
+    if (size == 0) size = 1;
+
+    ARENA_BLOCK *b = a->current;
+    if (b) {
+        size_t start = align_up(b->used, align);
+        if (start <= b->size && b->size - start >= size) {
+            b->used = start + size;
+            return &b->data[start];
+        }
+    }
+
+    // block data is ARENA_ALIGN aligned, so a new block needs no padding
+    b = arena_next_block(a, size);
+    if (!b) return NULL;
+    b->used = size;
+    return b->data;
+}
+
+
+void *arena_alloc(ARENA *a, size_t size)
+{
+    return arena_alloc_align(a, size, ARENA_ALIGN);
+}
+
+
+void *arena_calloc(ARENA *a, size_t count, size_t size)
+{
+    if (size && count > SIZE_MAX / size) return NULL;
+
+    void *p = arena_alloc(a, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+
+char *arena_strndup(ARENA *a, const char *s, size_t len)
+{
+    char *p = arena_alloc_align(a, len + 1, 1);
+    if (!p) return NULL;
+
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+
+char *arena_strdup(ARENA *a, const char *s)
+{
+    return arena_strndup(a, s, strlen(s));
+}
+
+
+void arena_shrink(ARENA *a, void *p, size_t size, size_t new_size)
+{
+    ARENA_BLOCK *b = a->current;
+
+    // only possible while nothing was allocated after p
+    if (b && new_size < size && (unsigned char *)p + size == &b->data[b->used]) {
+        b->used -= size - new_size;
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef EVTX_ARENA_H
+#define EVTX_ARENA_H
+
+#include <stddef.h>
+
+/*
+ * Bump allocator.
+ *
+ * Memory comes from large blocks, an allocation is just moving a pointer.
+ * Nothing is freed one by one: arena_reset() makes all the memory available
+ * again in O(1) and keeps the blocks for the next round, arena_free()
+ * gives the blocks back to the system.
+ *
+ * Typical use: one arena per decoder, reset per chunk or per record.
+ */
+
+#define ARENA_BLOCK_SIZE    (64 * 1024)
+#define ARENA_ALIGN         16          /* default alignment of arena_alloc() */
+
+typedef struct _ARENA_BLOCK {
+    struct _ARENA_BLOCK *next;
+    size_t size;            // bytes in data
+    size_t used;
+    _Alignas(ARENA_ALIGN) unsigned char data[];
+} ARENA_BLOCK;
+
+typedef struct _ARENA {
+    ARENA_BLOCK *first;
+    ARENA_BLOCK *current;   // allocations come from here, the blocks after it are free
+    size_t block_size;
+} ARENA;
+
+
+/* lifecycle, block_size 0 means ARENA_BLOCK_SIZE */
+void  arena_init(ARENA *a, size_t block_size);
+void  arena_reset(ARENA *a);
+void  arena_free(ARENA *a);
+
+/* NULL only when out of memory */
+void *arena_alloc(ARENA *a, size_t size);
+void *arena_alloc_align(ARENA *a, size_t size, size_t align);   /* align: power of 2, up to ARENA_ALIGN */
+void *arena_calloc(ARENA *a, size_t count, size_t size);
+char *arena_strdup(ARENA *a, const char *s);
+char *arena_strndup(ARENA *a, const char *s, size_t len);
+
+/* the last allocation p of size bytes only needs new_size bytes, give back the rest */
+void  arena_shrink(ARENA *a, void *p, size_t size, size_t new_size);
+
+#endif
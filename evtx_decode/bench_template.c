@@ -0,0 +1,99 @@
+// bench_template.c
+//
+// Compare the two ways of rendering a record:
+//
+//  - compiled templates (EVTX_OP program, the default)
+//  - the raw BinXML token walker (--raw-walker, OUT_RAW)
+//
+// Both decode the whole file with the DEFAULT output, sent to /dev/null.
+// Use a system.evtx sized file (20 MB or more) to get stable numbers.
+//
+// Build the program (one command line)
+//    gcc -Wall -Wextra -O2 -std=c11 -D_DEFAULT_SOURCE -pthread -o bench_template bench_template.c
+//        hex_dump.c timestamp.c evtx_file.c evtx_chunk.c evtx_record.c evtx_binxml.c
+//        utf16le.c evtx_xmltree.c evtx_output.c stack.c pool.c evtx_template.c out_sink.c arena.c evtx_index.c evtx_arrow.c evtx_batch.c evtx_follow.c evtx_verify.c crc32.c evtx_carve.c
+//
+// Run
+//    ./bench_template system.evtx [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "evtx_file.h"
+#include "evtx_output.h"
+#include "evtx_template.h"
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// best of rounds, in seconds
+static double run(const char *filename, uint32_t output_mode, int rounds)
+{
+    double best = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        FILE *fp = fopen(filename, "rb");
+        if (!fp) {
+            perror(filename);
+            exit(1);
+        }
+
+        EVTX_OPTIONS opts = { .output_mode = output_mode, .jobs = 1 };
+        OUT_SINK out;
+        out_sink_init_fd(&out, STDOUT_FILENO);
+
+        double t0 = now_sec();
+        decode_evtx_file(fp, &opts, &out);
+        out_sink_flush(&out);
+        double t = now_sec() - t0;
+
+        out_sink_free(&out);
+        fclose(fp);
+
+        if (r == 0 || t < best) best = t;
+    }
+
+    return best;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s evtxfile [rounds]\n", argv[0]);
+        return 1;
+    }
+    int rounds = (argc > 2) ? atoi(argv[2]) : 5;
+    if (rounds < 1) rounds = 1;
+
+    if (!freopen("/dev/null", "w", stdout)) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    double raw = run(argv[1], OUT_RAW, rounds);
+
+    // the first round also fills the process wide template cache,
+    // so the best round is the steady state of a long running decode
+    double compiled = run(argv[1], OUT_NONE, rounds);
+
+    uint64_t hits, misses;
+    evtx_template_cache_stats(&hits, &misses);
+
+    fprintf(stderr, "raw walker         : %8.3f sec\n", raw);
+    fprintf(stderr, "compiled templates : %8.3f sec  (%.2fx)\n", compiled, compiled > 0 ? raw / compiled : 0);
+    fprintf(stderr, "template cache     : hits=%llu misses=%llu\n",
+            (unsigned long long)hits, (unsigned long long)misses);
+
+    evtx_template_cache_free_all();
+    return 0;
+}
@@ -0,0 +1,178 @@
+// bench_timestamp.c
+//
+// Compare filetime_to_iso() of timestamp.c with gmtime_r + strftime (what
+// format_filetime() used to do).
+//
+// Both are first checked to give the same text: every day boundary from
+// 1601 to 10000, and random FILETIMEs over the whole 64-bit range (up to the
+// year 30828). Then N conversions are timed (100M by default) on
+//    log      timestamps going up by a few ms, like the records of a log:
+//             nearly always the same day as the one before
+//    random   any time between 1601 and 2100: a new day every time
+//
+// Build the program
+//    gcc -Wall -Wextra -O2 -std=c11 -D_DEFAULT_SOURCE -o bench_timestamp bench_timestamp.c timestamp.c
+//
+// Run
+//    ./bench_timestamp [conversions]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "timestamp.h"
+
+
+#define TICKS_PER_SEC   10000000ULL
+#define EPOCH_DIFF      11644473600ULL      // seconds from 1601-01-01 to 1970-01-01
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+
+// the libc way, "YYYY-MM-DDTHH:MM:SS.fffffff" without the 'Z'
+static size_t libc_to_iso(uint64_t filetime, char *buf, size_t size)
+{
+    time_t t = (time_t)(filetime / TICKS_PER_SEC) - (time_t)EPOCH_DIFF;
+    struct tm tm_buf;
+    gmtime_r(&t, &tm_buf);
+
+    size_t n = strftime(buf, size, "%Y-%m-%dT%H:%M:%S", &tm_buf);
+    n += (size_t)snprintf(&buf[n], size - n, ".%07u", (unsigned)(filetime % TICKS_PER_SEC));
+    return n;
+}
+
+static int check_one(uint64_t filetime, FILETIME_DAY_CACHE *cache)
+{
+    char a[64], b[FILETIME_ISO_MAX];
+    size_t na = libc_to_iso(filetime, a, sizeof(a));
+    size_t nb = filetime_to_iso(filetime, b, cache);
+
+    if (na != nb || memcmp(a, b, na) != 0) {
+        fprintf(stderr, "ERROR: FILETIME %llu: gmtime %.*s, filetime_to_iso %.*s\n",
+                (unsigned long long)filetime, (int)na, a, (int)nb, b);
+        return 1;
+    }
+    return 0;
+}
+
+static int check(void)
+{
+    FILETIME_DAY_CACHE cache;
+    memset(&cache, 0, sizeof(cache));
+    int errors = 0;
+
+    // the last tick of a day and the first of the next one, through the cache
+    const uint64_t ticks_per_day = 86400ULL * TICKS_PER_SEC;
+    for (uint64_t day = 1; day < 3067000 && errors < 10; day++) {   // to the year 10000
+        errors += check_one(day * ticks_per_day - 1, &cache);
+        errors += check_one(day * ticks_per_day, &cache);
+    }
+
+    uint64_t s = 88172645463325252ULL;
+    for (int i = 0; i < 10000000 && errors < 10; i++) {
+        errors += check_one(xorshift64(&s) >> 1, &cache);     // time_t of gmtime stays positive
+    }
+    errors += check_one(0, &cache);
+    errors += check_one(INT64_MAX, &cache);
+
+    return errors;
+}
+
+
+typedef size_t (*TO_ISO_FN)(uint64_t, char *, FILETIME_DAY_CACHE *);
+
+static size_t run_libc(uint64_t filetime, char *buf, FILETIME_DAY_CACHE *cache)
+{
+    (void)cache;
+    return libc_to_iso(filetime, buf, FILETIME_ISO_MAX);
+}
+
+static double bench(TO_ISO_FN fn, const uint64_t *times, size_t count, uint64_t n, uint64_t *sum)
+{
+    FILETIME_DAY_CACHE cache;
+    memset(&cache, 0, sizeof(cache));
+    char buf[FILETIME_ISO_MAX];
+    uint64_t acc = 0;
+
+    double t0 = now_sec();
+    for (uint64_t i = 0; i < n; i++) {
+        size_t len = fn(times[i % count], buf, &cache);
+        acc += len + (uint8_t)buf[len - 1];     // keep the result alive
+    }
+    double t1 = now_sec();
+
+    *sum = acc;
+    return t1 - t0;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint64_t n = (argc > 1) ? strtoull(argv[1], NULL, 10) : 100000000ULL;
+    if (n == 0) {
+        fprintf(stderr, "Usage: %s [conversions]\n", argv[0]);
+        return 1;
+    }
+
+    int errors = check();
+    printf("check: %s\n", errors ? "FAILED" : "ok");
+    if (errors) return 1;
+
+    // a table which stays in the cache, walked over and over
+    const size_t count = 1 << 16;
+    uint64_t *log_times = malloc(count * sizeof(uint64_t));
+    uint64_t *rnd_times = malloc(count * sizeof(uint64_t));
+    if (!log_times || !rnd_times) {
+        perror("malloc");
+        return 1;
+    }
+
+    uint64_t s = 0x9E3779B97F4A7C15ULL;
+    uint64_t t = 134114411391234567ULL;     // 2026-01-14
+    const uint64_t span = (EPOCH_DIFF + 4102444800ULL) * TICKS_PER_SEC;     // 1601 .. 2100
+    for (size_t i = 0; i < count; i++) {
+        t += xorshift64(&s) % 50000;        // up to 5 ms later
+        log_times[i] = t;
+        rnd_times[i] = xorshift64(&s) % span;
+    }
+
+    static const struct {
+        const char *name;
+        TO_ISO_FN   fn;
+    } impls[] = {
+        { "gmtime_r+strftime", run_libc },
+        { "filetime_to_iso",   filetime_to_iso },
+    };
+
+    printf("%llu conversions\n", (unsigned long long)n);
+    printf("%-20s %12s %12s\n", "", "log", "random");
+    for (size_t k = 0; k < sizeof(impls) / sizeof(impls[0]); k++) {
+        uint64_t sum1, sum2;
+        double a = bench(impls[k].fn, log_times, count, n, &sum1);
+        double b = bench(impls[k].fn, rnd_times, count, n, &sum2);
+        printf("%-20s %9.2f ns %9.2f ns   (%.2f s, %.2f s) [%llu]\n", impls[k].name,
+               a * 1e9 / (double)n, b * 1e9 / (double)n, a, b,
+               (unsigned long long)((sum1 + sum2) & 0xffff));
+    }
+
+    free(log_times);
+    free(rnd_times);
+    return 0;
+}
@@ -0,0 +1,202 @@
+// bench_utf16le.c
+//
+// Compare the UTF-16LE -> UTF-8 conversion of utf16le.c with iconv.
+//
+// The strings are taken from an EVTX file, like `strings -el` does:
+// every run of 4 or more printable UTF-16LE characters. A few non-ASCII
+// strings (Japanese, a surrogate pair) are added to cover the slow path.
+// Every implementation is first checked against iconv on all strings.
+//
+// Build the program (add -liconv on macOS)
+//    gcc -Wall -Wextra -O2 -std=c11 -D_DEFAULT_SOURCE -o bench_utf16le bench_utf16le.c utf16le.c out_sink.c
+//
+// Run
+//    ./bench_utf16le ../test_data/sample.evtx [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <iconv.h>
+
+#include "utf16le.h"
+
+
+typedef struct {
+    const uint16_t *data;
+    size_t count;
+} SAMPLE;
+
+typedef size_t (*CONVERT_FN)(const uint16_t *, size_t, char *);
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static int is_text_unit(uint16_t c)
+{
+    return (c >= 0x20 && c < 0x7f) || (c >= 0x3040 && c < 0x9fff);
+}
+
+
+// collect the UTF-16LE strings of buf, terminated by a U+0000 when there is one
+static size_t collect_samples(const uint8_t *buf, size_t size, SAMPLE *samples, size_t max)
+{
+    size_t n = 0;
+    size_t i = 0;
+
+    while (i + 2 <= size && n < max) {
+        size_t start = i;
+        while (i + 2 <= size && is_text_unit((uint16_t)(buf[i] | (buf[i + 1] << 8)))) {
+            i += 2;
+        }
+        size_t count = (i - start) / 2;
+        if (count >= 4) {
+            samples[n].data  = (const uint16_t *)&buf[start];
+            samples[n].count = count;
+            n++;
+        }
+        i = (i == start) ? i + 1 : i;
+    }
+    return n;
+}
+
+
+static size_t iconv_convert(iconv_t cd, const uint16_t *src, size_t count, char *dst)
+{
+    char *in = (char *)src;
+    char *out = dst;
+    size_t in_left = count * 2;
+    size_t out_left = UTF16LE_UTF8_SIZE(count) - 1;
+
+    iconv(cd, NULL, NULL, NULL, NULL);
+    if (iconv(cd, &in, &in_left, &out, &out_left) == (size_t)-1) {
+        return (size_t)-1;
+    }
+    *out = '\0';
+    return (size_t)(out - dst);
+}
+
+
+// same cost as the old print_utf16le_string(): open, malloc, convert, close
+static size_t iconv_per_call(const uint16_t *src, size_t count, char *dst)
+{
+    iconv_t cd = iconv_open("UTF-8", "UTF-16LE");
+    char *buf = malloc(count * 4 + 1);
+    size_t len = iconv_convert(cd, src, count, buf);
+    if (len != (size_t)-1) memcpy(dst, buf, len + 1);
+    free(buf);
+    iconv_close(cd);
+    return len;
+}
+
+
+static double run(CONVERT_FN fn, const SAMPLE *samples, size_t n, char *dst, int rounds, size_t *bytes)
+{
+    double best = 0;
+
+    for (int r = 0; r < rounds; r++) {
+        size_t total = 0;
+        double t0 = now_sec();
+        for (size_t k = 0; k < n; k++) {
+            total += fn(samples[k].data, samples[k].count, dst);
+        }
+        double t = now_sec() - t0;
+        if (r == 0 || t < best) best = t;
+        *bytes = total;
+    }
+    return best;
+}
+
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s evtxfile [rounds]\n", argv[0]);
+        return 1;
+    }
+    int rounds = (argc > 2) ? atoi(argv[2]) : 5;
+    if (rounds < 1) rounds = 1;
+
+    FILE *fp = fopen(argv[1], "rb");
+    if (!fp) {
+        perror(argv[1]);
+        return 1;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *buf = malloc((size_t)size + 2);
+    if (!buf || fread(buf, 1, (size_t)size, fp) != (size_t)size) {
+        fprintf(stderr, "ERROR: can not read %s\n", argv[1]);
+        return 1;
+    }
+    fclose(fp);
+
+    static const uint16_t extra[][8] = {
+        { 0x65e5, 0x672c, 0x8a9e, 0x306e, 0x30ed, 0x30b0, 0 },                 // 日本語のログ
+        { 'C', ':', 0x005c, 0x30e6, 0x30fc, 0x30b6, 0x30fc, 0 },               // C:\ユーザー
+        { 'e', 'm', 'o', 'j', 'i', 0xd83d, 0xde00, 0 },                         // surrogate pair
+    };
+
+    size_t max = (size_t)size / 8 + 3;
+    SAMPLE *samples = malloc(max * sizeof(SAMPLE));
+    size_t n = collect_samples(buf, (size_t)size, samples, max - 3);
+    for (size_t k = 0; k < 3; k++) {
+        samples[n].data  = extra[k];
+        samples[n].count = 8;
+        n++;
+    }
+
+    size_t longest = 0;
+    for (size_t k = 0; k < n; k++) {
+        if (samples[k].count > longest) longest = samples[k].count;
+    }
+    char *dst = malloc(UTF16LE_UTF8_SIZE(longest));
+    char *ref = malloc(UTF16LE_UTF8_SIZE(longest));
+
+    struct { const char *name; CONVERT_FN fn; } impls[] = {
+        { "scalar", utf16le_to_utf8_scalar },
+#if defined(__x86_64__) || defined(__i386__)
+        { "sse2",   utf16le_to_utf8_sse2 },
+        { "avx2",   __builtin_cpu_supports("avx2") ? utf16le_to_utf8_avx2 : NULL },
+#endif
+        { "iconv",  iconv_per_call },
+    };
+    size_t impl_count = sizeof(impls) / sizeof(impls[0]);
+
+    // check against iconv, which stops at U+0000 only through strlen()
+    iconv_t cd = iconv_open("UTF-8", "UTF-16LE");
+    for (size_t k = 0; k < n; k++) {
+        if (iconv_convert(cd, samples[k].data, samples[k].count, ref) == (size_t)-1) continue;
+        for (size_t m = 0; m < impl_count; m++) {
+            if (!impls[m].fn) continue;
+            impls[m].fn(samples[k].data, samples[k].count, dst);
+            if (strcmp(dst, ref) != 0) {
+                fprintf(stderr, "MISMATCH: %s on string #%zu\n", impls[m].name, k);
+                return 1;
+            }
+        }
+    }
+    iconv_close(cd);
+
+    printf("%zu strings, runtime choice: %s\n", n, utf16le_impl_name());
+    for (size_t m = 0; m < impl_count; m++) {
+        if (!impls[m].fn) continue;
+        size_t bytes = 0;
+        double t = run(impls[m].fn, samples, n, dst, rounds, &bytes);
+        printf("%-8s %8.3f ms  %7.1f MB/s\n", impls[m].name, t * 1e3, t > 0 ? bytes / t / 1e6 : 0);
+    }
+
+    free(dst);
+    free(ref);
+    free(samples);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,209 @@
+/*
+ * crc32.c
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#define CRC32_X86 1
+#include <immintrin.h>
+#endif
+
+#include "crc32.h"
+
+
+
+// ------------------------------------------------------------
+// slicing-by-8
+// ------------------------------------------------------------
+// crc32_table[0] is the usual byte at a time table, crc32_table[k] moves a
+// byte k more bytes forward, so 8 bytes are done with 8 lookups and no
+// dependency between them. EVTX is little endian and so are we (the headers
+// are read as packed structs), the 8 bytes are read as two uint32_t.
+
+static uint32_t crc32_table[8][256];
+
+static void crc32_init_table(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+        }
+        crc32_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t c = crc32_table[k - 1][i];
+            crc32_table[k][i] = (c >> 8) ^ crc32_table[0][c & 0xff];
+        }
+    }
+}
+
+
+uint32_t crc32_update_slice8(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+    crc = ~crc;
+
+    while (len >= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, p, 4);
+        memcpy(&hi, p + 4, 4);
+        lo ^= crc;
+        crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff] ^
+              crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24] ^
+              crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff] ^
+              crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+        p   += 8;
+        len -= 8;
+    }
+    while (len--) {
+        crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+
+
+#if defined(CRC32_X86)
+
+// ------------------------------------------------------------
+// PCLMULQDQ folding
+// ------------------------------------------------------------
+// "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ Instruction"
+// (Intel, 2009), in the bit reflected domain: four 128-bit lanes are folded
+// 64 bytes forward at a time with carry-less multiplications by x^(512+-64)
+// mod P, then folded into one lane, down to 64 bits, and Barrett reduced to
+// the 32-bit CRC. len must be a multiple of 16 and at least 64, crc is the
+// inverted state (as inside crc32_update_slice8).
+
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *p, size_t len)
+{
+    // k1..k5 and the polynomial with its Barrett constant, from the paper
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+    __m128i t;
+
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    p   += 64;
+    len -= 64;
+
+    // four lanes, 64 bytes at a time
+    while (len >= 64) {
+        __m128i t1 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i t2 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i t3 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i t4 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, t1), _mm_loadu_si128((const __m128i *)(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, t2), _mm_loadu_si128((const __m128i *)(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, t3), _mm_loadu_si128((const __m128i *)(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, t4), _mm_loadu_si128((const __m128i *)(p + 0x30)));
+
+        p   += 64;
+        len -= 64;
+    }
+
+    // the four lanes into one
+    t  = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), t);
+
+    t  = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), t);
+
+    t  = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), t);
+
+    // what is left, 16 bytes at a time
+    while (len >= 16) {
+        t  = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)p)), t);
+        p   += 16;
+        len -= 16;
+    }
+
+    // 128 -> 64 bits
+    t  = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), t);
+
+    t  = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, t);
+
+    // Barrett reduction to 32 bits
+    t  = _mm_clmulepi64_si128(_mm_and_si128(x1, mask32), poly, 0x10);
+    t  = _mm_clmulepi64_si128(_mm_and_si128(t, mask32), poly, 0x00);
+    x1 = _mm_xor_si128(x1, t);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+
+uint32_t crc32_update_pclmul(uint32_t crc, const void *buf, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buf;
+
+    // short pieces (the 120 bytes of a header) are not worth the setup
+    if (len >= 64) {
+        size_t n = len & ~(size_t)15;
+        crc = ~crc32_fold_pclmul(~crc, p, n);
+        p   += n;
+        len -= n;
+    }
+    return crc32_update_slice8(crc, p, len);
+}
+
+#endif
+
+
+// chosen once at startup from the CPU features
+static uint32_t (*crc32_impl)(uint32_t, const void *, size_t) = crc32_update_slice8;
+static const char *crc32_impl_label = "slice8";
+
+__attribute__((constructor))
+static void crc32_select_impl(void)
+{
+    crc32_init_table();
+#if defined(CRC32_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc32_impl = crc32_update_pclmul;
+        crc32_impl_label = "pclmul";
+    }
+#endif
+}
+
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+    return crc32_impl(crc, buf, len);
+}
+
+
+const char *crc32_impl_name(void)
+{
+    return crc32_impl_label;
+}
@@ -0,0 +1,27 @@
+/*
+ * crc32.h
+ *
+ * CRC-32 (ISO-HDLC, the one of zlib and EVTX: reflected polynomial 0xEDB88320)
+ */
+
+#if !defined( CRC32_H )
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// crc32_update(0, "123456789", 9) == 0xCBF43926, crc is the result of the
+// previous piece (0 for the first one), so crc32_update(crc32_update(0, a), b)
+// is the CRC of a and b together.
+// uses PCLMULQDQ when the CPU has it, see crc32_impl_name()
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+const char *crc32_impl_name(void);
+
+// the implementations, for the benchmark
+uint32_t crc32_update_slice8(uint32_t crc, const void *buf, size_t len);
+#if defined(__x86_64__)
+uint32_t crc32_update_pclmul(uint32_t crc, const void *buf, size_t len);
+#endif
+
+#endif
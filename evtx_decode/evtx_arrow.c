@@ -0,0 +1,735 @@
+/* evtx_arrow.c
+ *
+ * Arrow IPC stream writer, see evtx_arrow.h
+ *
+ * An IPC stream is a row of messages, each one
+ *     0xFFFFFFFF, int32 metadata size, Message flatbuffer (padded to 8), body
+ * and 0xFFFFFFFF 0x00000000 at the end. The body of a record batch is the
+ * column buffers back to back, each padded to 8 bytes.
+ *
+ * The Message flatbuffers (Schema.fbs / Message.fbs of the Arrow format) are
+ * built by the small builder below: like every flatbuffers builder it writes
+ * from the end of the buffer to the front, children before their parents.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "evtx_arrow.h"
+#include "evtx_record.h"
+#include "evtx_binxml.h"
+#include "utf16le.h"
+
+
+#define PAD8(n)     (((n) + 7) & ~(size_t)7)
+
+// flush a batch early when the strings get this large (offsets are int32)
+#define EVTX_ARROW_BATCH_BYTES  (64 * 1024 * 1024)
+
+
+
+// ------------------------------------------------------------
+// flatbuffers builder
+// ------------------------------------------------------------
+// the metadata of a message is small (the schema is about 1KB),
+// so a fixed buffer is enough. the host is little endian, as everywhere here
+
+#define FB_SIZE         4096
+#define FB_MAX_FIELDS   8
+
+typedef struct _FB {
+    uint8_t  buf[FB_SIZE];
+    size_t   head;                      // the data is buf[head .. FB_SIZE)
+    size_t   minalign;
+    uint32_t vtable[FB_MAX_FIELDS];     // fields of the open table, as fb_size() after each
+    int      vt_count;
+    uint32_t object_end;
+    int      error;                     // buffer too small
+} FB;
+
+static void fb_init(FB *b)
+{
+    b->head     = FB_SIZE;
+    b->minalign = 1;
+    b->error    = 0;
+}
+
+// offsets are counted from the end of the buffer
+static uint32_t fb_size(const FB *b)
+{
+    return (uint32_t)(FB_SIZE - b->head);
+}
+
+static void fb_place(FB *b, const void *p, size_t n)
+{
+    if (b->head < n) {
+        b->error = 1;
+        return;
+    }
+    b->head -= n;
+    memcpy(&b->buf[b->head], p, n);
+}
+
+// pad so that after `additional` more bytes the buffer is aligned to `align`
+static void fb_prep(FB *b, size_t align, size_t additional)
+{
+    if (align > b->minalign) b->minalign = align;
+
+    size_t pad = (~((size_t)fb_size(b) + additional) + 1) & (align - 1);
+    static const uint8_t zeros[8];
+    fb_place(b, zeros, pad);
+}
+
+static void fb_u8(FB *b, uint8_t v)   { fb_prep(b, 1, 0); fb_place(b, &v, 1); }
+static void fb_u16(FB *b, uint16_t v) { fb_prep(b, 2, 0); fb_place(b, &v, 2); }
+static void fb_i32(FB *b, int32_t v)  { fb_prep(b, 4, 0); fb_place(b, &v, 4); }
+static void fb_i64(FB *b, int64_t v)  { fb_prep(b, 8, 0); fb_place(b, &v, 8); }
+
+// a reference to an object written before (off is its fb_size())
+static void fb_uoffset(FB *b, uint32_t off)
+{
+    fb_prep(b, 4, 0);
+    uint32_t v = fb_size(b) - off + 4;
+    fb_place(b, &v, 4);
+}
+
+
+static void fb_start_table(FB *b)
+{
+    memset(b->vtable, 0, sizeof(b->vtable));
+    b->vt_count   = 0;
+    b->object_end = fb_size(b);
+}
+
+static void fb_slot(FB *b, int id)
+{
+    b->vtable[id] = fb_size(b);
+    if (id + 1 > b->vt_count) b->vt_count = id + 1;
+}
+
+static void fb_add_u8(FB *b, int id, uint8_t v)        { fb_u8(b, v);      fb_slot(b, id); }
+static void fb_add_u16(FB *b, int id, uint16_t v)      { fb_u16(b, v);     fb_slot(b, id); }
+static void fb_add_i32(FB *b, int id, int32_t v)       { fb_i32(b, v);     fb_slot(b, id); }
+static void fb_add_i64(FB *b, int id, int64_t v)       { fb_i64(b, v);     fb_slot(b, id); }
+static void fb_add_offset(FB *b, int id, uint32_t off) { fb_uoffset(b, off); fb_slot(b, id); }
+
+// the table starts with the offset to its vtable, written just in front of it
+static uint32_t fb_end_table(FB *b)
+{
+    fb_i32(b, 0);
+    uint32_t object = fb_size(b);
+
+    for (int i = b->vt_count - 1; i >= 0; i--) {
+        fb_u16(b, b->vtable[i] ? (uint16_t)(object - b->vtable[i]) : 0);
+    }
+    fb_u16(b, (uint16_t)(object - b->object_end));      // table size
+    fb_u16(b, (uint16_t)((b->vt_count + 2) * 2));       // vtable size
+
+    if (!b->error) {
+        int32_t soffset = (int32_t)(fb_size(b) - object);
+        memcpy(&b->buf[FB_SIZE - object], &soffset, 4);
+    }
+    return object;
+}
+
+static uint32_t fb_string(FB *b, const char *s)
+{
+    uint32_t n = (uint32_t)strlen(s);
+    fb_prep(b, 4, n + 1);
+    fb_place(b, "", 1);
+    fb_place(b, s, n);
+    fb_place(b, &n, 4);
+    return fb_size(b);
+}
+
+static uint32_t fb_offset_vector(FB *b, const uint32_t *offs, uint32_t n)
+{
+    fb_prep(b, 4, (size_t)n * 4);
+    for (uint32_t i = n; i-- > 0; ) {
+        fb_uoffset(b, offs[i]);
+    }
+    fb_place(b, &n, 4);
+    return fb_size(b);
+}
+
+// vector of structs of two int64 (FieldNode, Buffer)
+static uint32_t fb_pair_vector(FB *b, const int64_t (*pairs)[2], uint32_t n)
+{
+    fb_prep(b, 4, (size_t)n * 16);
+    fb_prep(b, 8, (size_t)n * 16);
+    for (uint32_t i = n; i-- > 0; ) {
+        fb_place(b, &pairs[i][1], 8);
+        fb_place(b, &pairs[i][0], 8);
+    }
+    fb_place(b, &n, 4);
+    return fb_size(b);
+}
+
+static void fb_finish(FB *b, uint32_t root)
+{
+    fb_prep(b, b->minalign, 4);
+    fb_uoffset(b, root);
+}
+
+
+
+// ------------------------------------------------------------
+// Arrow messages
+// ------------------------------------------------------------
+
+// values of the Arrow format
+#define ARROW_METADATA_V5       4
+#define ARROW_HEADER_SCHEMA     1
+#define ARROW_HEADER_BATCH      3
+#define ARROW_TYPE_INT          2
+#define ARROW_TYPE_UTF8         5
+#define ARROW_TYPE_TIMESTAMP    10
+#define ARROW_UNIT_NANOSECOND   3
+
+// 100ns ticks from 1601-01-01 to 1970-01-01
+#define FILETIME_UNIX_EPOCH     116444736000000000LL
+
+
+enum { COL_FIXED, COL_TIMESTAMP, COL_UTF8 };
+
+enum {
+    COL_RECORD_ID,
+    COL_TIMESTAMP_NS,
+    COL_EVENT_ID,
+    COL_LEVEL,
+    COL_PROVIDER,
+    COL_CHANNEL,
+    COL_COMPUTER,
+    COL_EVENT_DATA,
+    COL_COUNT
+};
+
+static const struct {
+    const char *name;
+    uint8_t     kind;       // COL_FIXED etc
+    uint8_t     width;      // bytes of a fixed width value
+    uint8_t     nullable;
+} arrow_columns[COL_COUNT] = {
+    { "record_id",  COL_FIXED,     8, 0 },
+    { "timestamp",  COL_TIMESTAMP, 8, 0 },
+    { "event_id",   COL_FIXED,     2, 1 },
+    { "level",      COL_FIXED,     1, 1 },
+    { "provider",   COL_UTF8,      0, 1 },
+    { "channel",    COL_UTF8,      0, 1 },
+    { "computer",   COL_UTF8,      0, 1 },
+    { "event_data", COL_UTF8,      0, 0 },
+};
+
+
+// write one message: metadata from b (the header table is already in it), then the body
+static void arrow_write_message(OUT_SINK *out, FB *b, uint8_t header_type, uint32_t header, int64_t body_length)
+{
+    fb_start_table(b);
+    fb_add_i64(b, 3, body_length);
+    fb_add_offset(b, 2, header);
+    fb_add_u16(b, 0, ARROW_METADATA_V5);
+    fb_add_u8(b, 1, header_type);
+    fb_finish(b, fb_end_table(b));
+
+    if (b->error) {
+        fprintf(stderr, "ERROR: Arrow message metadata too large\n");
+        return;
+    }
+
+    // the body must start 8 bytes aligned, the prefix is 8 bytes
+    uint32_t size = fb_size(b);
+    int32_t  prefix[2] = { -1, (int32_t)PAD8(size) };
+    static const uint8_t zeros[8];
+
+    out_write(out, prefix, sizeof(prefix));
+    out_write(out, &b->buf[b->head], size);
+    out_write(out, zeros, PAD8(size) - size);
+}
+
+
+static uint32_t arrow_field(FB *b, int col)
+{
+    uint8_t  type_type;
+    uint32_t type;
+
+    switch (arrow_columns[col].kind) {
+        case COL_FIXED:
+            fb_start_table(b);
+            fb_add_i32(b, 0, arrow_columns[col].width * 8);     // bitWidth
+            fb_add_u8(b, 1, 0);                                 // is_signed
+            type = fb_end_table(b);
+            type_type = ARROW_TYPE_INT;
+            break;
+
+        case COL_TIMESTAMP:
+        {
+            uint32_t tz = fb_string(b, "UTC");
+            fb_start_table(b);
+            fb_add_offset(b, 1, tz);
+            fb_add_u16(b, 0, ARROW_UNIT_NANOSECOND);
+            type = fb_end_table(b);
+            type_type = ARROW_TYPE_TIMESTAMP;
+            break;
+        }
+
+        default:
+            fb_start_table(b);
+            type = fb_end_table(b);
+            type_type = ARROW_TYPE_UTF8;
+            break;
+    }
+
+    uint32_t name     = fb_string(b, arrow_columns[col].name);
+    uint32_t children = fb_offset_vector(b, NULL, 0);
+
+    fb_start_table(b);
+    fb_add_offset(b, 0, name);
+    fb_add_offset(b, 3, type);
+    fb_add_offset(b, 5, children);
+    fb_add_u8(b, 1, arrow_columns[col].nullable);
+    fb_add_u8(b, 2, type_type);
+    return fb_end_table(b);
+}
+
+
+static void arrow_write_schema(OUT_SINK *out)
+{
+    FB b;
+    fb_init(&b);
+
+    uint32_t fields[COL_COUNT];
+    for (int col = 0; col < COL_COUNT; col++) {
+        fields[col] = arrow_field(&b, col);
+    }
+    uint32_t field_vector = fb_offset_vector(&b, fields, COL_COUNT);
+
+    fb_start_table(&b);
+    fb_add_offset(&b, 1, field_vector);
+    fb_add_u16(&b, 0, 0);                   // little endian
+    uint32_t schema = fb_end_table(&b);
+
+    arrow_write_message(out, &b, ARROW_HEADER_SCHEMA, schema, 0);
+}
+
+
+
+// ------------------------------------------------------------
+// columns
+// ------------------------------------------------------------
+
+typedef struct _ARROW_COLUMN {
+    OUT_SINK values;        // fixed width values, or the UTF-8 bytes
+    OUT_SINK offsets;       // int32, utf8 columns only
+    OUT_SINK validity;      // bitmap, nullable columns only
+    int64_t  null_count;
+    int      has_value;     // the current row got a value
+    uint64_t value;         // fixed width value of the current row
+} ARROW_COLUMN;
+
+enum { SEC_NONE, SEC_SYSTEM, SEC_DATA };
+
+struct _EVTX_ARROW {
+    OUT_SINK    *out;
+    EVTX_SAX     sax;
+    ARROW_COLUMN cols[COL_COUNT];
+    uint32_t     rows;          // in the current batch
+
+    // where the walk is in the record
+    uint32_t     depth;
+    int          section;       // SEC_*: which child of <Event>
+    int          field;         // COL_* the next value goes to, -1 for none
+    int          text_field;    // COL_* of the text of the open element
+    int          in_text;       // after ">": values are element text
+    int          key_attr;      // the pending attribute is Name: an EventData key
+    int          pair_open;     // a JSON "key":"value is open
+    int          pairs;         // JSON pairs of this record
+    const char  *element;       // innermost open element
+};
+
+
+static void arrow_start_batch(EVTX_ARROW *w)
+{
+    w->rows = 0;
+    for (int col = 0; col < COL_COUNT; col++) {
+        ARROW_COLUMN *c = &w->cols[col];
+        c->values.len   = 0;
+        c->offsets.len  = 0;
+        c->validity.len = 0;
+        c->null_count   = 0;
+        if (arrow_columns[col].kind == COL_UTF8) {
+            int32_t zero = 0;
+            out_write(&c->offsets, &zero, 4);
+        }
+    }
+}
+
+static void column_end_row(ARROW_COLUMN *c, int col, uint32_t row)
+{
+    if (arrow_columns[col].nullable) {
+        if ((row & 7) == 0) out_putc(&c->validity, 0);
+        if (c->has_value && c->validity.len) c->validity.buf[c->validity.len - 1] |= (char)(1 << (row & 7));
+        if (!c->has_value) c->null_count++;
+    }
+
+    if (arrow_columns[col].kind == COL_UTF8) {
+        int32_t end = (int32_t)c->values.len;
+        out_write(&c->offsets, &end, 4);
+    } else {
+        out_write(&c->values, &c->value, arrow_columns[col].width);
+    }
+    c->has_value = 0;
+    c->value     = 0;
+}
+
+
+static void arrow_write_batch(EVTX_ARROW *w)
+{
+    if (w->rows == 0) return;
+
+    int64_t nodes[COL_COUNT][2];
+    int64_t buffers[COL_COUNT * 3][2];
+    const OUT_SINK *body[COL_COUNT * 3];
+    uint32_t nb = 0;
+    int64_t  body_length = 0;
+
+    // validity (empty without nulls), offsets for utf8, values
+    for (int col = 0; col < COL_COUNT; col++) {
+        ARROW_COLUMN *c = &w->cols[col];
+        nodes[col][0] = w->rows;
+        nodes[col][1] = c->null_count;
+
+        const OUT_SINK *parts[3] = {
+            c->null_count ? &c->validity : NULL,
+            (arrow_columns[col].kind == COL_UTF8) ? &c->offsets : NULL,
+            &c->values
+        };
+        for (int p = 0; p < 3; p++) {
+            if (p == 1 && !parts[1]) continue;
+            size_t len = parts[p] ? parts[p]->len : 0;
+            buffers[nb][0] = body_length;
+            buffers[nb][1] = (int64_t)len;
+            body[nb++] = parts[p];
+            body_length += (int64_t)PAD8(len);
+        }
+    }
+
+    FB b;
+    fb_init(&b);
+    uint32_t node_vector   = fb_pair_vector(&b, (const int64_t (*)[2])nodes, COL_COUNT);
+    uint32_t buffer_vector = fb_pair_vector(&b, (const int64_t (*)[2])buffers, nb);
+    fb_start_table(&b);
+    fb_add_i64(&b, 0, w->rows);
+    fb_add_offset(&b, 1, node_vector);
+    fb_add_offset(&b, 2, buffer_vector);
+    uint32_t batch = fb_end_table(&b);
+
+    arrow_write_message(w->out, &b, ARROW_HEADER_BATCH, batch, body_length);
+
+    static const uint8_t zeros[8];
+    for (uint32_t n = 0; n < nb; n++) {
+        if (!body[n]) continue;
+        out_write(w->out, body[n]->buf, body[n]->len);
+        out_write(w->out, zeros, PAD8(body[n]->len) - body[n]->len);
+    }
+
+    arrow_start_batch(w);
+}
+
+
+
+// ------------------------------------------------------------
+// values
+// ------------------------------------------------------------
+
+// append a value as UTF-8 text, strings are converted in place
+static void put_text(OUT_SINK *s, uint8_t type, const void *ptr, uint32_t size)
+{
+    switch (type) {
+        case 0x00:
+            break;
+        case 0x01:
+        {
+            size_t count = size / 2;
+            if (out_reserve(s, UTF16LE_UTF8_SIZE(count)) == 0) {
+                s->len += utf16le_to_utf8((const uint16_t *)ptr, count, &s->buf[s->len]);
+            }
+            break;
+        }
+        case EVTX_SAX_TEXT_UTF8:
+            out_write(s, ptr, size);
+            break;
+        default:
+            if (size) print_value(s, type, ptr, size);
+            break;
+    }
+}
+
+// escape what was appended to s since start for a JSON string, usually nothing
+static void json_escape_from(OUT_SINK *s, size_t start)
+{
+    size_t i = start;
+    while (i < s->len) {
+        unsigned char c = (unsigned char)s->buf[i];
+        if (c == '"' || c == '\\' || c < 0x20) break;
+        i++;
+    }
+    if (i == s->len) return;
+
+    size_t n = s->len - i;
+    char *tail = malloc(n);
+    if (!tail) {
+        s->len = i;
+        return;
+    }
+    memcpy(tail, &s->buf[i], n);
+    s->len = i;
+
+    for (size_t k = 0; k < n; k++) {
+        unsigned char c = (unsigned char)tail[k];
+        switch (c) {
+            case '"':  out_puts(s, "\\\""); break;
+            case '\\': out_puts(s, "\\\\"); break;
+            case '\n': out_puts(s, "\\n");  break;
+            case '\r': out_puts(s, "\\r");  break;
+            case '\t': out_puts(s, "\\t");  break;
+            default:
+                if (c < 0x20) {
+                    out_puts(s, "\\u00");
+                    out_hex(s, c, 2);
+                } else {
+                    out_putc(s, (char)c);
+                }
+                break;
+        }
+    }
+    free(tail);
+}
+
+static void json_put(OUT_SINK *s, uint8_t type, const void *ptr, uint32_t size)
+{
+    size_t start = s->len;
+    put_text(s, type, ptr, size);
+    json_escape_from(s, start);
+}
+
+
+// EventData as {"key":"value",...}: the key is the Name attribute, or the element name
+static void pair_open(EVTX_ARROW *w, uint8_t key_type, const void *key, uint32_t key_size)
+{
+    OUT_SINK *s = &w->cols[COL_EVENT_DATA].values;
+    if (w->pairs++) out_putc(s, ',');
+    out_putc(s, '"');
+    json_put(s, key_type, key, key_size);
+    out_puts(s, "\":\"");
+    w->pair_open = 1;
+}
+
+static void pair_close(EVTX_ARROW *w)
+{
+    if (!w->pair_open) return;
+    out_putc(&w->cols[COL_EVENT_DATA].values, '"');
+    w->pair_open = 0;
+}
+
+
+
+// ------------------------------------------------------------
+// SAX callbacks
+// ------------------------------------------------------------
+
+static int arrow_on_record_begin(void *user, const EVTX_RECORD_HEADER *rh)
+{
+    EVTX_ARROW *w = user;
+
+    w->depth     = 0;
+    w->section   = SEC_NONE;
+    w->field     = -1;
+    w->text_field = -1;
+    w->in_text   = 0;
+    w->key_attr  = 0;
+    w->pair_open = 0;
+    w->pairs     = 0;
+
+    w->cols[COL_RECORD_ID].value     = rh->record_identifier;
+    w->cols[COL_RECORD_ID].has_value = 1;
+    w->cols[COL_TIMESTAMP_NS].value  = (uint64_t)(((int64_t)rh->timestamp - FILETIME_UNIX_EPOCH) * 100);
+    w->cols[COL_TIMESTAMP_NS].has_value = 1;
+
+    out_putc(&w->cols[COL_EVENT_DATA].values, '{');
+    w->cols[COL_EVENT_DATA].has_value = 1;
+    return 0;
+}
+
+static void arrow_on_element_open(void *user, const char *name, uint32_t len)
+{
+    EVTX_ARROW *w = user;
+    (void)len;
+
+    pair_close(w);      // the text of the parent ends here
+    w->depth++;
+    w->element  = name;
+    w->field    = -1;
+    w->in_text  = 0;
+    w->key_attr = 0;
+    w->text_field = -1;
+
+    if (w->depth == 2) {
+        if (strcmp(name, "System") == 0) w->section = SEC_SYSTEM;
+        else if (strcmp(name, "EventData") == 0 || strcmp(name, "UserData") == 0) w->section = SEC_DATA;
+        else w->section = SEC_NONE;
+    }
+    else if (w->depth == 3 && w->section == SEC_SYSTEM) {
+        if (strcmp(name, "EventID") == 0)       w->text_field = COL_EVENT_ID;
+        else if (strcmp(name, "Level") == 0)    w->text_field = COL_LEVEL;
+        else if (strcmp(name, "Channel") == 0)  w->text_field = COL_CHANNEL;
+        else if (strcmp(name, "Computer") == 0) w->text_field = COL_COMPUTER;
+    }
+}
+
+static void arrow_on_attribute(void *user, const char *name, uint32_t len)
+{
+    EVTX_ARROW *w = user;
+    (void)len;
+
+    w->field    = -1;
+    w->key_attr = 0;
+
+    if (w->section == SEC_SYSTEM && w->depth == 3 &&
+            strcmp(w->element, "Provider") == 0 && strcmp(name, "Name") == 0) {
+        w->field = COL_PROVIDER;
+    }
+    else if (w->section == SEC_DATA && w->depth >= 3 && strcmp(name, "Name") == 0) {
+        w->key_attr = 1;
+    }
+}
+
+static void arrow_on_start_tag_end(void *user)
+{
+    EVTX_ARROW *w = user;
+    w->field    = w->text_field;
+    w->key_attr = 0;
+    w->in_text  = 1;
+}
+
+static void arrow_on_value(void *user, uint8_t type, const void *ptr, uint32_t size)
+{
+    EVTX_ARROW *w = user;
+
+    if (w->key_attr) {
+        pair_open(w, type, ptr, size);
+        w->key_attr = 0;
+        return;
+    }
+
+    if (w->field >= 0) {
+        ARROW_COLUMN *c = &w->cols[w->field];
+        if (arrow_columns[w->field].kind == COL_UTF8) {
+            if (type != 0x00) {
+                put_text(&c->values, type, ptr, size);
+                c->has_value = 1;
+            }
+        } else {
+            int32_t v = value_as_uint16(type, ptr, size);
+            if (v >= 0 && (arrow_columns[w->field].width == 2 || v <= 0xff)) {
+                c->value     = (uint64_t)v;
+                c->has_value = 1;
+            }
+        }
+        return;
+    }
+
+    if (w->in_text && w->section == SEC_DATA && w->depth >= 3) {
+        if (!w->pair_open) pair_open(w, EVTX_SAX_TEXT_UTF8, w->element, (uint32_t)strlen(w->element));
+        json_put(&w->cols[COL_EVENT_DATA].values, type, ptr, size);
+    }
+}
+
+static void arrow_on_element_close(void *user)
+{
+    EVTX_ARROW *w = user;
+    pair_close(w);
+    w->depth--;
+    w->field      = -1;
+    w->text_field = -1;
+    w->in_text    = 1;      // back in the content of the parent
+}
+
+static void arrow_on_record_end(void *user, const EVTX_RECORD_HEADER *rh)
+{
+    EVTX_ARROW *w = user;
+    (void)rh;
+
+    pair_close(w);
+    out_putc(&w->cols[COL_EVENT_DATA].values, '}');
+
+    for (int col = 0; col < COL_COUNT; col++) {
+        column_end_row(&w->cols[col], col, w->rows);
+    }
+    w->rows++;
+
+    if (w->rows >= EVTX_ARROW_BATCH_ROWS || w->cols[COL_EVENT_DATA].values.len >= EVTX_ARROW_BATCH_BYTES) {
+        arrow_write_batch(w);
+    }
+}
+
+
+
+// ------------------------------------------------------------
+// writer
+// ------------------------------------------------------------
+
+EVTX_ARROW *evtx_arrow_new(OUT_SINK *out)
+{
+    EVTX_ARROW *w = calloc(1, sizeof(EVTX_ARROW));
+    if (!w) {
+        perror("calloc(arrow)");
+        return NULL;
+    }
+    w->out = out;
+
+    for (int col = 0; col < COL_COUNT; col++) {
+        out_sink_init_memory(&w->cols[col].values);
+        out_sink_init_memory(&w->cols[col].offsets);
+        out_sink_init_memory(&w->cols[col].validity);
+    }
+    arrow_start_batch(w);
+
+    w->sax.user             = w;
+    w->sax.on_record_begin  = arrow_on_record_begin;
+    w->sax.on_element_open  = arrow_on_element_open;
+    w->sax.on_attribute     = arrow_on_attribute;
+    w->sax.on_start_tag_end = arrow_on_start_tag_end;
+    w->sax.on_value         = arrow_on_value;
+    w->sax.on_element_close = arrow_on_element_close;
+    w->sax.on_record_end    = arrow_on_record_end;
+
+    arrow_write_schema(out);
+    return w;
+}
+
+
+const EVTX_SAX *evtx_arrow_sax(EVTX_ARROW *w)
+{
+    return &w->sax;
+}
+
+
+void evtx_arrow_finish(EVTX_ARROW *w)
+{
+    if (!w) return;
+
+    arrow_write_batch(w);
+
+    int32_t eos[2] = { -1, 0 };
+    out_write(w->out, eos, sizeof(eos));
+
+    for (int col = 0; col < COL_COUNT; col++) {
+        out_sink_free(&w->cols[col].values);
+        out_sink_free(&w->cols[col].offsets);
+        out_sink_free(&w->cols[col].validity);
+    }
+    free(w);
+}
@@ -0,0 +1,42 @@
+/* evtx_arrow.h
+ *
+ * Apache Arrow IPC stream output (-a), no Arrow library needed.
+ *
+ * One schema message, then a record batch every EVTX_ARROW_BATCH_ROWS
+ * records, then the end-of-stream marker:
+ *
+ *   record_id    uint64
+ *   timestamp    timestamp[ns, UTC]     of the record header
+ *   event_id     uint16, nullable
+ *   level        uint8,  nullable
+ *   provider     utf8,   nullable       Provider@Name
+ *   channel      utf8,   nullable
+ *   computer     utf8,   nullable
+ *   event_data   utf8                   EventData / UserData as a JSON object
+ *
+ * The writer is a SAX consumer (evtx_sax.h): the columns are filled straight
+ * from the values of the record, UTF-16LE strings are converted once into the
+ * column buffers. Readable by pyarrow.ipc.open_stream(), DuckDB, Polars ...
+ */
+
+#if !defined( EVTX_ARROW_H )
+#define EVTX_ARROW_H
+
+#include "out_sink.h"
+#include "evtx_sax.h"
+
+
+#define EVTX_ARROW_BATCH_ROWS   65536
+
+typedef struct _EVTX_ARROW EVTX_ARROW;
+
+// start a stream on out (the schema is written at once), NULL if out of memory
+EVTX_ARROW *evtx_arrow_new(OUT_SINK *out);
+
+// the callbacks to put in EVTX_OPTIONS.sax
+const EVTX_SAX *evtx_arrow_sax(EVTX_ARROW *w);
+
+// write the last batch and the end of the stream, and free the writer
+void evtx_arrow_finish(EVTX_ARROW *w);
+
+#endif /* !defined( EVTX_ARROW_H ) */
@@ -0,0 +1,457 @@
+/* evtx_batch.c
+ *
+ * Batch mode, see evtx_batch.h
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evtx_batch.h"
+#include "evtx_chunk.h"
+#include "evtx_output.h"
+#include "evtx_arrow.h"
+#include "evtx_verify.h"
+#include "pool.h"
+
+
+typedef struct _BATCH_FILE {
+    char     *path;
+    uint8_t  *base;             // the whole file, mapped
+    size_t    size;
+    uint16_t  chunk_count;      // chunks inside the file (with OUT_SLACK those after the header's count too)
+    uint32_t  first_task;       // the file header, its chunks are the next tasks
+} BATCH_FILE;
+
+typedef struct _BATCH {
+    BATCH_FILE *files;
+    uint32_t    count;
+    uint32_t    cap;
+    uint32_t    task_count;
+
+    const EVTX_OPTIONS *opts;
+    uint32_t    output_mode;    // opts->output_mode, with OUT_SOURCE for one stream
+    const char *out_dir;
+
+    // out_dir: the output file of one input, written by the pool in task order
+    OUT_SINK    file_out;
+    int         file_out_fd;    // -1: none open
+    uint32_t    file_out_index; // its input, UINT32_MAX for none
+
+    // --verify: what each task found (EVTX_VERIFY_*), written by the task itself
+    uint8_t    *verify_status;
+} BATCH;
+
+
+
+// ------------------------------------------------------------
+// the list of files
+// ------------------------------------------------------------
+
+static int batch_add_file(BATCH *b, const char *path)
+{
+    if (b->count == b->cap) {
+        uint32_t cap = b->cap ? b->cap * 2 : 64;
+        BATCH_FILE *files = realloc(b->files, cap * sizeof(BATCH_FILE));
+        if (!files) {
+            perror("realloc(batch)");
+            return -1;
+        }
+        b->files = files;
+        b->cap   = cap;
+    }
+
+    BATCH_FILE *f = &b->files[b->count];
+    memset(f, 0, sizeof(*f));
+    f->path = strdup(path);
+    if (!f->path) {
+        perror("strdup");
+        return -1;
+    }
+    b->count++;
+    return 0;
+}
+
+static int has_evtx_suffix(const char *name)
+{
+    size_t len = strlen(name);
+    return len > 5 && strcasecmp(name + len - 5, ".evtx") == 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// every *.evtx below dir, in name order so that the output does not depend on the file system
+static void batch_add_dir(BATCH *b, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d) {
+        perror(dir);
+        return;
+    }
+
+    char **names = NULL;
+    size_t count = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.') continue;     // ".", ".." and hidden files
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            char **grown = realloc(names, cap * sizeof(char *));
+            if (!grown) break;
+            names = grown;
+        }
+        if ((names[count] = strdup(de->d_name)) != NULL) count++;
+    }
+    closedir(d);
+
+    if (count) qsort(names, count, sizeof(char *), compare_names);
+
+    size_t dir_len = strlen(dir);
+    int slash = (dir_len && dir[dir_len - 1] == '/');
+    for (size_t i = 0; i < count; i++) {
+        char path[4096];
+        struct stat st;
+        snprintf(path, sizeof(path), "%s%s%s", dir, slash ? "" : "/", names[i]);
+
+        // lstat: symbolic links to directories are not followed, no loops
+        if (lstat(path, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) batch_add_dir(b, path);
+            else if (S_ISREG(st.st_mode) && has_evtx_suffix(names[i])) batch_add_file(b, path);
+        }
+        free(names[i]);
+    }
+    free(names);
+}
+
+
+// map the file and check its header, 0 if it can be decoded.
+// --verify takes all the chunks in the file (the chunk count of the header may be broken too),
+// so does OUT_SLACK (the chunks after chunk_count are only searched for records)
+static int batch_map_file(BATCH_FILE *f, const EVTX_OPTIONS *opts)
+{
+    int fd = open(f->path, O_RDONLY);
+    if (fd < 0) {
+        perror(f->path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(EVTX_FILE_HEADER)) {
+        fprintf(stderr, "ERROR: %s: not an EVTX file\n", f->path);
+        close(fd);
+        return -1;
+    }
+
+    f->size = (size_t)st.st_size;
+    f->base = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);      // the mapping stays
+    if (f->base == MAP_FAILED) {
+        perror("mmap");
+        f->base = NULL;
+        return -1;
+    }
+
+    const EVTX_FILE_HEADER *fh = (const EVTX_FILE_HEADER *)f->base;
+    if (memcmp(fh->signature, EVTX_FILE_SIGNATURE, sizeof(EVTX_FILE_SIGNATURE)) != 0) {
+        fprintf(stderr, "ERROR: %s: invalid EVTX signature\n", f->path);
+        munmap(f->base, f->size);
+        f->base = NULL;
+        return -1;
+    }
+    madvise(f->base, f->size, MADV_SEQUENTIAL);
+
+    // only the chunks which are completely inside the file
+    size_t chunks_in_file = (f->size - EVTX_CHUNK_START_OFFSET) / EVTX_CHUNK_SIZE;
+    f->chunk_count = fh->chunk_count;
+    if (!opts->verify && chunks_in_file < f->chunk_count) {
+        fprintf(stderr, "ERROR: %s: chunk #%zu is beyond the end of file\n", f->path, chunks_in_file);
+        f->chunk_count = (uint16_t)chunks_in_file;
+    }
+    if (opts->verify || CHECK_OUTMODE(opts->output_mode, OUT_SLACK)) {
+        f->chunk_count = (chunks_in_file > UINT16_MAX) ? UINT16_MAX : (uint16_t)chunks_in_file;
+    }
+    return 0;
+}
+
+
+static BATCH_FILE *batch_file_of_task(const BATCH *b, uint32_t task_index)
+{
+    uint32_t lo = 0, hi = b->count;     // the last file with first_task <= task_index
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (b->files[mid].first_task <= task_index) lo = mid;
+        else hi = mid;
+    }
+    return &b->files[lo];
+}
+
+
+
+// ------------------------------------------------------------
+// one output file per input
+// ------------------------------------------------------------
+
+static const char *batch_output_suffix(uint32_t output_mode)
+{
+    switch (output_mode & OUTFMT_MASK) {
+        case OUT_CSV:   return ".csv";
+        case OUT_XML:   return ".xml";
+        case OUT_JSON:  return ".jsonl";
+        case OUT_ARROW: return ".arrow";
+        default:        return ".txt";
+    }
+}
+
+// <out_dir>/<input path, '/' replaced by '_'><suffix>: inputs from different
+// directories with the same name (every host has a System.evtx) do not collide
+static int batch_open_output(BATCH *b, uint32_t index)
+{
+    const char *p = b->files[index].path;
+    while (*p == '/' || (p[0] == '.' && p[1] == '/')) p += (*p == '/') ? 1 : 2;
+
+    char path[4096];
+    int len = snprintf(path, sizeof(path), "%s/", b->out_dir);
+    for (; *p && len < (int)sizeof(path) - 16; p++) {
+        path[len++] = (*p == '/') ? '_' : *p;
+    }
+    snprintf(&path[len], sizeof(path) - (size_t)len, "%s", batch_output_suffix(b->output_mode));
+
+    b->file_out_index = index;
+    b->file_out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (b->file_out_fd < 0) {
+        perror(path);
+        return -1;
+    }
+    out_sink_init_fd(&b->file_out, b->file_out_fd);
+    output_header(&b->file_out, b->output_mode);
+    return 0;
+}
+
+static void batch_close_output(BATCH *b)
+{
+    if (b->file_out_fd >= 0) {
+        out_sink_free(&b->file_out);
+        close(b->file_out_fd);
+    }
+    b->file_out_fd    = -1;
+    b->file_out_index = UINT32_MAX;
+}
+
+// the pool asks in task order, so a file is done when the next one starts.
+// when the output file can not be created the output goes to the main stream
+static OUT_SINK *batch_task_out(void *arg, uint32_t task_index)
+{
+    BATCH *b = (BATCH *)arg;
+    uint32_t index = (uint32_t)(batch_file_of_task(b, task_index) - b->files);
+
+    if (index != b->file_out_index) {
+        batch_close_output(b);
+        batch_open_output(b, index);
+    }
+    return (b->file_out_fd >= 0) ? &b->file_out : NULL;
+}
+
+
+
+// ------------------------------------------------------------
+// the tasks
+// ------------------------------------------------------------
+
+static void *batch_worker_init(void *arg)
+{
+    (void)arg;
+    EVTX_CHUNK_CTX *ctx = malloc(sizeof(EVTX_CHUNK_CTX));
+    if (ctx) evtx_chunk_ctx_init(ctx);
+    return ctx;
+}
+
+static void batch_worker_free(void *worker)
+{
+    if (!worker) return;
+    evtx_chunk_ctx_free((EVTX_CHUNK_CTX *)worker);
+    free(worker);
+}
+
+static void batch_task(void *arg, void *worker, uint32_t task_index, OUT_SINK *out)
+{
+    BATCH *b = (BATCH *)arg;
+    EVTX_CHUNK_CTX *ctx = (EVTX_CHUNK_CTX *)worker;
+    BATCH_FILE *f = batch_file_of_task(b, task_index);
+    uint32_t output_mode = b->output_mode;
+
+    // only the checksums, no decoder context needed
+    if (b->verify_status) {
+        const uint8_t *p = f->base;
+        if (task_index == f->first_task) {
+            b->verify_status[task_index] = (uint8_t)evtx_verify_file_header(out, f->path, (const EVTX_FILE_HEADER *)p);
+        } else {
+            uint32_t chunk_index = task_index - f->first_task - 1;
+            p += EVTX_CHUNK_START_OFFSET + (size_t)chunk_index * EVTX_CHUNK_SIZE;
+            b->verify_status[task_index] = (uint8_t)evtx_verify_chunk(out, f->path, p, chunk_index);
+        }
+        return;
+    }
+
+    if (task_index == f->first_task) {
+        // the formats without a Source field get the name of the file before its records
+        output_source_line(out, output_mode, f->path);
+        decode_evtx_file_header(out, (EVTX_FILE_HEADER *)f->base, output_mode, NULL);
+        return;
+    }
+
+    uint16_t chunk_index = (uint16_t)(task_index - f->first_task - 1);
+    if (!ctx) {
+        fprintf(stderr, "ERROR: no decoder context for %s chunk #%u\n", f->path, chunk_index);
+        return;
+    }
+    evtx_options_apply(b->opts, ctx);
+    ctx->source = CHECK_OUTMODE(output_mode, OUT_SOURCE) ? f->path : NULL;
+
+    size_t chunk_base = EVTX_CHUNK_START_OFFSET + (size_t)chunk_index * EVTX_CHUNK_SIZE;
+    if (chunk_index < ((const EVTX_FILE_HEADER *)f->base)->chunk_count) {
+        decode_evtx_chunk(ctx, out, f->base + chunk_base, chunk_index, output_mode);
+    } else {
+        evtx_chunk_recover(ctx, out, f->base + chunk_base, chunk_index, output_mode);
+    }
+}
+
+
+// -a: the Arrow writer is a SAX consumer, it gets the records from one thread
+// in order, so the files are decoded one after another
+static int batch_run_arrow(BATCH *b, OUT_SINK *out)
+{
+    EVTX_ARROW *arrow = NULL;
+    int rtn_code = 0;
+
+    for (uint32_t i = 0; i < b->count; i++) {
+        OUT_SINK *dst = out;
+        if (b->out_dir) {
+            batch_close_output(b);
+            if (batch_open_output(b, i) == 0) dst = &b->file_out;
+        }
+        if (!arrow && !(arrow = evtx_arrow_new(dst))) return 1;
+
+        FILE *fp = fopen(b->files[i].path, "rb");
+        if (!fp) {
+            perror(b->files[i].path);
+            rtn_code = 1;
+        } else {
+            EVTX_OPTIONS opts = *b->opts;
+            opts.sax  = evtx_arrow_sax(arrow);
+            opts.jobs = 1;
+            rtn_code |= decode_evtx_file(fp, &opts, dst);
+            fclose(fp);
+        }
+
+        // one stream per output file
+        if (b->out_dir) {
+            evtx_arrow_finish(arrow);
+            arrow = NULL;
+        }
+    }
+    evtx_arrow_finish(arrow);
+    batch_close_output(b);
+    return rtn_code;
+}
+
+
+// --verify: the report lines of the tasks in order, then the totals.
+// 1 when anything is broken
+static int batch_run_verify(BATCH *b, OUT_SINK *out)
+{
+    b->verify_status = calloc(b->task_count, 1);
+    if (!b->verify_status) {
+        perror("calloc(verify)");
+        return 1;
+    }
+
+    POOL_JOB job = { batch_task, b, NULL, NULL, NULL };
+    int rtn_code = (pool_run_ordered(b->opts->jobs, b->task_count, &job, out) != 0);
+
+    uint32_t corrupt = 0, empty = 0;
+    for (uint32_t i = 0; i < b->task_count; i++) {
+        if (b->verify_status[i] == EVTX_VERIFY_CORRUPT) corrupt++;
+        if (b->verify_status[i] == EVTX_VERIFY_EMPTY) empty++;
+    }
+    out_printf(out, "verified %" PRIu32 " file(s), %" PRIu32 " chunk(s) (%" PRIu32 " empty): %" PRIu32 " broken\n",
+               b->count, b->task_count - b->count, empty, corrupt);
+
+    free(b->verify_status);
+    b->verify_status = NULL;
+    return rtn_code | (corrupt != 0);
+}
+
+
+int decode_evtx_batch(const char *const *paths, int path_count, const EVTX_OPTIONS *opts,
+                      const char *out_dir, OUT_SINK *out)
+{
+    BATCH b;
+    memset(&b, 0, sizeof(b));
+    b.opts           = opts;
+    b.out_dir        = out_dir;
+    b.file_out_fd    = -1;
+    b.file_out_index = UINT32_MAX;
+    b.output_mode    = opts->output_mode;
+    if (!out_dir) SET_OUTMODE(b.output_mode, OUT_SOURCE);
+
+    // files as they are (whatever their name), directories are searched for *.evtx
+    for (int i = 0; i < path_count; i++) {
+        struct stat st;
+        if (stat(paths[i], &st) == 0 && S_ISDIR(st.st_mode)) batch_add_dir(&b, paths[i]);
+        else batch_add_file(&b, paths[i]);
+    }
+
+    // map them all, the ones which can not be decoded are dropped from the list
+    int rtn_code = 0;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < b.count; i++) {
+        if (batch_map_file(&b.files[i], opts) != 0) {
+            free(b.files[i].path);
+            rtn_code = 1;
+            continue;
+        }
+        b.files[kept] = b.files[i];
+        b.files[kept].first_task = b.task_count;
+        b.task_count += 1 + (uint32_t)b.files[kept].chunk_count;
+        kept++;
+    }
+    b.count = kept;
+
+    if (b.count == 0) {
+        fprintf(stderr, "ERROR: no EVTX files to decode\n");
+        free(b.files);
+        return 1;
+    }
+
+    if (opts->verify) {
+        rtn_code |= batch_run_verify(&b, out);
+    } else if (CHECK_OUTMODE(opts->output_mode, OUT_ARROW)) {
+        rtn_code |= batch_run_arrow(&b, out);
+    } else {
+        // one CSV header for the whole stream, with out_dir one per file
+        if (!out_dir) output_header(out, b.output_mode);
+
+        POOL_JOB job = { batch_task, &b, batch_worker_init, batch_worker_free,
+                         out_dir ? batch_task_out : NULL };
+        if (pool_run_ordered(opts->jobs, b.task_count, &job, out) != 0) rtn_code = 1;
+        batch_close_output(&b);
+    }
+
+    for (uint32_t i = 0; i < b.count; i++) {
+        munmap(b.files[i].base, b.files[i].size);
+        free(b.files[i].path);
+    }
+    free(b.files);
+    return rtn_code;
+}
@@ -0,0 +1,28 @@
+/* evtx_batch.h
+ *
+ * Batch mode: many EVTX files, and directories of them, in one run.
+ *
+ * All the files are mapped first and their chunks go into one task list,
+ * file after file: the file header of a file, then its chunks. The threads
+ * of the pool (pool.h) take the next task of the list whenever they are
+ * free, so the chunks of one large Security.evtx are spread over all of
+ * them while the small files are done in between.
+ *
+ * The output keeps the order of the list. Without an output directory it is
+ * one stream, where every CSV line / JSON object has the input file in a
+ * Source field (and the other formats get a "==> file <==" line before each
+ * file). With an output directory each input gets its own output file.
+ */
+
+#if !defined( EVTX_BATCH_H )
+#define EVTX_BATCH_H
+
+#include "evtx_file.h"
+
+
+// decode the files and directories (all *.evtx below them) in paths.
+// out_dir NULL: everything to out, else one file per input in out_dir
+int decode_evtx_batch(const char *const *paths, int path_count, const EVTX_OPTIONS *opts,
+                      const char *out_dir, OUT_SINK *out);
+
+#endif /* !defined( EVTX_BATCH_H ) */
@@ -12,91 +12,14 @@
 #include "timestamp.h"
 #include "hex_dump.h"
 #include "stack.h"
+#include "evtx_template.h"
 
 
 
-#pragma pack(push, 1)
-
-// Token 0x0f: BINXML Fragment
-typedef struct {
-    uint8_t  token;          // should be 0x0f
-    uint8_t  major_version;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
-    uint8_t  minor_version;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
-    uint8_t  flag;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
-                             // followed by the actual data based on the type
-} TOKEN_0F_FRAGMENT_HEADER;
-
-// Token 0x01 / 0x41: Open Element
-typedef struct {
-    uint8_t  token;          // should be 0x01 or 0x41
-    uint16_t dependency_id;  // Usually 0xFFFF
-    uint32_t element_size;   // Total size of this element branch
-    uint32_t name_offset;    // Offset to Name Descriptor
-                             // for 0x41: 4B as more_data_size 
-} TOKEN_01_OPEN_ELEMENT_HEADER;
-
-// Token 0x05: Value Token
-typedef struct {
-    uint8_t  token;          // should be 0x05
-    uint8_t  value_type;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
-                             // followed by the actual data based on the type
-} TOKEN_05_ATTRIBUTE_VALUE_HEADER;
-
-// Token 0x06 / 0x46: Attribute Name
-typedef struct {
-    uint8_t  token;          // should be 0x06 or 0x46
-    uint32_t name_offset;    // name offfset for Attribute Name
-                             // NOTE for 0x46: NO MORE 4B as more_data_size 
-} TOKEN_06_ATTRIBUTE_NAME_HEADER;
-
-
-// Token 0x36: Attribute Name   (new token found by me)
-typedef struct {
-    uint8_t  token;          // should be 0x36
-    uint8_t  unknown[4];     // Unknown/Dependency ID. Similar to the ff ff seen in 0x41, but 4 bytes. 
-                             // This might be a more complex dependency identifier.
-    uint32_t name_offset;    // name offfset for Attribute Name
-} TOKEN_36_ATTRIBUTE_NAME_HEADER;
-
-
 
 
-
-
-
-// Token 0x0d BinXmlTokenNormalSubstitution 
-// Token 0x0e BinXmlTokenOptionallSubstitution
-typedef struct {
-    uint8_t  token;      // should be 0x0d or 0x0e
-    uint16_t subs_id;    // Substitution identifier
-    uint8_t value_type;    
-} TOKEN_0E_SUBSTITUTION_HEADER;
-
-// Token 0x0C: Template Instance Header
-// the 33-byte structure including 24-byte of TEMPLATE_DEFINITION_HEADER
-// now I use the 9-byte structure only
-typedef struct {
-    uint8_t  unknown_val;         // unknown but usually seen as 0x01
-    uint32_t template_id;      // the template ID as same as template_id
-    uint32_t template_offset;   // offset to TEMPLATE_DEFINITION_HEADER, usually next 4 bytes
-} BINXML_TEMPLATE_INSTANCE_HEADER;
-
-// substitution value array
-typedef struct {
-    uint16_t size;          // raw value size
-    uint16_t type;          // EVTX value type, only 1 byte used
-    uint32_t value_offset;  // relative offset in chunk_buffer
-} EVTX_VALUE_ITEM;
-
-typedef struct {
-    uint16_t count;
-    EVTX_VALUE_ITEM *items;
-} EVTX_VALUE_TABLE;
-
-#pragma pack(pop)
-
-
-static void print_value_by_index(EVTX_VALUE_TABLE *tbl, uint8_t *chunk_buffer, uint32_t index, uint32_t output_mode, XML_TREE *xtree);
+static void print_value_by_index(EVTX_CHUNK_CTX *ctx, EVTX_VALUE_TABLE *tbl, uint32_t index);
+static void sax_value_by_index(EVTX_CHUNK_CTX *ctx, EVTX_VALUE_TABLE *tbl, uint32_t index, const EVTX_SAX *sax);
 
 
 const char* get_value_type_name(uint8_t value_type) {
@@ -144,11 +67,12 @@ const char* get_value_type_name(uint8_t value_type) {
  * @param name_off 解析したNameOffset
  * @return スキップすべきバイト数（実体がない場合は0）
  */
-static uint32_t get_inline_name_skip_bytes(uint8_t *chunk_buffer, uint32_t cursor_offset, uint32_t name_offset) 
+uint32_t get_inline_name_skip_bytes(EVTX_CHUNK_CTX *ctx, uint32_t cursor_offset, uint32_t name_offset) 
 {
+    uint8_t *chunk_buffer = ctx->chunk_buffer;
     uint32_t skip_size = 0;
 
-    //printf("DEBUG: get_inline_name_skip_bytes() cursor=0x%x\tname_offset=0x%x", cursor_offset, name_offset);
+    //out_printf(out, "DEBUG: get_inline_name_skip_bytes() cursor=0x%x\tname_offset=0x%x", cursor_offset, name_offset);
 
     if (cursor_offset == name_offset) { 
         // Name_Offset is just at the cursor, need to skip it
@@ -158,7 +82,7 @@ static uint32_t get_inline_name_skip_bytes(uint8_t *chunk_buffer, uint32_t curso
         skip_size = sizeof(nh) + (nh.char_count * 2 + 2); // plus 2 NULLs
     }
 
-    //printf("\tskip_size=%d\n", skip_size);
+    //out_printf(out, "\tskip_size=%d\n", skip_size);
 
     return skip_size;
 }
@@ -166,23 +90,15 @@ static uint32_t get_inline_name_skip_bytes(uint8_t *chunk_buffer, uint32_t curso
 
 
 
-static void print_evtx_filetime(uint64_t filetime) {
-    // 100-nanosecond intervals between 1601 and 1970
-    const uint64_t EPOCH_DIFF = 116444736000000000ULL;
-    
-    uint64_t unix_intervals = filetime - EPOCH_DIFF;
-    time_t seconds = (time_t)(unix_intervals / 10000000ULL);
-    uint32_t nanoseconds = (uint32_t)((unix_intervals % 10000000ULL) * 100);
-
-    struct tm *utc_time = gmtime(&seconds);
-    
-    // Format: YYYY-MM-DDTHH:MM:SS.ssssssZ
-    printf("%04d-%02d-%02dT%02d:%02d:%02d.%09uZ",
-           utc_time->tm_year + 1900, utc_time->tm_mon + 1, utc_time->tm_mday,
-           utc_time->tm_hour, utc_time->tm_min, utc_time->tm_sec, nanoseconds);
+static void print_evtx_filetime(OUT_SINK *out, uint64_t filetime) {
+    // Format: YYYY-MM-DDTHH:MM:SS.sssssssssZ, the 100ns digits and two zeros for nanoseconds
+    char text[FILETIME_ISO_MAX];
+    size_t len = filetime_to_iso(filetime, text, filetime_thread_cache());
+    memcpy(&text[len], "00Z", 3);
+    out_write(out, text, len + 3);
 }
 
-static void print_evtx_sid(uint8_t *sid_ptr) {
+static void print_evtx_sid(OUT_SINK *out, uint8_t *sid_ptr) {
     if (!sid_ptr) return;
 
     // Byte 0: Revision (S-n)
@@ -199,17 +115,21 @@ static void print_evtx_sid(uint8_t *sid_ptr) {
     }
 
     // Start printing the SID string
-    printf("S-%u-%llu", revision, authority);
+    out_puts(out, "S-");
+    out_u32(out, revision);
+    out_putc(out, '-');
+    out_u64(out, authority);
 
     // Bytes 8+: Sub-Authorities (4 bytes each, Little-Endian)
     uint32_t *sub_authorities = (uint32_t *)(sid_ptr + 8);
     for (int i = 0; i < sub_auth_count; i++) {
-        printf("-%u", sub_authorities[i]);
+        out_putc(out, '-');
+        out_u32(out, sub_authorities[i]);
     }
-    //printf("\n");
+    //out_printf(out, "\n");
 }
 
-static void print_evtx_guid(uint8_t *guid_ptr) {
+static void print_evtx_guid(OUT_SINK *out, uint8_t *guid_ptr) {
     if (!guid_ptr) return;
 
     // GUID structure in memory:
@@ -219,17 +139,27 @@ static void print_evtx_guid(uint8_t *guid_ptr) {
     uint16_t data2 = *(uint16_t *)&guid_ptr[4];
     uint16_t data3 = *(uint16_t *)&guid_ptr[6];
 
-    printf("{%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}",
-           data1, data2, data3,
-           guid_ptr[8], guid_ptr[9],   // Data4 starts here
-           guid_ptr[10], guid_ptr[11], 
-           guid_ptr[12], guid_ptr[13], 
-           guid_ptr[14], guid_ptr[15]);
+    // {%08x-%04x-%04x-%02x%02x-%02x%02x%02x%02x%02x%02x}
+    out_putc(out, '{');
+    out_hex(out, data1, 8);
+    out_putc(out, '-');
+    out_hex(out, data2, 4);
+    out_putc(out, '-');
+    out_hex(out, data3, 4);
+    out_putc(out, '-');
+    for (int i = 8; i < 16; i++) {  // Data4 starts here
+        if (i == 10) out_putc(out, '-');
+        out_hex(out, guid_ptr[i], 2);
+    }
+    out_putc(out, '}');
 }
 
 // build the TABLE, set each member from chunk_buffer
-static void create_value_table(EVTX_VALUE_TABLE *tbl, uint8_t *chunk_buffer, uint32_t value_table_offset, uint32_t output_mode)
+// the items are taken from the scratch arena, they are gone with the next record
+static void create_value_table(EVTX_VALUE_TABLE *tbl, EVTX_CHUNK_CTX *ctx, uint32_t value_table_offset)
 {
+    uint8_t *chunk_buffer = ctx->chunk_buffer;
+
     // value_array layout
     // 4B item_count    at value_table_offset
     // 2B size %0   at value_table_offset + 4 * 0
@@ -242,9 +172,21 @@ static void create_value_table(EVTX_VALUE_TABLE *tbl, uint8_t *chunk_buffer, uin
     // data %2      at value_table_offset + 4 + 4 * count + size0 + size1
     // .... until to last item
 
-    uint32_t count = *(uint32_t *)(chunk_buffer + value_table_offset);
+    uint32_t count = 0;
+    if ((uint64_t)value_table_offset + sizeof(count) <= EVTX_CHUNK_SIZE) {
+        count = *(uint32_t *)(chunk_buffer + value_table_offset);
+    }
+
+    // the descriptors at least must be inside the chunk
+    if (value_table_offset + sizeof(count) + (uint64_t)count * 4 > EVTX_CHUNK_SIZE) {
+        count = 0;
+    }
     tbl->count = count;
-    tbl->items = calloc(count, sizeof(EVTX_VALUE_ITEM));
+    tbl->items = arena_alloc(&ctx->scratch, count * sizeof(EVTX_VALUE_ITEM));
+    if (!tbl->items) {
+        tbl->count = 0;
+        return;
+    }
 
     // the offset of data %0
     uint32_t value_offset = value_table_offset + sizeof(count) + count * 4; 
@@ -253,6 +195,9 @@ static void create_value_table(EVTX_VALUE_TABLE *tbl, uint8_t *chunk_buffer, uin
         uint16_t size = *(uint16_t *)(chunk_buffer + value_table_offset + sizeof(count) + i * 4); 
         uint16_t type = *(uint16_t *)(chunk_buffer + value_table_offset + sizeof(count) + i * 4 + 2); 
 
+        // a value running out of the chunk (a broken record) is empty
+        if ((uint64_t)value_offset + size > EVTX_CHUNK_SIZE) size = 0;
+
         tbl->items[i].size = size;
         tbl->items[i].type = type;
         tbl->items[i].value_offset = value_offset;
@@ -262,128 +207,233 @@ static void create_value_table(EVTX_VALUE_TABLE *tbl, uint8_t *chunk_buffer, uin
 
 }
 
-// free the allocated memory
-static void delete_value_table(EVTX_VALUE_TABLE *tbl)
+// a type we do not know, or a fixed size type with the wrong size (a broken or carved record)
+static void print_value_unknown(OUT_SINK *out, uint8_t type, uint32_t size)
 {
-    free(tbl->items);
+    out_printf(out, "[Unknown Type 0x%02x, size %d]", type, size);
 }
 
-// get the value by index
-static void print_value_by_index(EVTX_VALUE_TABLE *tbl, 
-                                  uint8_t *chunk_buffer, 
-                                  uint32_t index, 
-                                  uint32_t output_mode, 
-                                  XML_TREE *xtree)
+// print one value of the given type, data_ptr points to its size bytes
+// the embedded BinXML (0x21) is not handled here, see print_value_by_index()
+void print_value(OUT_SINK *out, uint8_t type, const uint8_t *data_ptr, uint32_t size)
 {
-    if (index >= tbl->count) return;
-
-    EVTX_VALUE_ITEM *val_item = &tbl->items[index];
-    uint16_t size = val_item->size;
-    uint16_t type = val_item->type;
-    uint8_t *data_ptr = chunk_buffer + val_item->value_offset;
-
     // Handle empty values (like your %13)
     if (size == 0 && type != 0x00) {
-        printf("[Empty]");
+        out_puts(out, "[Empty]");
         return;
     }
 
     switch (type) {
         case 0x00: // NullType
-            printf("(null)");
+            out_puts(out, "(null)");
             break;
 
         case 0x01: // StringType (Unicode UTF-16LE)
             // We pass the size in bytes to our helper
-            print_utf16le_string(size/2, (uint16_t *)data_ptr);
+            print_utf16le_string(out, size/2, (uint16_t *)data_ptr);
             break;
 
         case 0x02: // AnsiStringType
-            printf("%.*s", size, (char *)data_ptr);
+            out_write(out, data_ptr, strnlen((const char *)data_ptr, size));
+            break;
+
+        case 0x03: // Int8Type
+            out_i64(out, *(const int8_t *)data_ptr);
+            break;
+
+        case 0x05: // Int16Type
+            if (size == 2) out_i64(out, *(const int16_t *)data_ptr);
+            break;
+
+        case 0x07: // Int32Type
+            if (size == 4) out_i64(out, *(const int32_t *)data_ptr);
+            break;
+
+        case 0x09: // Int64Type
+            if (size == 8) out_i64(out, *(const int64_t *)data_ptr);
             break;
 
         case 0x04: // Uint32Type (Your debug says Uint8, but 0x04 is usually 32-bit)
-            if (size == 1) printf("%u", *data_ptr);
-            else if (size == 4) printf("%u", *(uint32_t *)data_ptr);
+            if (size == 1) out_u32(out, *data_ptr);
+            else if (size == 4) out_u32(out, *(uint32_t *)data_ptr);
             break;
 
        case 0x06: // Uint16Type
-           if (size == 2) printf("%u", *(uint16_t *)data_ptr);
+           if (size == 2) out_u32(out, *(uint16_t *)data_ptr);
            break;
 
         case 0x08: // Uint32Type in your table (standard is 64-bit, let's follow your size)
-            if (size == 4) printf("%u", *(uint32_t *)data_ptr);
-            else if (size == 8) printf("%llu", *(uint64_t *)data_ptr);
+            if (size == 4) out_u32(out, *(uint32_t *)data_ptr);
+            else if (size == 8) out_u64(out, *(uint64_t *)data_ptr);
             break;
 
         case 0x0A: // Uint64Type
-            printf("%llu", *(uint64_t *)data_ptr);
+            if (size == 8) out_u64(out, *(uint64_t *)data_ptr);
+            else print_value_unknown(out, type, size);
+            break;
+
+        case 0x0D: // BoolType, 4 bytes
+            out_puts(out, (size == 4 ? *(uint32_t *)data_ptr : *data_ptr) ? "true" : "false");
+            break;
+
+        case 0x0E: // BinaryType, upper case hex like the Event Viewer
+            for (uint32_t i = 0; i < size; i++) {
+                out_putc(out, "0123456789ABCDEF"[data_ptr[i] >> 4]);
+                out_putc(out, "0123456789ABCDEF"[data_ptr[i] & 0x0f]);
+            }
             break;
 
         case 0x0F: // GuidType
-            print_evtx_guid(data_ptr);
+            if (size == 16) print_evtx_guid(out, (uint8_t *)data_ptr);
+            else print_value_unknown(out, type, size);
             break;
 
         case 0x11: // FileTimeType
-            print_evtx_filetime(*(uint64_t *)data_ptr);
+            if (size == 8) print_evtx_filetime(out, *(uint64_t *)data_ptr);
+            else print_value_unknown(out, type, size);
             break;
 
         case 0x13: // SidType (0x13 or 0x1C depending on version)
-            print_evtx_sid(data_ptr);
+            // the count of sub-authorities is in the data, it must not take us past the value
+            if (size >= 8 && 8 + 4 * (uint32_t)data_ptr[1] <= size) print_evtx_sid(out, (uint8_t *)data_ptr);
+            else print_value_unknown(out, type, size);
             break;
 
-        case 0x15: // HexInt64Type
-            printf("0x%llx", *(uint64_t *)data_ptr);
+        case 0x14: // HexInt32Type
+            if (size == 4) {
+                out_puts(out, "0x");
+                out_hex(out, *(uint32_t *)data_ptr, 0);
+            } else {
+                print_value_unknown(out, type, size);
+            }
             break;
 
-        case 0x21: // BinXmlType
-        {
-           
-            if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-                printf("[Embedded BinXML Area - %d bytes]", size);
-                printf("\nDEBUG: called from print_value_by_index()\t");
+        case 0x15: // HexInt64Type
+            if (size == 8) {
+                out_puts(out, "0x");
+                out_hex(out, *(uint64_t *)data_ptr, 0);
+            } else {
+                print_value_unknown(out, type, size);
             }
+            break;
 
-            // decode it
-            decode_binxml(chunk_buffer, val_item->value_offset, val_item->size, output_mode, xtree); 
-
+        case EVTX_SAX_TEXT_UTF8: // static text of a compiled template, see evtx_sax.h
+            out_write(out, data_ptr, size);
             break;
-       }
 
        default:
-           printf("[Unknown Type 0x%02x, size %d]", type, size);
+           print_value_unknown(out, type, size);
            break;
     }
 }
 
 
+// get the value by index
+static void print_value_by_index(EVTX_CHUNK_CTX *ctx,
+                                  EVTX_VALUE_TABLE *tbl, 
+                                  uint32_t index)
+{
+    uint32_t output_mode  = ctx->output_mode;
+    OUT_SINK *out         = ctx->out;
+
+    if (index >= tbl->count) return;
 
+    EVTX_VALUE_ITEM *val_item = &tbl->items[index];
+
+    if (val_item->type == 0x21 && val_item->size != 0) { // BinXmlType
+        if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
+            out_printf(out, "[Embedded BinXML Area - %d bytes]", val_item->size);
+            out_printf(out, "\nDEBUG: called from print_value_by_index()\t");
+        }
+
+        // decode it
+        decode_binxml(ctx, val_item->value_offset, val_item->size, NULL); 
+        return;
+    }
+
+    print_value(out, (uint8_t)val_item->type, ctx->chunk_buffer + val_item->value_offset, val_item->size);
+}
+
+
+// same as print_value_by_index(), but the value is handed to the SAX consumer as it is
+static void sax_value_by_index(EVTX_CHUNK_CTX *ctx,
+                               EVTX_VALUE_TABLE *tbl,
+                               uint32_t index,
+                               const EVTX_SAX *sax)
+{
+    if (index >= tbl->count) return;
+
+    EVTX_VALUE_ITEM *val_item = &tbl->items[index];
+
+    // embedded BinXML: its elements come as events
+    if (val_item->type == 0x21 && val_item->size != 0) {
+        if (CHECK_OUTMODE(ctx->output_mode, OUT_DEBUG)) {
+            out_printf(ctx->out, "[Embedded BinXML Area - %d bytes]", val_item->size);
+            out_printf(ctx->out, "\nDEBUG: called from sax_value_by_index()\t");
+        }
+        decode_binxml(ctx, val_item->value_offset, val_item->size, sax);
+        return;
+    }
+
+    if (sax->on_value) {
+        const uint8_t *ptr = (val_item->type == 0x00) ? NULL : ctx->chunk_buffer + val_item->value_offset;
+        sax->on_value(sax->user, (uint8_t)val_item->type, ptr, (val_item->type == 0x00) ? 0 : val_item->size);
+    }
+}
+
+
+
+
+
+
+// the SAX callbacks may be NULL
+static inline void sax_open(const EVTX_SAX *sax, const char *name, uint32_t len)
+{
+    if (sax->on_element_open) sax->on_element_open(sax->user, name, len);
+}
+
+static inline void sax_attr(const EVTX_SAX *sax, const char *name, uint32_t len)
+{
+    if (sax->on_attribute) sax->on_attribute(sax->user, name, len);
+}
+
+static inline void sax_start_tag_end(const EVTX_SAX *sax)
+{
+    if (sax->on_start_tag_end) sax->on_start_tag_end(sax->user);
+}
+
+static inline void sax_value(const EVTX_SAX *sax, uint8_t type, const void *ptr, uint32_t size)
+{
+    if (sax->on_value) sax->on_value(sax->user, type, ptr, size);
+}
+
+static inline void sax_close(const EVTX_SAX *sax)
+{
+    if (sax->on_element_close) sax->on_element_close(sax->user);
+}
 
 
 
 static void decode_template_with_values(
-                   uint8_t *chunk_buffer,        /* the 64KB chunk in memory */
+                   EVTX_CHUNK_CTX *ctx,          /* the chunk being decoded */
                    uint32_t binxml_offset,       /* start position of binxml, related to chunk_buffer */
                    uint32_t binxml_size,         /* the size of buffer =  record_size - 24 - 4  */       
                    EVTX_VALUE_TABLE *tbl_ptr,    /* value table of this binxml */
-                   uint32_t output_mode,         /* CSV or DEBUG etc */
-                   XML_TREE *xtree)              /* the tree */
+                   const EVTX_SAX *sax)          /* callbacks, NULL to print */
 {
+    uint8_t *chunk_buffer = ctx->chunk_buffer;    /* the 64KB chunk in memory */
+    OUT_SINK *out         = ctx->out;             /* where to print */
     uint32_t i = binxml_offset;  // the starting point of cursor in buffer
     uint32_t binxml_limit = binxml_offset + binxml_size;  // the hard limit of cursor in buffer
 
-    XML_TREE *current; // the temprate tree
-    STACK *stack = stack_new(); // to hold element names
-
-    if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-        printf("DEBUG: decode_template_with_values() offset=0x%08" PRIx32 "\tsize=%" PRIu32 "\n", binxml_offset, binxml_size);
-        hex_dump_bytes(&chunk_buffer[binxml_offset], binxml_size);
-    }
+    STACK stack_buf;            // to hold element names
+    STACK *stack = &stack_buf;
+    stack_init(stack, &ctx->scratch);
 
     while (i < binxml_limit ) {
         uint8_t raw_token = chunk_buffer[i];
 
-        //printf("\nDEBUG: cursor=0x%x\traw_token=0x%02x\n", i, raw_token);
+        //out_printf(out, "\nDEBUG: cursor=0x%x\traw_token=0x%02x\n", i, raw_token);
         
         switch (raw_token) {
 
@@ -402,13 +452,18 @@ static void decode_template_with_values(
                 memcpy(&open_el, &chunk_buffer[i], sizeof(open_el));
                 i += sizeof(open_el); // skip (Token + DependencyID + DataSize + NameOffset)
             
-                char name_buf[1024];
-                get_name_from_offset(chunk_buffer, open_el.name_offset, name_buf, sizeof(name_buf));
-                printf("<%s", name_buf);
-                stack_push(stack, name_buf);
+                uint32_t name_len;
+                const char *name = chunk_get_name(ctx, open_el.name_offset, &name_len);
+                if (sax) {
+                    sax_open(sax, name, name_len);
+                } else {
+                    out_putc(out, '<');
+                    out_puts(out, name);
+                }
+                stack_push(stack, name);
 
                 // if the name_offset is defined at here, skip the whole name buffer
-                i += get_inline_name_skip_bytes(chunk_buffer, i, open_el.name_offset);
+                i += get_inline_name_skip_bytes(ctx, i, open_el.name_offset);
             
                 if (raw_token & 0x40) { 
                     // if token=0x41, there are 4 bytes as attr_list_size
@@ -426,12 +481,18 @@ static void decode_template_with_values(
                 memcpy(&attr, &chunk_buffer[i], sizeof(attr));
                 i += sizeof(attr); // token + 4B 
             
-                char name_buf[1024];
-                get_name_from_offset(chunk_buffer, attr.name_offset, name_buf, sizeof(name_buf));
-                printf(" %s=", name_buf);
+                if (sax) {
+                    uint32_t name_len;
+                    const char *name = chunk_get_name(ctx, attr.name_offset, &name_len);
+                    sax_attr(sax, name, name_len);
+                } else {
+                    out_putc(out, ' ');
+                    out_puts(out, chunk_get_name(ctx, attr.name_offset, NULL));
+                    out_putc(out, '=');
+                }
             
                 // if the name_offset is defined at here, skip the whole name buffer
-                i += get_inline_name_skip_bytes(chunk_buffer, i, attr.name_offset);
+                i += get_inline_name_skip_bytes(ctx, i, attr.name_offset);
             
                 // NOTE for 0x46
                 // there is NO 4 bytes as more_data_size
@@ -446,12 +507,18 @@ static void decode_template_with_values(
                 memcpy(&attr, &chunk_buffer[i], sizeof(attr));
                 i += sizeof(attr); // token + 4B unkown + 4B name_offset 
             
-                char name_buf[1024];
-                get_name_from_offset(chunk_buffer, attr.name_offset, name_buf, sizeof(name_buf));
-                printf(" %s=", name_buf);
+                if (sax) {
+                    uint32_t name_len;
+                    const char *name = chunk_get_name(ctx, attr.name_offset, &name_len);
+                    sax_attr(sax, name, name_len);
+                } else {
+                    out_putc(out, ' ');
+                    out_puts(out, chunk_get_name(ctx, attr.name_offset, NULL));
+                    out_putc(out, '=');
+                }
             
                 // if the name_offset is defined at here, skip the whole name buffer
-                i += get_inline_name_skip_bytes(chunk_buffer, i, attr.name_offset);
+                i += get_inline_name_skip_bytes(ctx, i, attr.name_offset);
             
                 break;
             }
@@ -472,18 +539,23 @@ static void decode_template_with_values(
                         uint16_t char_count = *(uint16_t*)&chunk_buffer[i];
                         i += 2; // consume count
 
-                        print_utf16le_string(char_count, (uint16_t *)&chunk_buffer[i]);
+                        if (sax) {
+                            sax_value(sax, v_type, &chunk_buffer[i], (uint32_t)char_count * 2);
+                        } else {
+                            print_utf16le_string(out, char_count, (uint16_t *)&chunk_buffer[i]);
+                        }
                         i += (char_count * 2); // consume utf16le string
 
                         break;
                     }
 
                     case 0x00: // nulltype
-                        printf("null");
+                        if (sax) sax_value(sax, v_type, NULL, 0);
+                        else out_puts(out, "null");
                         break;
 
                     default:
-                        printf("WARNING: No code for token=0x05 or 0x45: value_type=0x%02x\n", v_type);
+                        out_printf(out, "WARNING: No code for token=0x05 or 0x45: value_type=0x%02x\n", v_type);
                         break;
 
                }
@@ -500,9 +572,10 @@ static void decode_template_with_values(
                 memcpy(&sh, &chunk_buffer[i], sizeof(sh));
                 i += sizeof(sh); // token + 2B subID + 1B type
 
-                //printf("DEBUG: subs_id=%%%d\n", sh.subs_id);
+                //out_printf(out, "DEBUG: subs_id=%%%d\n", sh.subs_id);
 
-                print_value_by_index(tbl_ptr, chunk_buffer, sh.subs_id, output_mode, xtree);
+                if (sax) sax_value_by_index(ctx, tbl_ptr, sh.subs_id, sax);
+                else print_value_by_index(ctx, tbl_ptr, sh.subs_id);
 
                 // how to handle array type?
 
@@ -519,37 +592,48 @@ static void decode_template_with_values(
             case 0x0a: // BinXmlTokenPITarget
             case 0x0b: // BinXmlTokenCDATASection
                 i += 1; // token
-                printf("WARNING: no code for this token 0x%02x\n", raw_token);
+                out_printf(out, "WARNING: no code for this token 0x%02x\n", raw_token);
                 break;
 
             case 0x0c: // BinXmlTokenTemplateInstance
                 // this should never appear in template_binxml
-                printf("ERROR: Token 0C appreared on template_binxml, something WRONG?\n");
+                out_printf(out, "ERROR: Token 0C appreared on template_binxml, something WRONG?\n");
                 return;
                 break;
             
             case 0x02: // BinXmlTokenCloseStartElementTag
                 i += 1;
-                printf(">");
+                if (sax) sax_start_tag_end(sax);
+                else out_putc(out, '>');
                 break;
 
             case 0x03: // BinXmlTokenCloseEmptyElementTag
                 i += 1;
-                printf("/>\n");
+                if (sax) sax_close(sax);
+                else out_puts(out, "/>\n");
                 stack_pop(stack);  // since this is an empty element, we need to pop it from stack, but not print out
                 break;
 
             case 0x04: // BinXmlTokenEndElementTag
+            {
                 i += 1;
-                printf("</%s>\n", stack_pop(stack));
+                const char *name = stack_pop(stack);
+                if (sax) {
+                    sax_close(sax);
+                } else {
+                    out_puts(out, "</");
+                    out_puts(out, name ? name : "(null)");
+                    out_puts(out, ">\n");
+                }
                 break;
+            }
 
             case 0x00: // BinXmlTokenEOF  EOF or Padding, just skip it to next byte
                 i += 1;
                 break;
 
             default:
-                printf("WARNING: Token 0x%02x NOT PROCESSED\n", raw_token);
+                out_printf(out, "WARNING: Token 0x%02x NOT PROCESSED\n", raw_token);
                 i += 1; 
                 break;
         }
@@ -560,12 +644,75 @@ static void decode_template_with_values(
 
 
 
-void decode_binxml(uint8_t *chunk_buffer,        /* the 64KB chunk in memory */
-                   uint32_t binxml_offset,       /* start position of binxml, related to chunk_buffer */
-                   uint32_t binxml_size,         /* the size of buffer =  record_size - 24 - 4  */       
-                   uint32_t output_mode,         /* CSV or DEBUG etc */
-                   XML_TREE *xtree)              /* XML TREE of output */
+// print a record from its compiled template, same output as decode_template_with_values()
+static void render_template(EVTX_CHUNK_CTX *ctx,
+                            const EVTX_TEMPLATE *tpl,
+                            EVTX_VALUE_TABLE *tbl_ptr)
+{
+    OUT_SINK *out = ctx->out;
+    const EVTX_OP *op  = tpl->ops;
+    const EVTX_OP *end = tpl->ops + tpl->op_count;
+
+    // only two cases: a static run printed at once, or a substitution
+    while (op < end) {
+        if (op->run_ops) {
+            out_write(out, TEMPLATE_OP_TEXT(tpl, op), op->run_len);
+            op += op->run_ops;
+        } else {
+            print_value_by_index(ctx, tbl_ptr, op->arg);
+            op++;
+        }
+    }
+}
+
+
+// drive the SAX callbacks from the compiled template, op by op
+static void render_template_sax(EVTX_CHUNK_CTX *ctx,
+                                const EVTX_TEMPLATE *tpl,
+                                EVTX_VALUE_TABLE *tbl_ptr,
+                                const EVTX_SAX *sax)
 {
+    for (const EVTX_OP *op = tpl->ops; op < tpl->ops + tpl->op_count; op++) {
+        switch (op->code) {
+            case EVTX_OP_OPEN:
+                sax_open(sax, TEMPLATE_NAME(tpl, op->arg), tpl->names[op->arg].len);
+                break;
+            case EVTX_OP_ATTR:
+                sax_attr(sax, TEMPLATE_NAME(tpl, op->arg), tpl->names[op->arg].len);
+                break;
+            case EVTX_OP_VALUE:
+                // the printed form of a static string is the string itself, already UTF-8
+                if (op->value_type == 0x00) sax_value(sax, 0x00, NULL, 0);
+                else sax_value(sax, EVTX_SAX_TEXT_UTF8, TEMPLATE_OP_TEXT(tpl, op), op->text_len);
+                break;
+            case EVTX_OP_SUBST:
+            case EVTX_OP_SUBST_OPT:
+                sax_value_by_index(ctx, tbl_ptr, op->arg, sax);
+                break;
+            case EVTX_OP_CLOSE_START:
+                sax_start_tag_end(sax);
+                break;
+            case EVTX_OP_CLOSE_EMPTY:
+            case EVTX_OP_CLOSE:
+                sax_close(sax);
+                break;
+        }
+    }
+}
+
+
+
+
+
+// find the template of the record and build its value table, nothing is printed
+// returns -1 when there is no template instance (0C token)
+int binxml_read_instance(EVTX_CHUNK_CTX *ctx,            /* the chunk being decoded */
+                         uint32_t binxml_offset,         /* start position of binxml, related to chunk_buffer */
+                         uint32_t binxml_size,           /* the size of buffer =  record_size - 24 - 4  */
+                         BINXML_INSTANCE *inst)
+{
+    uint8_t *chunk_buffer = ctx->chunk_buffer;    /* the 64KB chunk in memory */
+
     // binxml can be splitted into 3 parts:
     //     {template-ID-Offset} {optional: definition} {instance data}
     //     part1: leading 0f token and 0C token, specify template ID and offset 
@@ -574,62 +721,230 @@ void decode_binxml(uint8_t *chunk_buffer,        /* the 64KB chunk in memory */
     // decode the binxml by following steps
     //     1) find the tempalate offset from part1, get the offset of template_binxml
     //     2) find the starting position of part3, create value_table
-    //     3) create the instance by mergring template with values
-
+    //     3) create the instance by mergring template with values (binxml_render_instance)
 
-    uint32_t template_binxml_offset = 0x00;
-    uint32_t template_binxml_size = 0x00;
     uint32_t value_table_offset = 0x00;
 
-    EVTX_VALUE_TABLE value_table;
-
-    if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-        printf("decode_binxml() offset=0x%08" PRIx32 "\tsize=%" PRIu32 "\n", binxml_offset, binxml_size);
-    }
+    memset(inst, 0, sizeof(*inst));
+    inst->binxml_offset = binxml_offset;
+    inst->binxml_size   = binxml_size;
 
     // first find template specified by token 0C, usuaaly in the very begining
     for (uint32_t i = binxml_offset; i < binxml_offset + 10; i++) { 
         if ((chunk_buffer[i] == 0x0c) && (chunk_buffer[i + 1] == 0x01)) {// found it.
             BINXML_TEMPLATE_INSTANCE_HEADER token_h;
             memcpy(&token_h, &chunk_buffer[i + 1], sizeof(token_h));
+            if (token_h.template_offset > EVTX_CHUNK_SIZE - sizeof(EVTX_TEMPLATE_DEFINITION_HEADER)) {
+                return -1;      // a broken record (carved ones can be anything)
+            }
 
             EVTX_TEMPLATE_DEFINITION_HEADER th;
             memcpy(&th, &chunk_buffer[token_h.template_offset], sizeof(th));
+            if (th.data_size > EVTX_CHUNK_SIZE - token_h.template_offset - sizeof(th)) {
+                return -1;      // the template runs out of the chunk
+            }
                   // if needed, make sure this is a real template offset by checking 
                   //    if token_h.template_offset existing in index table (0x180 to 0x1ff)
 
-            template_binxml_offset = token_h.template_offset + sizeof(th);
-            template_binxml_size = th.data_size;
+            inst->template_offset = token_h.template_offset;
+            inst->template_binxml_offset = token_h.template_offset + sizeof(th);
+            inst->template_binxml_size = th.data_size;
             value_table_offset = i + 1 + sizeof(token_h); // 1 byte is the token 0C itself
-
-            //printf("DEBUG: found 0C 01 at 0x%08" PRIx32 "", i);
-            //printf("\ttemplate_id=0x%08" PRIx32 "\tbinxml_offset=0x%08" PRIx32 "\tsize=%" PRIu32 "B\n", 
-            //         th.template_id, template_binxml_offset, template_binxml_size);
             break; // no more need to loop since already found it.
          }
-      }
-      if (!template_binxml_offset) {
-          printf("ERROR: no 0C token found\n"); // should never happen
-          return;
-      }
-
-      // adjust the value_table_offset if part2 existing
-      if ((binxml_offset < template_binxml_offset) && 
-                 (template_binxml_offset < binxml_offset + binxml_size)) {
-           // template binxml is within the original binxml, i.e. size of part2
-           value_table_offset += template_binxml_size + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER);
-      }
-
-      // build the value_table
-      create_value_table(&value_table, chunk_buffer, value_table_offset, output_mode);
-
-      // now, merge the template_binxml with value data
-      decode_template_with_values(chunk_buffer, 
-              template_binxml_offset, template_binxml_size, 
-              &value_table, output_mode, xtree);
-
-      // free memory
-      delete_value_table(&value_table);
+    }
+    if (!inst->template_binxml_offset) {
+        return -1;
+    }
+
+    // adjust the value_table_offset if part2 existing
+    if ((binxml_offset < inst->template_binxml_offset) && 
+               (inst->template_binxml_offset < binxml_offset + binxml_size)) {
+         // template binxml is within the original binxml, i.e. size of part2
+         value_table_offset += inst->template_binxml_size + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER);
+    }
+
+    // build the value_table
+    create_value_table(&inst->values, ctx, value_table_offset);
+
+    // the template is parsed only once per chunk, unless it has tokens only the raw walker knows
+    // --raw-walker skips it, to compare both
+    inst->tpl = CHECK_OUTMODE(ctx->output_mode, OUT_RAW) ? NULL
+                : evtx_template_get(ctx, inst->template_offset);
+    return 0;
+}
+
+
+
+int32_t value_as_uint16(uint8_t type, const uint8_t *ptr, uint32_t size)
+{
+    uint32_t id = 0;
+
+    switch (type) {
+        case 0x04:  // UInt8
+            if (size != 1) return -1;
+            return ptr[0];
+        case 0x06:  // UInt16, the usual one
+        {
+            if (size != 2) return -1;
+            uint16_t v;
+            memcpy(&v, ptr, 2);
+            return v;
+        }
+        case 0x08:  // UInt32
+            if (size != 4) return -1;
+            memcpy(&id, ptr, 4);
+            return (id > 0xffff) ? -1 : (int32_t)id;
+        case 0x01:  // UTF-16LE digits
+        case EVTX_SAX_TEXT_UTF8:
+        {
+            uint32_t step = (type == 0x01) ? 2 : 1;
+            if (size < step) return -1;
+            for (uint32_t n = 0; n + step <= size; n += step) {
+                uint16_t c = ptr[n];
+                if (step == 2) c |= (uint16_t)(ptr[n + 1] << 8);
+                if (c == 0) break;
+                if (c < '0' || c > '9' || id > 0xffff) return -1;
+                id = id * 10 + (c - '0');
+            }
+            return (id > 0xffff) ? -1 : (int32_t)id;
+        }
+        default:
+            return -1;
+    }
+}
+
+
+// SAX consumer for templates which are not compiled: waits for the text of /Event/System/EventID
+typedef struct {
+    uint32_t depth;
+    int      in_system;
+    int      in_evtid;      // 1: inside <EventID ...>, 2: after its ">"
+    int32_t  event_id;
+} EVTID_FINDER;
+
+static void finder_on_element_open(void *user, const char *name, uint32_t len)
+{
+    EVTID_FINDER *f = user;
+    (void)len;
+    f->depth++;
+    if (f->depth == 2) f->in_system = (strcmp(name, "System") == 0);
+    f->in_evtid = (f->depth == 3 && f->in_system && strcmp(name, "EventID") == 0);
+}
+
+static void finder_on_start_tag_end(void *user)
+{
+    EVTID_FINDER *f = user;
+    if (f->in_evtid) f->in_evtid = 2;
+}
+
+static void finder_on_value(void *user, uint8_t type, const void *ptr, uint32_t size)
+{
+    EVTID_FINDER *f = user;
+    if (f->in_evtid == 2 && f->event_id < 0) {
+        f->event_id = value_as_uint16(type, ptr, size);
+        f->in_evtid = 0;
+    }
+}
+
+static void finder_on_element_close(void *user)
+{
+    EVTID_FINDER *f = user;
+    f->depth--;
+    f->in_evtid = 0;
+}
+
+
+// the EventID of the record, -1 if it has none
+int32_t binxml_event_id(EVTX_CHUNK_CTX *ctx, BINXML_INSTANCE *inst)
+{
+    const EVTX_TEMPLATE *tpl = inst->tpl;
+
+    // compiled: the template knows which op it is, one value to look at
+    if (tpl) {
+        if (tpl->evtid_op < 0) return -1;
+
+        const EVTX_OP *op = &tpl->ops[tpl->evtid_op];
+        if (op->code == EVTX_OP_VALUE) {
+            return value_as_uint16(EVTX_SAX_TEXT_UTF8, (const uint8_t *)TEMPLATE_OP_TEXT(tpl, op), op->text_len);
+        }
+        if (op->arg >= inst->values.count) return -1;
+
+        EVTX_VALUE_ITEM *item = &inst->values.items[op->arg];
+        return value_as_uint16((uint8_t)item->type, ctx->chunk_buffer + item->value_offset, item->size);
+    }
+
+    // raw walker: walk the template once without printing (no debug, warnings go to the scratch sink)
+    EVTID_FINDER f = { 0, 0, 0, -1 };
+    EVTX_SAX finder = {
+        .user             = &f,
+        .on_element_open  = finder_on_element_open,
+        .on_start_tag_end = finder_on_start_tag_end,
+        .on_value         = finder_on_value,
+        .on_element_close = finder_on_element_close,
+    };
+
+    uint32_t output_mode = ctx->output_mode;
+    OUT_SINK *out        = ctx->out;
+    CLEAR_OUTMODE(ctx->output_mode, OUT_DEBUG);
+    ctx->out = &ctx->value_out;
+
+    decode_template_with_values(ctx, inst->template_binxml_offset, inst->template_binxml_size,
+                                &inst->values, &finder);
+
+    ctx->value_out.len = 0;
+    ctx->out = out;
+    ctx->output_mode = output_mode;
+    return f.event_id;
+}
+
+
+
+// merge the template with the values: print it, or hand it to the SAX callbacks
+void binxml_render_instance(EVTX_CHUNK_CTX *ctx, BINXML_INSTANCE *inst, const EVTX_SAX *sax)
+{
+    uint8_t *chunk_buffer = ctx->chunk_buffer;
+    uint32_t output_mode  = ctx->output_mode;
+    OUT_SINK *out         = ctx->out;
+
+    if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
+        out_printf(out, "decode_binxml() offset=0x%08" PRIx32 "\tsize=%" PRIu32 "\n", inst->binxml_offset, inst->binxml_size);
+    }
+
+    if (!inst->template_binxml_offset) {
+        out_printf(out, "ERROR: no 0C token found\n"); // should never happen
+        return;
+    }
+
+    if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
+        out_printf(out, "DEBUG: decode_template_with_values() offset=0x%08" PRIx32 "\tsize=%" PRIu32 "\n", 
+                   inst->template_binxml_offset, inst->template_binxml_size);
+        hex_dump_bytes(out, &chunk_buffer[inst->template_binxml_offset], inst->template_binxml_size);
+    }
+
+    const EVTX_TEMPLATE *tpl = inst->tpl;
+    if (tpl && sax) {
+        render_template_sax(ctx, tpl, &inst->values, sax);
+    } else if (tpl) {
+        render_template(ctx, tpl, &inst->values);
+    } else {
+        decode_template_with_values(ctx, 
+                inst->template_binxml_offset, inst->template_binxml_size, 
+                &inst->values, sax);
+    }
+}
+
+
+
+void decode_binxml(EVTX_CHUNK_CTX *ctx,          /* the chunk being decoded */
+                   uint32_t binxml_offset,       /* start position of binxml, related to chunk_buffer */
+                   uint32_t binxml_size,         /* the size of buffer =  record_size - 24 - 4  */       
+                   const EVTX_SAX *sax)          /* callbacks, NULL to print directly */
+{
+    BINXML_INSTANCE inst;
+
+    binxml_read_instance(ctx, binxml_offset, binxml_size, &inst);
+    binxml_render_instance(ctx, &inst, sax);
 }
 
 
@@ -9,12 +9,125 @@ typedef struct {
 } BinXmlContext;
 
 #include "evtx_xmltree.h"
+#include "evtx_chunk.h"
+#include "evtx_sax.h"
 
 
-void decode_binxml(uint8_t *chunk_buffer, uint32_t binxml_offset, uint32_t binxml_size, uint32_t output_mode, XML_TREE *xtree);
+#pragma pack(push, 1)
+
+// Token 0x0f: BINXML Fragment
+typedef struct {
+    uint8_t  token;          // should be 0x0f
+    uint8_t  major_version;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
+    uint8_t  minor_version;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
+    uint8_t  flag;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
+                             // followed by the actual data based on the type
+} TOKEN_0F_FRAGMENT_HEADER;
+
+// Token 0x01 / 0x41: Open Element
+typedef struct {
+    uint8_t  token;          // should be 0x01 or 0x41
+    uint16_t dependency_id;  // Usually 0xFFFF
+    uint32_t element_size;   // Total size of this element branch
+    uint32_t name_offset;    // Offset to Name Descriptor
+                             // for 0x41: 4B as more_data_size 
+} TOKEN_01_OPEN_ELEMENT_HEADER;
+
+// Token 0x05: Value Token
+typedef struct {
+    uint8_t  token;          // should be 0x05
+    uint8_t  value_type;     // e.g., 0x01 for String, 0x04 for Hex32, etc.
+                             // followed by the actual data based on the type
+} TOKEN_05_ATTRIBUTE_VALUE_HEADER;
+
+// Token 0x06 / 0x46: Attribute Name
+typedef struct {
+    uint8_t  token;          // should be 0x06 or 0x46
+    uint32_t name_offset;    // name offfset for Attribute Name
+                             // NOTE for 0x46: NO MORE 4B as more_data_size 
+} TOKEN_06_ATTRIBUTE_NAME_HEADER;
+
+
+// Token 0x36: Attribute Name   (new token found by me)
+typedef struct {
+    uint8_t  token;          // should be 0x36
+    uint8_t  unknown[4];     // Unknown/Dependency ID. Similar to the ff ff seen in 0x41, but 4 bytes. 
+                             // This might be a more complex dependency identifier.
+    uint32_t name_offset;    // name offfset for Attribute Name
+} TOKEN_36_ATTRIBUTE_NAME_HEADER;
+
+
+
+
+
+
+
+// Token 0x0d BinXmlTokenNormalSubstitution 
+// Token 0x0e BinXmlTokenOptionallSubstitution
+typedef struct {
+    uint8_t  token;      // should be 0x0d or 0x0e
+    uint16_t subs_id;    // Substitution identifier
+    uint8_t value_type;    
+} TOKEN_0E_SUBSTITUTION_HEADER;
+
+// Token 0x0C: Template Instance Header
+// the 33-byte structure including 24-byte of TEMPLATE_DEFINITION_HEADER
+// now I use the 9-byte structure only
+typedef struct {
+    uint8_t  unknown_val;         // unknown but usually seen as 0x01
+    uint32_t template_id;      // the template ID as same as template_id
+    uint32_t template_offset;   // offset to TEMPLATE_DEFINITION_HEADER, usually next 4 bytes
+} BINXML_TEMPLATE_INSTANCE_HEADER;
+
+// substitution value array
+typedef struct {
+    uint16_t size;          // raw value size
+    uint16_t type;          // EVTX value type, only 1 byte used
+    uint32_t value_offset;  // relative offset in chunk_buffer
+} EVTX_VALUE_ITEM;
+
+typedef struct {
+    uint16_t count;
+    EVTX_VALUE_ITEM *items;
+} EVTX_VALUE_TABLE;
+
+#pragma pack(pop)
+
+
+struct _EVTX_TEMPLATE;
+
+// one record (or embedded BinXML): its template and the values for it
+typedef struct _BINXML_INSTANCE {
+    uint32_t binxml_offset;
+    uint32_t binxml_size;
+    uint32_t template_offset;
+    uint32_t template_binxml_offset;        // 0: no template instance found
+    uint32_t template_binxml_size;
+    const struct _EVTX_TEMPLATE *tpl;       // compiled template, NULL for the raw walker
+    EVTX_VALUE_TABLE values;                // items in the scratch arena
+} BINXML_INSTANCE;
+
+// decode_binxml() in two steps, so a record can be looked at before it is rendered
+int     binxml_read_instance(EVTX_CHUNK_CTX *ctx, uint32_t binxml_offset, uint32_t binxml_size, BINXML_INSTANCE *inst);
+void    binxml_render_instance(EVTX_CHUNK_CTX *ctx, BINXML_INSTANCE *inst, const EVTX_SAX *sax);
+
+// the text of /Event/System/EventID as a number, -1 if there is none
+int32_t binxml_event_id(EVTX_CHUNK_CTX *ctx, BINXML_INSTANCE *inst);
+
+// print the record at binxml_offset, or hand it to the SAX callbacks when sax is not NULL
+void decode_binxml(EVTX_CHUNK_CTX *ctx, uint32_t binxml_offset, uint32_t binxml_size, const EVTX_SAX *sax);
+
+// a value given as number (UInt8/16/32) or as text (UTF-16LE value or UTF-8 template text),
+// like EventID or Level: -1 if it is not a number up to 65535
+int32_t value_as_uint16(uint8_t type, const uint8_t *ptr, uint32_t size);
+
+// print one value of an EVTX value type (not 0x21), as the decoder does
+void print_value(OUT_SINK *out, uint8_t type, const uint8_t *data_ptr, uint32_t size);
 
 const char* get_value_type_name(uint8_t value_type);
 
+uint32_t get_inline_name_skip_bytes(EVTX_CHUNK_CTX *ctx, uint32_t cursor_offset, uint32_t name_offset);
+
 
 #endif
  
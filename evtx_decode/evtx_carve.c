@@ -0,0 +1,368 @@
+/* evtx_carve.c
+ *
+ * --carve, see evtx_carve.h
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evtx_carve.h"
+#include "evtx_chunk.h"
+#include "evtx_record.h"
+#include "evtx_binxml.h"
+#include "evtx_output.h"
+#include "evtx_verify.h"
+#include "pool.h"
+
+
+#define CARVE_NONE      UINT64_MAX
+
+
+// what one stripe found, written by its own task
+typedef struct _CARVE_STATS {
+    uint32_t chunks;            // intact, decoded as a whole
+    uint32_t broken_chunks;     // a chunk header with a wrong CRC
+    uint32_t records;           // decoded one by one (broken or lost chunk)
+    uint32_t lost_records;      // their chunk could not be found
+} CARVE_STATS;
+
+typedef struct _CARVE {
+    const char    *path;
+    const uint8_t *base;        // the whole image, mapped
+    uint64_t       size;
+    const EVTX_OPTIONS *opts;
+    uint32_t       output_mode; // with OUT_SOURCE
+    CARVE_STATS   *stats;       // one per stripe
+} CARVE;
+
+typedef struct _CARVE_WORKER {
+    EVTX_CHUNK_CTX ctx;
+    uint64_t chunk_at;          // image offset of the chunk in ctx, for single records. CARVE_NONE: none
+    int      chunk_state;       // what evtx_chunk_begin() said about it
+    char     source[4096];      // image@offset of the chunk
+    uint8_t  chunk[EVTX_CHUNK_SIZE];    // a copy: at the end of the image, or with a header made up
+} CARVE_WORKER;
+
+
+
+// ------------------------------------------------------------
+// candidates
+// ------------------------------------------------------------
+
+static int carve_is_chunk(const CARVE *c, uint64_t off)
+{
+    return off + sizeof(EVTX_CHUNK_HEADER) <= c->size &&
+           memcmp(c->base + off, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) == 0;
+}
+
+// the first chunk signature at a sector in [from, to), to if none
+static uint64_t carve_next_chunk(const CARVE *c, uint64_t from, uint64_t to)
+{
+    uint64_t off = (from + EVTX_CARVE_CHUNK_ALIGN - 1) & ~(uint64_t)(EVTX_CARVE_CHUNK_ALIGN - 1);
+    for (; off < to; off += EVTX_CARVE_CHUNK_ALIGN) {
+        if (carve_is_chunk(c, off)) return off;
+    }
+    return to;
+}
+
+// the chunk set up by carve_record() for its records is done
+static void carve_end_chunk(CARVE_WORKER *w)
+{
+    if (w->chunk_at != CARVE_NONE && w->chunk_state == 0) evtx_chunk_end(&w->ctx);
+    w->chunk_at = CARVE_NONE;
+}
+
+// the 64KB chunk at off: in the mapping, or copied to the worker (zero padded)
+// when the image ends inside it
+static uint8_t *carve_chunk_buffer(const CARVE *c, CARVE_WORKER *w, uint64_t off)
+{
+    if (off + EVTX_CHUNK_SIZE <= c->size) return (uint8_t *)c->base + off;
+
+    // the copy may be the chunk of carve_record(), it is set up again for its next record
+    carve_end_chunk(w);
+
+    size_t n = (size_t)(c->size - off);
+    memcpy(w->chunk, c->base + off, n);
+    memset(w->chunk + n, 0, EVTX_CHUNK_SIZE - n);
+    return w->chunk;
+}
+
+// the size of the record at off when it looks complete: signature, a size
+// which fits in a chunk and the copy of it at the end. 0 if not
+static uint32_t carve_record_size(const CARVE *c, uint64_t off)
+{
+    EVTX_RECORD_HEADER rh;
+    uint32_t size_copy;
+
+    if (off + sizeof(rh) + 4 > c->size) return 0;
+    memcpy(&rh, c->base + off, sizeof(rh));
+    if (rh.signature != EVTX_RECORD_SIGNATURE || rh.record_size <= sizeof(rh) + 4 ||
+            rh.record_size > EVTX_CHUNK_SIZE - sizeof(EVTX_CHUNK_HEADER) || off + rh.record_size > c->size) {
+        return 0;
+    }
+    memcpy(&size_copy, c->base + off + rh.record_size - 4, 4);
+    return (size_copy == rh.record_size) ? rh.record_size : 0;
+}
+
+// the chunk of the record at off, CARVE_NONE if it is not found.
+// the BinXML starts with a template instance: template id and the offset of
+// its definition in the chunk. the chunk starts at a sector, holds the whole
+// record, and has the definition with the same id at that offset
+static uint64_t carve_record_chunk(const CARVE *c, uint64_t off, uint32_t size)
+{
+    const uint8_t *binxml = c->base + off + sizeof(EVTX_RECORD_HEADER);
+    BINXML_TEMPLATE_INSTANCE_HEADER ti;
+    size_t i;
+
+    if (size < sizeof(EVTX_RECORD_HEADER) + 10 + 1 + sizeof(ti) + 4) return CARVE_NONE;
+
+    // like binxml_read_instance(): 0x0c 0x01 just after the fragment header
+    for (i = 0; i < 10; i++) {
+        if (binxml[i] == 0x0c && binxml[i + 1] == 0x01) break;
+    }
+    if (i == 10) return CARVE_NONE;
+    memcpy(&ti, &binxml[i + 1], sizeof(ti));
+
+    if (ti.template_offset < sizeof(EVTX_CHUNK_HEADER) ||
+            ti.template_offset > EVTX_CHUNK_SIZE - sizeof(EVTX_TEMPLATE_DEFINITION_HEADER) ||
+            off < sizeof(EVTX_CHUNK_HEADER)) {
+        return CARVE_NONE;
+    }
+
+    uint64_t lowest = (off + size > EVTX_CHUNK_SIZE) ? off + size - EVTX_CHUNK_SIZE : 0;
+    uint64_t at = (off - sizeof(EVTX_CHUNK_HEADER)) & ~(uint64_t)(EVTX_CARVE_CHUNK_ALIGN - 1);
+
+    // the nearest one first, it is the chunk header just in front when there is one
+    for (;; at -= EVTX_CARVE_CHUNK_ALIGN) {
+        uint64_t def = at + ti.template_offset;
+        if (at < lowest) break;
+        if (def + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER) <= c->size &&
+                memcmp(c->base + def + 4, &ti.template_id, 4) == 0) {
+            return at;
+        }
+        if (at < EVTX_CARVE_CHUNK_ALIGN) break;
+    }
+    return CARVE_NONE;
+}
+
+
+
+// ------------------------------------------------------------
+// decoding what was found
+// ------------------------------------------------------------
+
+// the records of the chunk at chunk_at are tagged with image@offset
+static void carve_source(const CARVE *c, CARVE_WORKER *w, OUT_SINK *out, uint64_t chunk_at)
+{
+    snprintf(w->source, sizeof(w->source), "%s@0x%012" PRIx64, c->path, chunk_at);
+    w->ctx.source = w->source;
+
+    output_source_line(out, c->output_mode, w->source);
+}
+
+// one record of the chunk at chunk_at, which is not decoded as a whole.
+// the records of a chunk come one after another, the chunk is set up once for them
+static void carve_record(const CARVE *c, CARVE_WORKER *w, OUT_SINK *out, uint64_t chunk_at, uint64_t off)
+{
+    if (chunk_at != w->chunk_at) {
+        carve_end_chunk(w);
+
+        uint8_t *chunk = carve_chunk_buffer(c, w, chunk_at);
+        if (chunk != w->chunk) memcpy(w->chunk, chunk, EVTX_CHUNK_SIZE);
+
+        // the header is broken or not there at all: enough of one for the decoder,
+        // the records are walked here
+        EVTX_CHUNK_HEADER *ch = (EVTX_CHUNK_HEADER *)w->chunk;
+        if (memcmp(ch->signature, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) != 0) {
+            memcpy(ch->signature, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE));
+            ch->first_record_identifier = 0;
+            ch->last_record_identifier  = UINT64_MAX;
+            ch->last_record_offset      = 0;
+        }
+        ch->free_space_offset = EVTX_CHUNK_SIZE;
+
+        carve_source(c, w, out, chunk_at);
+        w->chunk_at    = chunk_at;
+        w->chunk_state = evtx_chunk_begin(&w->ctx, out, w->chunk, 0, c->output_mode);
+    }
+
+    if (w->chunk_state == 0) {
+        w->ctx.recovered = 1;
+        decode_evtx_record(&w->ctx, (uint32_t)(off - chunk_at));
+        w->ctx.recovered = 0;
+    }
+}
+
+// the records in [from, to) which are not in an intact chunk
+static void carve_records(const CARVE *c, CARVE_WORKER *w, OUT_SINK *out, CARVE_STATS *st,
+                          uint64_t from, uint64_t to)
+{
+    uint64_t off = (from + 7) & ~(uint64_t)7;
+
+    while (off < to) {
+        off += evtx_find_record_signature(c->base + off, (size_t)(to - off));
+        if (off >= to) break;
+
+        uint32_t size = carve_record_size(c, off);
+        if (!size) {
+            off += 8;
+            continue;
+        }
+
+        uint64_t chunk_at = carve_record_chunk(c, off, size);
+        if (chunk_at == CARVE_NONE) {
+            st->lost_records++;
+        } else {
+            carve_record(c, w, out, chunk_at, off);
+            st->records++;
+        }
+        off += ALIGN_8(size);
+    }
+}
+
+
+static void *carve_worker_init(void *arg)
+{
+    (void)arg;
+    CARVE_WORKER *w = malloc(sizeof(CARVE_WORKER));
+    if (w) {
+        evtx_chunk_ctx_init(&w->ctx);
+        w->chunk_at = CARVE_NONE;
+    }
+    return w;
+}
+
+static void carve_worker_free(void *worker)
+{
+    if (!worker) return;
+    evtx_chunk_ctx_free(&((CARVE_WORKER *)worker)->ctx);
+    free(worker);
+}
+
+// one stripe: the chunks and the records which start in it
+static void carve_task(void *arg, void *worker, uint32_t task_index, OUT_SINK *out)
+{
+    CARVE *c = (CARVE *)arg;
+    CARVE_WORKER *w = (CARVE_WORKER *)worker;
+    CARVE_STATS *st = &c->stats[task_index];
+
+    if (!w) {
+        fprintf(stderr, "ERROR: no decoder context for stripe #%u\n", task_index);
+        return;
+    }
+    evtx_options_apply(c->opts, &w->ctx);
+
+    uint64_t start = (uint64_t)task_index * EVTX_CARVE_STRIPE_SIZE;
+    uint64_t end   = (start + EVTX_CARVE_STRIPE_SIZE < c->size) ? start + EVTX_CARVE_STRIPE_SIZE : c->size;
+    uint64_t off   = start;
+
+    // an intact chunk of the stripe before may reach into this one, its records are done
+    uint64_t lowest = (start > EVTX_CHUNK_SIZE) ? start - EVTX_CHUNK_SIZE + EVTX_CARVE_CHUNK_ALIGN : 0;
+    for (uint64_t at = start; at > lowest; ) {
+        at -= EVTX_CARVE_CHUNK_ALIGN;
+        if (!carve_is_chunk(c, at)) continue;
+        if (evtx_verify_chunk(NULL, NULL, carve_chunk_buffer(c, w, at), 0) == EVTX_VERIFY_OK) {
+            off = at + EVTX_CHUNK_SIZE;
+        }
+        break;
+    }
+
+    while (off < end) {
+        uint64_t next = carve_next_chunk(c, off, end);
+        carve_records(c, w, out, st, off, next);
+        if (next >= end) break;
+
+        uint8_t *chunk = carve_chunk_buffer(c, w, next);
+        if (evtx_verify_chunk(NULL, NULL, chunk, 0) == EVTX_VERIFY_OK) {
+            carve_end_chunk(w);
+            carve_source(c, w, out, next);
+            decode_evtx_chunk(&w->ctx, out, chunk, 0, c->output_mode);
+            st->chunks++;
+            off = next + EVTX_CHUNK_SIZE;
+        } else {
+            // its records are carved one by one, they find the chunk again
+            st->broken_chunks++;
+            off = next + sizeof(EVTX_CHUNK_HEADER);
+        }
+    }
+    carve_end_chunk(w);
+}
+
+
+
+static int carve_image(const char *path, const EVTX_OPTIONS *opts, uint32_t output_mode, OUT_SINK *out)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fprintf(stderr, "ERROR: %s: not a regular file\n", path);
+        close(fd);
+        return 1;
+    }
+
+    CARVE c;
+    memset(&c, 0, sizeof(c));
+    c.path        = path;
+    c.size        = (uint64_t)st.st_size;
+    c.opts        = opts;
+    c.output_mode = output_mode;
+    c.base        = mmap(NULL, (size_t)c.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);      // the mapping stays
+    if (c.base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    madvise((void *)c.base, (size_t)c.size, MADV_SEQUENTIAL);
+
+    uint32_t stripe_count = (uint32_t)((c.size + EVTX_CARVE_STRIPE_SIZE - 1) / EVTX_CARVE_STRIPE_SIZE);
+    c.stats = calloc(stripe_count, sizeof(CARVE_STATS));
+    if (!c.stats) {
+        perror("calloc(carve)");
+        munmap((void *)c.base, (size_t)c.size);
+        return 1;
+    }
+
+    POOL_JOB job = { carve_task, &c, carve_worker_init, carve_worker_free, NULL };
+    int rtn_code = (pool_run_ordered(opts->jobs, stripe_count, &job, out) != 0);
+
+    CARVE_STATS total = { 0, 0, 0, 0 };
+    for (uint32_t i = 0; i < stripe_count; i++) {
+        total.chunks        += c.stats[i].chunks;
+        total.broken_chunks += c.stats[i].broken_chunks;
+        total.records       += c.stats[i].records;
+        total.lost_records  += c.stats[i].lost_records;
+    }
+    fprintf(stderr, "%s: %" PRIu32 " intact chunk(s), %" PRIu32 " broken chunk(s), "
+            "%" PRIu32 " record(s) outside intact chunks, %" PRIu32 " more without their chunk\n",
+            path, total.chunks, total.broken_chunks, total.records, total.lost_records);
+
+    free(c.stats);
+    munmap((void *)c.base, (size_t)c.size);
+    return rtn_code;
+}
+
+
+int evtx_carve(const char *const *paths, int path_count, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    uint32_t output_mode = opts->output_mode;
+    SET_OUTMODE(output_mode, OUT_SOURCE);
+    output_header(out, output_mode);
+
+    int rtn_code = 0;
+    for (int i = 0; i < path_count; i++) {
+        rtn_code |= carve_image(paths[i], opts, output_mode, out);
+    }
+    return rtn_code;
+}
@@ -0,0 +1,42 @@
+/* evtx_carve.h
+ *
+ * --carve: recover event records from a raw disk image (unallocated space,
+ * a dd of a partition, memory ...) where there is no EVTX file to follow.
+ *
+ * The image is mapped and cut into stripes, which the -j threads scan in
+ * parallel (the output keeps the image order). In a stripe
+ *
+ *   - "ElfChnk\0" at every 512 bytes (chunks start at a sector of the file)
+ *     is a chunk. When both its CRCs are right (evtx_verify.h) it is decoded
+ *     as a whole, like a chunk of a file.
+ *   - "**\0\0" at every 8 bytes (records are 8 byte aligned in a chunk) with
+ *     the copy of the record size at its end is a record. Records of a chunk
+ *     with a broken CRC are decoded one by one with that chunk. For a record
+ *     whose chunk header is gone, the chunk is found from the template of
+ *     the record: the template definition it refers to (an offset in its
+ *     chunk) must hold the same template id.
+ *
+ * Every record is tagged with image@offset (the Source field of CSV / JSON,
+ * a "==> ... <==" line for the other formats), the ones decoded one by one and
+ * those in the slack of intact chunks are flagged as recovered. What was found
+ * goes to stderr at the end.
+ */
+
+#if !defined( EVTX_CARVE_H )
+#define EVTX_CARVE_H
+
+#include <stdint.h>
+
+#include "evtx_file.h"
+
+
+// the piece of the image one task scans
+#define EVTX_CARVE_STRIPE_SIZE      (4u << 20)
+
+// sector size: chunks are looked for at this alignment
+#define EVTX_CARVE_CHUNK_ALIGN      512
+
+// carve the images (any files) in paths one after another, the records go to out
+int evtx_carve(const char *const *paths, int path_count, const EVTX_OPTIONS *opts, OUT_SINK *out);
+
+#endif /* !defined( EVTX_CARVE_H ) */
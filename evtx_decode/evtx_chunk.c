@@ -23,21 +23,21 @@
 
 
 
-// the chunks started just after EVTX_FILE header block
-#define EVTX_CHUNK_START_OFFSET 4096
-
 // functions only called in this file
-static void decode_evtx_chunk_header(uint32_t chunk_base, 
+static void decode_evtx_chunk_header(OUT_SINK *out,
+                                     uint32_t chunk_base, 
                                      uint8_t *chunk_buffer,
                                      uint16_t output_mode); 
 
-static void decode_common_string_entry(uint32_t chunk_base, 
+static void decode_common_string_entry(OUT_SINK *out,
+                                     uint32_t chunk_base, 
                                      uint8_t *chunk_buffer,
                                      uint32_t offset, 
                                      int      entry_index, 
                                      uint16_t output_mode);
 
-static void decode_template_ptr_entry(uint32_t chunk_base, 
+static void decode_template_ptr_entry(OUT_SINK *out,
+                                     uint32_t chunk_base, 
                                      uint8_t *chunk_buffer,
                                       uint32_t offset, 
                                       int      entry_index, 
@@ -46,67 +46,133 @@ static void decode_template_ptr_entry(uint32_t chunk_base,
 
 
 
-static NAME_CACHE_LIST *chunk_name_get_cache_list() {
-    static NAME_CACHE_LIST my_name_cache_list = { NULL };
-    return &my_name_cache_list;
+// decode the name entry into the pool
+static const char *name_pool_add(EVTX_CHUNK_CTX *ctx, uint32_t name_offset, uint32_t *len)
+{
+    EVTX_NAME_ENTRY_HEADER nh;
+    memcpy(&nh, &ctx->chunk_buffer[name_offset], sizeof(nh));
+
+    uint32_t chars = name_offset + sizeof(nh);
+    if (chars + nh.char_count * 2 > EVTX_CHUNK_SIZE) {
+        return NULL;
+    }
+
+    // one UTF-16 unit is at most 3 bytes of UTF-8 (a surrogate pair 4 bytes for 2 units)
+    size_t size = UTF16LE_UTF8_SIZE(nh.char_count);
+    char *str = arena_alloc_align(&ctx->arena, size, 1);
+    if (!str) return NULL;
+
+    *len = (uint32_t)utf16le_to_utf8((uint16_t *)&ctx->chunk_buffer[chars], nh.char_count, str);
+
+    // give back what the string did not use
+    arena_shrink(&ctx->arena, str, size, *len + 1);
+
+    return str;
 }
 
 
+const char *chunk_get_name(EVTX_CHUNK_CTX *ctx, uint32_t name_offset, uint32_t *len)
+{
+    uint32_t dummy;
+    if (!len) len = &dummy;
+    *len = 0;
 
+    if (name_offset == 0 || name_offset + sizeof(EVTX_NAME_ENTRY_HEADER) > EVTX_CHUNK_SIZE) {
+        return "";
+    }
 
+    EVTX_NAME_POOL *pool = &ctx->names;
+    uint32_t h = (name_offset >> 2) & (EVTX_NAME_SLOTS - 1);
+    EVTX_NAME_SLOT *slot = NULL;
 
+    for (uint32_t n = 0; n < EVTX_NAME_SLOTS; n++) {
+        EVTX_NAME_SLOT *s = &pool->slots[(h + n) & (EVTX_NAME_SLOTS - 1)];
+        if (s->offset == name_offset) {
+            *len = s->len;
+            return s->str;
+        }
+        if (s->offset == 0) {
+            slot = s;
+            break;
+        }
+    }
+
+    const char *str = name_pool_add(ctx, name_offset, len);
+    if (!str) {
+        *len = 0;
+        return "";
+    }
 
-// for new chunk, clear all data of previuous chunk
-static void chunk_name_offset_clear_cache() {
-    NAME_CACHE_LIST *cache = chunk_name_get_cache_list();
-    NAME_CACHE_NODE *curr = cache->head;
-    while (curr) {
-        NAME_CACHE_NODE *next = curr->next;
-        free(curr);
-        curr = next;
+    // table full: the name is still valid, only decoded again next time
+    if (slot && pool->used < EVTX_NAME_MAX_USED) {
+        slot->offset = name_offset;
+        slot->len    = *len;
+        slot->str    = str;
+        pool->used++;
     }
 
-    // Important: set head to NULL so it's ready for the next chunk
-    cache->head = NULL; 
+    return str;
+}
+
+
+void evtx_chunk_ctx_init(EVTX_CHUNK_CTX *ctx)
+{
+    memset(ctx, 0, sizeof(*ctx));
+    arena_init(&ctx->arena, 0);
+    arena_init(&ctx->scratch, 0);
+    xml_init_tree(&ctx->xtree);
+    out_sink_init_memory(&ctx->value_out);
+}
+
+
+void evtx_chunk_ctx_free(EVTX_CHUNK_CTX *ctx)
+{
+    arena_free(&ctx->arena);
+    arena_free(&ctx->scratch);
+    xml_release_tree(&ctx->xtree);
+    out_sink_free(&ctx->value_out);
 }
 
 
 
-// リストにオフセットが存在するか確認
-int chunk_name_offset_is_cached(uint32_t offset) {
-    NAME_CACHE_LIST *list = chunk_name_get_cache_list();
-    NAME_CACHE_NODE *curr = list->head;
-    while (curr) {
-        if (curr->offset == offset) return 1;
-        curr = curr->next;
+ 
+// the timestamp of the record header at record_base, 0 if there is no record
+static uint64_t chunk_record_timestamp(const uint8_t *chunk_buffer, uint32_t record_base)
+{
+    if (record_base < sizeof(EVTX_CHUNK_HEADER) || record_base + sizeof(EVTX_RECORD_HEADER) > EVTX_CHUNK_SIZE) {
+        return 0;
     }
-    return 0;
+
+    EVTX_RECORD_HEADER rh;
+    memcpy(&rh, &chunk_buffer[record_base], sizeof(rh));
+    return (rh.signature == EVTX_RECORD_SIGNATURE) ? rh.timestamp : 0;
 }
 
-// リストにオフセットを追加
-void chunk_name_offset_add_cache(uint32_t offset) {
-    NAME_CACHE_LIST *list = chunk_name_get_cache_list();
-    if (chunk_name_offset_is_cached(offset)) return;
-    
-    NAME_CACHE_NODE *new_node = malloc(sizeof(NAME_CACHE_NODE));
-    new_node->offset = offset;
-    new_node->next = list->head;
-    list->head = new_node;
+// records are appended to a chunk as they are written, so their timestamps go up:
+// the first and the last record tell whether the chunk can have anything in the window
+static int chunk_outside_window(EVTX_CHUNK_CTX *ctx, const uint8_t *chunk_buffer)
+{
+    if (!ctx->since && !ctx->until) return 0;
+
+    const EVTX_CHUNK_HEADER *ch = (const EVTX_CHUNK_HEADER *)chunk_buffer;
+    uint64_t first = chunk_record_timestamp(chunk_buffer, sizeof(EVTX_CHUNK_HEADER));
+    uint64_t last  = chunk_record_timestamp(chunk_buffer, ch->last_record_offset);
+    if (!first || !last || first > last) {
+        return 0;   // not sure, let the records decide
+    }
+
+    return (ctx->since && last < ctx->since) || (ctx->until && first > ctx->until);
 }
 
- 
-int decode_evtx_chunk(FILE *fp, uint16_t chunk_index, uint32_t output_mode)
+
+int evtx_chunk_begin(EVTX_CHUNK_CTX *ctx, OUT_SINK *out, uint8_t *chunk_buffer, uint16_t chunk_index, uint32_t output_mode)
 {
     // the absolute offset in the file, it should be 0x00001000, 0x00011000, 0x00021000, ...
     // this is the absolute starting point of this chunk in the input evtx file
     uint32_t chunk_base =
         EVTX_CHUNK_START_OFFSET + (uint32_t)chunk_index * EVTX_CHUNK_SIZE;
 
-    // read the whole chunk into memory
-    uint8_t *chunk_buffer = malloc(EVTX_CHUNK_SIZE);
-    fseek(fp, chunk_base, SEEK_SET); 
-    fread(chunk_buffer, 1, EVTX_CHUNK_SIZE, fp);
-    
+    // the whole chunk is already in memory (mapped or read by the caller)
     // the chunk header
     EVTX_CHUNK_HEADER *ch = (EVTX_CHUNK_HEADER *)chunk_buffer; 
 
@@ -116,15 +182,104 @@ int decode_evtx_chunk(FILE *fp, uint16_t chunk_index, uint32_t output_mode)
         return 1;
     }
 
-    // New Chunk starts, wipe any names from the previous chunk
-    chunk_name_offset_clear_cache();
+    // --since / --until: nothing of this chunk is in the window, do not even look at it.
+    // the live records say nothing about the slack (older records, most of the time),
+    // with OUT_SLACK only the record walk of decode_evtx_chunk() is skipped
+    if (!CHECK_OUTMODE(output_mode, OUT_SLACK) && chunk_outside_window(ctx, chunk_buffer)) {
+        return 2;
+    }
+
+    // --record: the chunk header tells which records are in the chunk
+    if (ctx->record_last && (ch->last_record_identifier < ctx->record_first ||
+                             ch->first_record_identifier > ctx->record_last)) {
+        return 2;
+    }
+
+    // New Chunk starts, point the context at it
+    ctx->chunk_buffer = chunk_buffer;
+    ctx->chunk_base   = chunk_base;
+    ctx->chunk_index  = chunk_index;
+    ctx->output_mode  = output_mode;
+    ctx->out          = out;
+    memset(&ctx->names, 0, sizeof(ctx->names));
+    memset(&ctx->templates, 0, sizeof(ctx->templates));
+    arena_reset(&ctx->arena);
+
 
+    // a SAX consumer may not want this chunk
+    if (ctx->sax && ctx->sax->on_chunk && ctx->sax->on_chunk(ctx->sax->user, chunk_index, ch) != 0) {
+        return 2;
+    }
 
     // decode the header: first 512 bytes 
-    decode_evtx_chunk_header(chunk_base, chunk_buffer, output_mode);
+    if (!ctx->sax) {
+        decode_evtx_chunk_header(out, chunk_base, chunk_buffer, output_mode);
+    }
+
+    return 0;
+}
+
+
+void evtx_chunk_end(EVTX_CHUNK_CTX *ctx)
+{
+    // compiled templates are only valid for this chunk
+    evtx_template_cache_clear(&ctx->templates);
+}
+
+
+// the records in [from, 64KB) of the chunk which can still be decoded, flagged as recovered.
+// deleted and overwritten records stay in the slack of a chunk until the space is written
+// again, most of it is zeros or a few records: the signature search skips it at vector speed
+static void chunk_recover_records(EVTX_CHUNK_CTX *ctx, uint32_t from)
+{
+    uint32_t off = ALIGN_8(from);
+    if (off < sizeof(EVTX_CHUNK_HEADER)) off = sizeof(EVTX_CHUNK_HEADER);
+
+    ctx->recovered = 1;
+    while (off < EVTX_CHUNK_SIZE) {
+        off += (uint32_t)evtx_find_record_signature(&ctx->chunk_buffer[off], EVTX_CHUNK_SIZE - off);
+        if (off >= EVTX_CHUNK_SIZE) break;
+
+        uint32_t size = evtx_record_recoverable(ctx->chunk_buffer, off);
+        if (!size) {
+            off += 8;
+            continue;
+        }
+        decode_evtx_record(ctx, off);
+        off += ALIGN_8(size);
+    }
+    ctx->recovered = 0;
+}
+
+
+int evtx_chunk_recover(EVTX_CHUNK_CTX *ctx, OUT_SINK *out, uint8_t *chunk_buffer, uint16_t chunk_index, uint32_t output_mode)
+{
+    if (memcmp(chunk_buffer, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) != 0) {
+        return 1;   // never written, or not a chunk any more
+    }
+
+    int rtn_code = evtx_chunk_begin(ctx, out, chunk_buffer, chunk_index, output_mode);
+    if (rtn_code != 0) {
+        return (rtn_code == 1) ? 1 : 0;
+    }
+    chunk_recover_records(ctx, sizeof(EVTX_CHUNK_HEADER));
+    evtx_chunk_end(ctx);
+
+    return 0;
+}
+
 
-    // walk through all records in this chunk, if there are records 
-    if (ch->first_record_identifier > 0) { 
+int decode_evtx_chunk(EVTX_CHUNK_CTX *ctx, OUT_SINK *out, uint8_t *chunk_buffer, uint16_t chunk_index, uint32_t output_mode)
+{
+    int rtn_code = evtx_chunk_begin(ctx, out, chunk_buffer, chunk_index, output_mode);
+    if (rtn_code != 0) {
+        return (rtn_code == 1) ? 1 : 0;     // 2: skipped, not an error
+    }
+
+    EVTX_CHUNK_HEADER *ch = (EVTX_CHUNK_HEADER *)chunk_buffer; 
+
+    // walk through all records in this chunk, if there are records and some may be in the window
+    if (ch->first_record_identifier > 0 && !chunk_outside_window(ctx, chunk_buffer)) { 
 
         // how many records in this chunk: (but how about some records are deleted?)
         uint64_t record_count = ch->last_record_identifier - ch->first_record_identifier + 1;
@@ -139,8 +294,9 @@ int decode_evtx_chunk(FILE *fp, uint16_t chunk_index, uint32_t output_mode)
             EVTX_RECORD_HEADER *rh = (EVTX_RECORD_HEADER *) &chunk_buffer[record_base]; 
     
             // call function to handle this record
-            if (decode_evtx_record(chunk_base, record_base, chunk_buffer, output_mode) != 0) {
-                return 3;   // wrong record found
+            if (decode_evtx_record(ctx, record_base) != 0) {
+                rtn_code = 3;   // wrong record found
+                break;
             }
     
             // move to next record and alignment to 8 Bytes  
@@ -153,17 +309,20 @@ int decode_evtx_chunk(FILE *fp, uint16_t chunk_index, uint32_t output_mode)
         }
     }
 
-    // clear it again at the end to free memory immediately
-    chunk_name_offset_clear_cache();
+    // what is left after the last record
+    if (CHECK_OUTMODE(output_mode, OUT_SLACK) &&
+            ch->free_space_offset >= sizeof(EVTX_CHUNK_HEADER) && ch->free_space_offset < EVTX_CHUNK_SIZE) {
+        chunk_recover_records(ctx, ch->free_space_offset);
+    }
 
-    free(chunk_buffer);
+    evtx_chunk_end(ctx);
 
-    return 0;
+    return rtn_code;
 }
 
 
 // decode header
-static void decode_evtx_chunk_header(uint32_t chunk_base, uint8_t *chunk_buffer, uint16_t output_mode) 
+static void decode_evtx_chunk_header(OUT_SINK *out, uint32_t chunk_base, uint8_t *chunk_buffer, uint16_t output_mode) 
 {
     // the chunk header
     EVTX_CHUNK_HEADER *ch = (EVTX_CHUNK_HEADER *)chunk_buffer; 
@@ -174,24 +333,25 @@ static void decode_evtx_chunk_header(uint32_t chunk_base, uint8_t *chunk_buffer,
         uint64_t chunk_index = (chunk_base - EVTX_CHUNK_START_OFFSET) / EVTX_CHUNK_SIZE;
 
         // and print out header details
-        printf("%.8s#%05" PRIu64 " (0x%08" PRIx32 ")\t", 
+        out_printf(out, "%.8s#%05" PRIu64 " (0x%08" PRIx32 ")\t", 
                ch->signature, 
                chunk_index,
                chunk_base); 
-        printf("record_num=%" PRIu64 "-%" PRIu64 "\t",
+        out_printf(out, "record_num=%" PRIu64 "-%" PRIu64 "\t",
                ch->first_record_number,
                ch->last_record_number);
-        printf("record_id=%" PRIu64 "-%" PRIu64 "\t",
+        out_printf(out, "record_id=%" PRIu64 "-%" PRIu64 "\t",
                ch->first_record_identifier,
                ch->last_record_identifier);
-        printf("last_offset=0x%" PRIx32 "\tfree_offset=0x%" PRIx32,
+        out_printf(out, "last_offset=0x%" PRIx32 "\tfree_offset=0x%" PRIx32,
                ch->last_record_offset,
                ch->free_space_offset);
-        printf("\n");
+        out_printf(out, "\n");
     }
 
     if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-        hex_dump_bytes((uint8_t *)ch, ch->header_size);
+        // the header of a broken (carved) chunk may say anything
+        hex_dump_bytes(out, (uint8_t *)ch, (ch->header_size <= sizeof(EVTX_CHUNK_HEADER)) ? ch->header_size : 0x80);
     }
 
 
@@ -203,7 +363,7 @@ static void decode_evtx_chunk_header(uint32_t chunk_base, uint8_t *chunk_buffer,
             uint32_t string_offset = ch->string_offset_array[i];
             if (string_offset > 0) {   // if this offset is in using 
                 // call function to process each
-                decode_common_string_entry(chunk_base, chunk_buffer, string_offset, i, output_mode);
+                decode_common_string_entry(out, chunk_base, chunk_buffer, string_offset, i, output_mode);
             }
         }
     }
@@ -215,7 +375,7 @@ static void decode_evtx_chunk_header(uint32_t chunk_base, uint8_t *chunk_buffer,
             uint32_t template_offsets = ch->template_ptr_array[i];
             if (template_offsets > 0) { // if this offset is in using 
                 // call function to process each
-                decode_template_ptr_entry(chunk_base, chunk_buffer, template_offsets, i, output_mode);
+                decode_template_ptr_entry(out, chunk_base, chunk_buffer, template_offsets, i, output_mode);
             }
         }
 
@@ -224,14 +384,19 @@ static void decode_evtx_chunk_header(uint32_t chunk_base, uint8_t *chunk_buffer,
 
 
 
-static void decode_common_string_entry(uint32_t chunk_base, uint8_t *chunk_buffer, uint32_t offset, int entry_index, uint16_t output_mode) 
+static void decode_common_string_entry(OUT_SINK *out, uint32_t chunk_base, uint8_t *chunk_buffer, uint32_t offset, int entry_index, uint16_t output_mode) 
 {
+    // a broken chunk: offsets outside it, or chains which do not go forward
+    if (offset < sizeof(EVTX_CHUNK_HEADER) || offset > EVTX_CHUNK_SIZE - sizeof(EVTX_NAME_ENTRY_HEADER)) {
+        return;
+    }
+
     // read the NAME ENTRY HEADER (fixed size)
     EVTX_NAME_ENTRY_HEADER *n_header = (EVTX_NAME_ENTRY_HEADER *) &chunk_buffer[offset];
 
 
     // 3. show summary line
-    printf("Namestring#%02d (0x%08" PRIx32 ")\tnext_offset=0x%08" PRIx32 "\thash=0x%04" PRIx16 "\tlength=%" PRIu16 "\t", 
+    out_printf(out, "Namestring#%02d (0x%08" PRIx32 ")\tnext_offset=0x%08" PRIx32 "\thash=0x%04" PRIx16 "\tlength=%" PRIu16 "\t", 
            entry_index, 
            chunk_base + offset, 
            n_header->next_offset, 
@@ -239,28 +404,31 @@ static void decode_common_string_entry(uint32_t chunk_base, uint8_t *chunk_buffe
            n_header->char_count);
     
     // 4. print the UTF-16LE string
-    print_name_from_offset(chunk_buffer, offset);
-    printf("\n");
+    print_name_from_offset(out, chunk_buffer, offset);
+    out_printf(out, "\n");
 
     // 5. if n_header.next_offset is not 0, need to jump to next_offset
-    if (n_header->next_offset > 0) { 
+    if (n_header->next_offset > offset) { 
         // call ourself
         // using -1 to indicate it's a "next_offset"
-        decode_common_string_entry(chunk_base, chunk_buffer, n_header->next_offset, -1, output_mode); 
+        decode_common_string_entry(out, chunk_base, chunk_buffer, n_header->next_offset, -1, output_mode); 
     }
 }
 
 
 
 
-static void decode_template_ptr_entry(uint32_t chunk_base, uint8_t *chunk_buffer, uint32_t offset, int entry_index, uint16_t output_mode) 
+static void decode_template_ptr_entry(OUT_SINK *out, uint32_t chunk_base, uint8_t *chunk_buffer, uint32_t offset, int entry_index, uint16_t output_mode) 
 {
+    if (offset < sizeof(EVTX_CHUNK_HEADER) || offset > EVTX_CHUNK_SIZE - sizeof(EVTX_TEMPLATE_DEFINITION_HEADER)) {
+        return;
+    }
 
     // 1. read the TEMPLATE Definition Header (fixed size)
     EVTX_TEMPLATE_DEFINITION_HEADER *t_header = (EVTX_TEMPLATE_DEFINITION_HEADER *) &chunk_buffer[offset];
 
     // 2. print out summary
-    printf("Template#%02d   (0x%08" PRIx32 ")\tnext_offset=0x%08" PRIx32 "\tID=0x%08" PRIx32 "\tbinxml_size=%" PRIu32 "B\n", 
+    out_printf(out, "Template#%02d   (0x%08" PRIx32 ")\tnext_offset=0x%08" PRIx32 "\tID=0x%08" PRIx32 "\tbinxml_size=%" PRIu32 "B\n", 
            entry_index, 
            chunk_base + offset, 
            t_header->next_offset, 
@@ -268,10 +436,10 @@ static void decode_template_ptr_entry(uint32_t chunk_base, uint8_t *chunk_buffer
            t_header->data_size);
 
     // 3. if next_offset, recursive call ourself, but using -1 to indicate next_offset
-    if (t_header->next_offset > 0) {
+    if (t_header->next_offset > offset) {
         // call ourself
         // using -1 to indicate it's a "next_offset"
-        decode_template_ptr_entry(chunk_base, chunk_buffer, t_header->next_offset, -1, output_mode);
+        decode_template_ptr_entry(out, chunk_base, chunk_buffer, t_header->next_offset, -1, output_mode);
     }
 }
 
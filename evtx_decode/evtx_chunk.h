@@ -9,9 +9,18 @@
 
 #include <inttypes.h>
 
+#include "evtx_template.h"
+#include "out_sink.h"
+#include "arena.h"
+#include "evtx_xmltree.h"
+#include "evtx_sax.h"
+
 #define EVTX_CHUNK_SIZE             0x10000
 #define EVTX_CHUNK_SIGNATURE        "ElfChnk"
 
+// the chunks started just after EVTX_FILE header block
+#define EVTX_CHUNK_START_OFFSET     4096
+
 
 #pragma pack(push, 1)
 typedef struct _EVTX_CHUNK_HEADER {
@@ -55,20 +64,76 @@ typedef struct _EVTX_TEMPLATE_DEFINITION_HEADER {
 #pragma pack(pop)
 
 
-// オフセットを記録するためのノード
-typedef struct _NAME_CACHE_NODE {
-    uint32_t offset;
-    struct _NAME_CACHE_NODE *next;
-} NAME_CACHE_NODE;
-
-// リスト管理用
-typedef struct {
-    NAME_CACHE_NODE *head;
-} NAME_CACHE_LIST;
-
-int chunk_name_offset_is_cached(uint32_t offset); 
-void chunk_name_offset_add_cache(uint32_t offset);
-
-int decode_evtx_chunk(FILE *fp, uint16_t chunk_index, uint32_t output_mode);
+// element and attribute names of the chunk, converted to UTF-8 once
+// open addressing keyed by the name offset, the strings live in the chunk arena
+// so a name pointer stays valid until the end of the chunk
+#define EVTX_NAME_SLOTS         1024    // power of 2
+#define EVTX_NAME_MAX_USED      768     // keep the table sparse
+
+typedef struct _EVTX_NAME_SLOT {
+    uint32_t    offset;         // 0 = empty slot
+    uint32_t    len;
+    const char *str;            // UTF-8, NULL terminated
+} EVTX_NAME_SLOT;
+
+typedef struct _EVTX_NAME_POOL {
+    uint32_t         used;
+    EVTX_NAME_SLOT   slots[EVTX_NAME_SLOTS];
+} EVTX_NAME_POOL;
+
+
+// everything needed while decoding one chunk
+// there is no global state, so each thread can decode its own chunk with its own context.
+// a context is reused for all the chunks a thread decodes, so are its arenas
+typedef struct _EVTX_CHUNK_CTX {
+    uint8_t  *chunk_buffer;     // the whole 64KB chunk
+    uint32_t  chunk_base;       // absolute offset of this chunk in the file
+    uint16_t  chunk_index;
+    uint32_t  output_mode;
+    OUT_SINK *out;              // everything printed for this chunk goes here
+    const EVTX_SAX *sax;        // callbacks instead of printing, NULL to print (set by the caller)
+    const struct _EVTX_EVTID_FILTER *evtid_filter;  // -e, NULL for all records (set by the caller)
+    uint64_t  since;            // --since / --until as FILETIME, 0 = no limit (set by the caller)
+    uint64_t  until;
+    uint64_t  record_first;     // --record: record identifiers, record_last 0 = all (set by the caller)
+    uint64_t  record_last;
+    const char *source;         // batch mode: the input file, tags the records (set by the caller)
+    int       recovered;        // the records being decoded are not in the record walk (slack, carving)
+
+    // names of this chunk, decoded on first use
+    EVTX_NAME_POOL names;
+
+    // templates of this chunk, compiled on first use
+    EVTX_TEMPLATE_CACHE templates;
+
+    ARENA     arena;            // reset per chunk: names
+    ARENA     scratch;          // reset per record: value tables, element stacks
+    XML_TREE  xtree;            // reset per record, has its own arena
+    OUT_SINK  value_out;        // memory sink, one value formatted as text for the tree
+} EVTX_CHUNK_CTX;
+
+// before the first chunk / after the last one
+void evtx_chunk_ctx_init(EVTX_CHUNK_CTX *ctx);
+void evtx_chunk_ctx_free(EVTX_CHUNK_CTX *ctx);
+
+// the UTF-8 name of the name entry at name_offset, decoded once per chunk
+// never NULL (an empty string for a broken offset), valid until the end of the chunk
+const char *chunk_get_name(EVTX_CHUNK_CTX *ctx, uint32_t name_offset, uint32_t *len);
+
+// chunk_buffer points to the whole 64KB chunk, either inside a file mapping or a read buffer
+// ctx is owned by the caller (see evtx_chunk_ctx_init) and set up here for this chunk, the output goes to out.
+// with OUT_SLACK the space after free_space_offset is searched for records too (see evtx_chunk_recover)
+int decode_evtx_chunk(EVTX_CHUNK_CTX *ctx, OUT_SINK *out, uint8_t *chunk_buffer, uint16_t chunk_index, uint32_t output_mode);
+
+// a chunk past the chunk_count of the file header (left from a bigger log, or after a clear):
+// nothing of it is trusted, every record which looks whole is decoded and flagged as recovered.
+// returns 1 without a word when there is no chunk signature
+int evtx_chunk_recover(EVTX_CHUNK_CTX *ctx, OUT_SINK *out, uint8_t *chunk_buffer, uint16_t chunk_index, uint32_t output_mode);
+
+// decode_evtx_chunk() without the record walk, for callers which pick the records themselves
+// (decode_evtx_record() between them). begin returns 0 to go on, 1 for a broken chunk,
+// 2 when the chunk is skipped (--since/--until without OUT_SLACK, SAX on_chunk); end only after a 0
+int  evtx_chunk_begin(EVTX_CHUNK_CTX *ctx, OUT_SINK *out, uint8_t *chunk_buffer, uint16_t chunk_index, uint32_t output_mode);
+void evtx_chunk_end(EVTX_CHUNK_CTX *ctx);
 
 #endif
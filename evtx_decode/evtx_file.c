@@ -5,29 +5,41 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include "evtx_file.h"
 #include "evtx_chunk.h"
 #include "hex_dump.h"
 #include "evtx_output.h"
+#include "pool.h"
+#include "evtx_sax.h"
+#include "evtx_index.h"
 
 // verify and decode the evtx file header
-static int decode_evtx_file_header(FILE *fp, EVTX_FILE_HEADER *fh, int output_mode)
+int decode_evtx_file_header(OUT_SINK *out, EVTX_FILE_HEADER *fh, int output_mode, const EVTX_SAX *sax)
 {
 
     // verify the signature first
     if (memcmp(fh->signature, EVTX_FILE_SIGNATURE, sizeof(EVTX_FILE_SIGNATURE)) == 0) {
+        if (sax) {
+            // nothing is printed for a SAX consumer, it may stop here
+            return (sax->on_file_header && sax->on_file_header(sax->user, fh) != 0) ? 2 : 0;
+        }
+
         if (IS_OUT_DEFAULT(output_mode)) {
 
             // print the contents of head
-            printf("%.8s", fh->signature);
-            printf("\t      version=%u.%u", fh->major_version, fh->minor_version);
-            printf("\tchunk=%" PRIu64 "-%" PRIu64 "", fh->first_chunk_number, fh->last_chunk_number);
-            printf("\tchunk_counts=%" PRIu16 "", fh->chunk_count);
-            //printf("\tchunk_offset=0x%08" PRIx16 "", fh->header_block_size);
-            printf("\tnext_record_id=%" PRIu64 "", fh->next_record_id);
-            printf("\tflags=0x%02" PRIx32 "", fh->flags);
+            out_printf(out, "%.8s", fh->signature);
+            out_printf(out, "\t      version=%u.%u", fh->major_version, fh->minor_version);
+            out_printf(out, "\tchunk=%" PRIu64 "-%" PRIu64 "", fh->first_chunk_number, fh->last_chunk_number);
+            out_printf(out, "\tchunk_counts=%" PRIu16 "", fh->chunk_count);
+            //out_printf(out, "\tchunk_offset=0x%08" PRIx16 "", fh->header_block_size);
+            out_printf(out, "\tnext_record_id=%" PRIu64 "", fh->next_record_id);
+            out_printf(out, "\tflags=0x%02" PRIx32 "", fh->flags);
             { // flags as text
                 char ftext[8]; 
                 switch (fh->flags) {
@@ -36,16 +48,16 @@ static int decode_evtx_file_header(FILE *fp, EVTX_FILE_HEADER *fh, int output_mo
                     case 0x02: strcpy(ftext, "full"); break;;
                     default  : strcpy(ftext, "unknown"); break;;
                 }
-                printf("(%s)", ftext);
+                out_printf(out, "(%s)", ftext);
             }
-            //printf("\theader_size=%" PRIu32 "", fh->header_size);
-            printf("\n");
+            //out_printf(out, "\theader_size=%" PRIu32 "", fh->header_size);
+            out_printf(out, "\n");
 
         } 
 
         if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-            uint32_t offset = 0x00000000; // the starting of this file
-            hex_dump_file(fp, offset, fh->header_size);
+            // the header is already in memory, no need to seek back to offset 0
+            hex_dump_bytes(out, (uint8_t *)fh, fh->header_size);
         }
 
     } else {
@@ -57,19 +69,341 @@ static int decode_evtx_file_header(FILE *fp, EVTX_FILE_HEADER *fh, int output_mo
 }
 
 
-int decode_evtx_file(FILE *fp, uint32_t output_mode)
+void evtx_options_apply(const EVTX_OPTIONS *opts, EVTX_CHUNK_CTX *ctx)
 {
-    // read file header
-    EVTX_FILE_HEADER fh;
-    fread(&fh, sizeof(fh), 1, fp);
+    ctx->sax          = opts->sax;
+    ctx->evtid_filter = opts->evtid_filter;
+    ctx->since        = opts->since;
+    ctx->until        = opts->until;
+    ctx->record_first = opts->record_first;
+    ctx->record_last  = opts->record_last;
+}
+
+
+// what a chunk worker needs to decode chunk #task_index of a mapped file
+typedef struct _CHUNK_TASK_ARG {
+    uint8_t  *file_base;
+    uint32_t  output_mode;
+    const EVTX_OPTIONS *opts;
+    uint16_t  chunk_count;      // in the file header, the chunks after it are only recovered
+} CHUNK_TASK_ARG;
+
+// each worker decodes with its own context, kept for all the chunks it decodes
+static void *chunk_worker_init(void *arg)
+{
+    (void)arg;
+    EVTX_CHUNK_CTX *ctx = malloc(sizeof(EVTX_CHUNK_CTX));
+    if (ctx) evtx_chunk_ctx_init(ctx);
+    return ctx;
+}
+
+static void chunk_worker_free(void *worker)
+{
+    if (!worker) return;
+    evtx_chunk_ctx_free((EVTX_CHUNK_CTX *)worker);
+    free(worker);
+}
+
+static void decode_chunk_task(void *arg, void *worker, uint32_t task_index, OUT_SINK *out)
+{
+    CHUNK_TASK_ARG *ta = (CHUNK_TASK_ARG *)arg;
+    EVTX_CHUNK_CTX *ctx = (EVTX_CHUNK_CTX *)worker;
+    size_t chunk_base = EVTX_CHUNK_START_OFFSET + (size_t)task_index * EVTX_CHUNK_SIZE;
 
-    // decode the evtx file header then decode each chunk 
-    if (decode_evtx_file_header(fp, &fh, output_mode) == 0) {
-        for (uint16_t i = 0; i < fh.chunk_count; i++) {
-            decode_evtx_chunk(fp, i, output_mode);
+    if (!ctx) {
+        fprintf(stderr, "ERROR: no decoder context for chunk #%u\n", task_index);
+        return;
+    }
+    evtx_options_apply(ta->opts, ctx);
+    if (task_index < ta->chunk_count) {
+        decode_evtx_chunk(ctx, out, ta->file_base + chunk_base, (uint16_t)task_index, ta->output_mode);
+    } else {
+        evtx_chunk_recover(ctx, out, ta->file_base + chunk_base, (uint16_t)task_index, ta->output_mode);
+    }
+}
+
+
+// --index: open the sidecar index, or build it when it is missing or stale.
+// it is used only when there is something to filter, returns -1 to decode the whole file
+static int decode_evtx_indexed(uint8_t *file_base, size_t file_size, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    const EVTX_FILE_HEADER *fh = (const EVTX_FILE_HEADER *)file_base;
+    int stats = CHECK_OUTMODE(opts->output_mode, OUT_STATS);
+
+    EVTX_INDEX idx;
+    if (evtx_index_open(&idx, opts->index_path, fh, file_size) != 0) {
+        if (evtx_index_build(opts->index_path, file_base, file_size) != 0 ||
+            evtx_index_open(&idx, opts->index_path, fh, file_size) != 0) {
+            fprintf(stderr, "WARNING: no index, decoding the whole file\n");
+            return -1;
         }
+        if (stats) fprintf(stderr, "index: built %s\n", opts->index_path);
+    }
+
+    if (stats) {
+        fprintf(stderr, "index: %" PRIu32 " chunks, %" PRIu64 " records\n",
+                idx.header->chunk_entries, idx.header->record_entries);
+    }
+
+    int rtn_code = -1;
+    if (opts->evtid_filter || opts->since || opts->until || opts->record_last) {
+        rtn_code = evtx_index_decode(&idx, file_base, opts, out);
+    }
+    evtx_index_close(&idx);
+    return rtn_code;
+}
+
+
+// ------------------------------------------------------------
+// --record: find the chunks from their headers
+// ------------------------------------------------------------
+// every probe reads only the header (one page) of a chunk
+
+// record identifiers of chunk i, -1 if it has no valid header
+static int chunk_record_range(const uint8_t *file_base, uint32_t i, uint64_t *first, uint64_t *last)
+{
+    const EVTX_CHUNK_HEADER *ch = (const EVTX_CHUNK_HEADER *)
+            (file_base + EVTX_CHUNK_START_OFFSET + (size_t)i * EVTX_CHUNK_SIZE);
+
+    if (memcmp(ch->signature, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) != 0 ||
+        ch->first_record_identifier == 0 || ch->last_record_identifier < ch->first_record_identifier) {
+        return -1;
+    }
+    *first = ch->first_record_identifier;
+    *last  = ch->last_record_identifier;
+    return 0;
+}
+
+
+int evtx_find_record_chunks(const uint8_t *file_base, uint16_t chunk_count,
+                            uint64_t first, uint64_t last, uint16_t *start, uint16_t *count)
+{
+    uint64_t f, l, f_hi, l_hi;
+
+    *start = 0;
+    *count = 0;
+    if (chunk_count == 0) return 0;
+
+    // a full log wraps around: records go up from the oldest chunk to the
+    // end of the file, and on from chunk 0. find the oldest one first
+    uint32_t lo = 0, hi = chunk_count - 1;
+    if (chunk_record_range(file_base, lo, &f, &l) != 0 ||
+        chunk_record_range(file_base, hi, &f_hi, &l_hi) != 0) {
+        return -1;
+    }
+    if (f > f_hi) {
+        while (lo < hi) {
+            uint32_t mid = (lo + hi) / 2;
+            if (chunk_record_range(file_base, mid, &f, &l) != 0 ||
+                chunk_record_range(file_base, hi, &f_hi, &l_hi) != 0) {
+                return -1;
+            }
+            if (f > f_hi) lo = mid + 1;
+            else          hi = mid;
+        }
+    }
+    uint32_t oldest = lo;
+
+    // positions counted from the oldest chunk, in record order:
+    // the first chunk which ends at or after `first` ...
+    uint32_t a = 0, b = chunk_count;
+    while (a < b) {
+        uint32_t mid = (a + b) / 2;
+        if (chunk_record_range(file_base, (oldest + mid) % chunk_count, &f, &l) != 0) return -1;
+        if (l < first) a = mid + 1;
+        else           b = mid;
+    }
+
+    // ... up to the first chunk which starts after `last`
+    uint32_t e = a;
+    b = chunk_count;
+    while (e < b) {
+        uint32_t mid = (e + b) / 2;
+        if (chunk_record_range(file_base, (oldest + mid) % chunk_count, &f, &l) != 0) return -1;
+        if (f > last) b = mid;
+        else          e = mid + 1;
+    }
+
+    *start = (uint16_t)((oldest + a) % chunk_count);
+    *count = (uint16_t)(e - a);
+    return 0;
+}
+
+
+// decode only the chunks holding the records of --record, -1 to decode the whole file
+static int decode_evtx_record_range(uint8_t *file_base, uint16_t chunk_count, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    uint16_t start, count;
+    if (evtx_find_record_chunks(file_base, chunk_count, opts->record_first, opts->record_last, &start, &count) != 0) {
+        return -1;      // some chunk header is broken, every chunk header is checked instead
+    }
+
+    EVTX_CHUNK_CTX ctx;
+    evtx_chunk_ctx_init(&ctx);
+    evtx_options_apply(opts, &ctx);
+
+    for (uint32_t k = 0; k < count; k++) {
+        uint16_t i = (uint16_t)((start + k) % chunk_count);
+        decode_evtx_chunk(&ctx, out, file_base + EVTX_CHUNK_START_OFFSET + (size_t)i * EVTX_CHUNK_SIZE,
+                          i, opts->output_mode);
+    }
+    evtx_chunk_ctx_free(&ctx);
+
+    return 0;
+}
+
+
+// the whole file is mapped: every chunk is just a pointer into the mapping,
+// nothing is copied
+static int decode_evtx_mapped(uint8_t *file_base, size_t file_size, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    uint32_t output_mode = opts->output_mode;
+    EVTX_FILE_HEADER *fh = (EVTX_FILE_HEADER *)file_base;
+
+    int rtn_code = decode_evtx_file_header(out, fh, output_mode, opts->sax);
+    if (rtn_code != 0) {
+        return (rtn_code == 2) ? 0 : 1;
+    }
+    if (!opts->sax) output_header(out, output_mode);     // CSV header line etc.
+
+    // only decode chunks which are completely inside the file
+    uint16_t chunk_count = fh->chunk_count;
+    size_t chunks_in_file = (file_size - EVTX_CHUNK_START_OFFSET) / EVTX_CHUNK_SIZE;
+    if (chunks_in_file < chunk_count) {
+        fprintf(stderr, "ERROR: chunk #%zu is beyond the end of file\n", chunks_in_file);
+        chunk_count = (uint16_t)chunks_in_file;
+    }
+
+    // OUT_SLACK: the chunks after chunk_count are searched for records as well
+    uint16_t last_chunk = chunk_count;
+    if (CHECK_OUTMODE(output_mode, OUT_SLACK) && chunks_in_file > chunk_count) {
+        last_chunk = (chunks_in_file > UINT16_MAX) ? UINT16_MAX : (uint16_t)chunks_in_file;
+    }
+
+    // --record: a few chunks found by their headers, in record order even when
+    // the log wraps around, no index needed
+    if (opts->record_last && decode_evtx_record_range(file_base, chunk_count, opts, out) == 0) {
         return 0;
-    } else {
+    }
+
+    // with filters the index takes us straight to the wanted records
+    if (opts->index_path && decode_evtx_indexed(file_base, file_size, opts, out) == 0) {
+        return 0;
+    }
+
+    // SAX callbacks come from one thread, in file order
+    if (opts->jobs > 1 && !opts->sax) {
+        // every chunk carries its own string and template tables,
+        // so they can be decoded independently and written out in order
+        CHUNK_TASK_ARG ta = { file_base, output_mode, opts, chunk_count };
+        POOL_JOB job = { decode_chunk_task, &ta, chunk_worker_init, chunk_worker_free, NULL };
+
+        pool_run_ordered(opts->jobs, last_chunk, &job, out);
+        return 0;
+    }
+
+    EVTX_CHUNK_CTX ctx;
+    evtx_chunk_ctx_init(&ctx);
+    evtx_options_apply(opts, &ctx);
+    for (uint16_t i = 0; i < last_chunk; i++) {
+        size_t chunk_base = EVTX_CHUNK_START_OFFSET + (size_t)i * EVTX_CHUNK_SIZE;
+
+        // ask the kernel to start reading the next chunk while we decode this one
+        if (i + 1 < last_chunk) {
+            madvise(file_base + chunk_base + EVTX_CHUNK_SIZE, EVTX_CHUNK_SIZE, MADV_WILLNEED);
+        }
+
+        if (i < chunk_count) {
+            decode_evtx_chunk(&ctx, out, file_base + chunk_base, i, output_mode);
+        } else {
+            evtx_chunk_recover(&ctx, out, file_base + chunk_base, i, output_mode);
+        }
+    }
+    evtx_chunk_ctx_free(&ctx);
+
+    return 0;
+}
+
+
+// fallback for inputs which can not be mapped (pipes etc.)
+// one chunk buffer is reused for all chunks
+// (-j is not used here, chunks are read one after another anyway)
+static int decode_evtx_stream(FILE *fp, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    uint32_t output_mode = opts->output_mode;
+
+    // read file header
+    EVTX_FILE_HEADER fh;
+    if (fread(&fh, sizeof(fh), 1, fp) != 1) {
+        fprintf(stderr, "ERROR: can not read the EVTX file header\n");
+        return 1;
+    }
+
+    int rtn_code = decode_evtx_file_header(out, &fh, output_mode, opts->sax);
+    if (rtn_code != 0) {
+        return (rtn_code == 2) ? 0 : 1;
+    }
+    if (!opts->sax) output_header(out, output_mode);
+
+    uint8_t *chunk_buffer = malloc(EVTX_CHUNK_SIZE);
+    if (!chunk_buffer) {
+        perror("malloc(chunk_buffer)");
         return 1;
     }
+
+    EVTX_CHUNK_CTX ctx;
+    evtx_chunk_ctx_init(&ctx);
+    evtx_options_apply(opts, &ctx);
+
+    for (uint16_t i = 0; i < fh.chunk_count; i++) {
+        long chunk_base = EVTX_CHUNK_START_OFFSET + (long)i * EVTX_CHUNK_SIZE;
+
+        // chunks are stored back to back just after the header block,
+        // so on a pipe (where fseek fails) we are already at the right place
+        fseek(fp, chunk_base, SEEK_SET);
+        if (fread(chunk_buffer, 1, EVTX_CHUNK_SIZE, fp) != EVTX_CHUNK_SIZE) {
+            fprintf(stderr, "ERROR: chunk #%u is beyond the end of file\n", i);
+            break;
+        }
+
+        decode_evtx_chunk(&ctx, out, chunk_buffer, i, output_mode);
+    }
+
+    // OUT_SLACK: whatever follows chunk_count, up to the end of the input
+    for (uint32_t i = fh.chunk_count; CHECK_OUTMODE(output_mode, OUT_SLACK) && i <= UINT16_MAX; i++) {
+        if (fread(chunk_buffer, 1, EVTX_CHUNK_SIZE, fp) != EVTX_CHUNK_SIZE) {
+            break;
+        }
+        evtx_chunk_recover(&ctx, out, chunk_buffer, (uint16_t)i, output_mode);
+    }
+
+    evtx_chunk_ctx_free(&ctx);
+    free(chunk_buffer);
+
+    return 0;
+}
+
+
+int decode_evtx_file(FILE *fp, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    // map regular files as a whole, fall back to stdio for everything else
+    struct stat st;
+    if (fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && 
+            (size_t)st.st_size >= sizeof(EVTX_FILE_HEADER)) {
+
+        size_t file_size = (size_t)st.st_size;
+        uint8_t *file_base = mmap(NULL, file_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+        if (file_base != MAP_FAILED) {
+            // chunks are walked front to back, unless only a few records are wanted
+            madvise(file_base, file_size, opts->record_last ? MADV_RANDOM : MADV_SEQUENTIAL);
+
+            int rtn_code = decode_evtx_mapped(file_base, file_size, opts, out);
+
+            munmap(file_base, file_size);
+            return rtn_code;
+        }
+    }
+
+    return decode_evtx_stream(fp, opts, out);
 }
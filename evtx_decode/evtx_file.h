@@ -6,8 +6,11 @@
 #if !defined( EVTX_FILE_H )
 #define EVTX_FILE_H
 
+#include <stdio.h>
 #include <inttypes.h>
 
+#include "out_sink.h"
+
 
 
 #define EVTX_FILE_SIGNATURE "ElfFile"
@@ -30,6 +33,36 @@ typedef struct _EVTX_FILE_HEADER {
 } EVTX_FILE_HEADER;
 #pragma pack(pop)
 
-int decode_evtx_file(FILE *fp, uint32_t output_mode);
+// options for decoding a whole file, set from the command line
+typedef struct _EVTX_OPTIONS {
+    uint32_t output_mode;   // OUT_* flags, see evtx_output.h
+    int      jobs;          // threads decoding chunks in parallel (1 = serial)
+    const struct _EVTX_SAX *sax;    // callbacks instead of output (see evtx_sax.h), NULL to print
+    const struct _EVTX_EVTID_FILTER *evtid_filter;  // -e (see evtx_output.h), NULL for all records
+    uint64_t since;         // --since / --until: FILETIME of the record header, both
+    uint64_t until;         // inclusive, 0 = no limit
+    const char *index_path; // --index: sidecar index (see evtx_index.h), NULL for none
+    uint64_t record_first;  // --record N[:M]: record identifiers, both inclusive,
+    uint64_t record_last;   // record_last 0 = all records
+    int      verify;        // --verify: check the checksums instead of decoding (see evtx_verify.h)
+} EVTX_OPTIONS;
+
+struct _EVTX_CHUNK_CTX;
+
+// the chunks of a mapped file which hold records first..last, found by a binary search
+// of the chunk headers: chunks (start + k) % chunk_count for k < count, in record order
+// (a full log wraps around). -1 if a chunk header is broken
+int evtx_find_record_chunks(const uint8_t *file_base, uint16_t chunk_count,
+                            uint64_t first, uint64_t last, uint16_t *start, uint16_t *count);
+
+// check the signature of the file header and print it (DEFAULT summary, -d dump),
+// or hand it to sax. 0 to go on, 1 if it is not an EVTX file, 2 when sax stops here
+int decode_evtx_file_header(OUT_SINK *out, EVTX_FILE_HEADER *fh, int output_mode, const struct _EVTX_SAX *sax);
+
+// copy the filters of opts into a decoder context
+void evtx_options_apply(const EVTX_OPTIONS *opts, struct _EVTX_CHUNK_CTX *ctx);
+
+// decode the whole file, the output goes to out (or to opts->sax)
+int decode_evtx_file(FILE *fp, const EVTX_OPTIONS *opts, OUT_SINK *out);
 
 #endif /* !defined( EVTX_FILE_H ) */
@@ -0,0 +1,344 @@
+/* evtx_follow.c
+ *
+ * --follow, see evtx_follow.h
+ *
+ * Everything is read with pread(): the file is written by someone else
+ * while we read it, a mapping of it could change under the decoder.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "evtx_follow.h"
+#include "evtx_chunk.h"
+#include "evtx_record.h"
+#include "evtx_output.h"
+
+
+typedef struct _FOLLOW {
+    const char *path;
+    int       fd;
+    dev_t     dev;              // of the file open now, a new copy has another inode
+    ino_t     ino;
+    int       inotify_fd;       // -1: poll only
+    int       watch;            // the file
+    int       dir_watch;        // its directory: a new copy of the file
+
+    const EVTX_OPTIONS *opts;
+    OUT_SINK *out;
+    EVTX_CHUNK_CTX ctx;
+    uint8_t  *chunk;            // the current chunk, read again when it has new records
+
+    // the position
+    int       started;          // 0: look for the oldest chunk first
+    uint32_t  cur;              // current chunk
+    uint64_t  cur_first;        // its first record identifier, it changes when the chunk is reused
+    uint32_t  next_off;         // offset of the next record in the current chunk
+    uint64_t  last_id;          // last record decoded (or dropped by the filters)
+} FOLLOW;
+
+
+static volatile sig_atomic_t follow_stop;
+
+static void follow_on_signal(int sig)
+{
+    (void)sig;
+    follow_stop = 1;
+}
+
+
+
+// ------------------------------------------------------------
+// the file
+// ------------------------------------------------------------
+
+static void follow_add_watch(FOLLOW *f)
+{
+#ifdef __linux__
+    if (f->inotify_fd < 0) return;
+    if (f->watch >= 0) inotify_rm_watch(f->inotify_fd, f->watch);
+    f->watch = inotify_add_watch(f->inotify_fd, f->path, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+#else
+    (void)f;
+#endif
+}
+
+// (re)open the file, the position is kept: a new copy of the same log goes on where the old one ended
+static int follow_open(FOLLOW *f)
+{
+    int fd = open(f->path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (f->fd >= 0) close(f->fd);
+    f->fd  = fd;
+    f->dev = st.st_dev;
+    f->ino = st.st_ino;
+    follow_add_watch(f);
+    return 0;
+}
+
+static void follow_check_replaced(FOLLOW *f)
+{
+    struct stat st;
+    if (stat(f->path, &st) != 0) return;    // gone for the moment, keep the old one
+    if (st.st_dev != f->dev || st.st_ino != f->ino) follow_open(f);
+}
+
+static uint32_t follow_chunks_in_file(FOLLOW *f)
+{
+    struct stat st;
+    if (fstat(f->fd, &st) != 0 || st.st_size < EVTX_CHUNK_START_OFFSET) return 0;
+    return (uint32_t)(((uint64_t)st.st_size - EVTX_CHUNK_START_OFFSET) / EVTX_CHUNK_SIZE);
+}
+
+// the header of chunk i, -1 if it has no records (yet)
+static int follow_read_header(FOLLOW *f, uint32_t i, EVTX_CHUNK_HEADER *ch)
+{
+    off_t off = EVTX_CHUNK_START_OFFSET + (off_t)i * EVTX_CHUNK_SIZE;
+    if (pread(f->fd, ch, sizeof(*ch), off) != (ssize_t)sizeof(*ch)) return -1;
+
+    if (memcmp(ch->signature, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) != 0 ||
+        ch->first_record_identifier == 0 || ch->last_record_identifier < ch->first_record_identifier) {
+        return -1;
+    }
+    return 0;
+}
+
+// wait for a change of the file, at most EVTX_FOLLOW_INTERVAL_MS
+static void follow_wait(FOLLOW *f)
+{
+    if (f->inotify_fd >= 0) {
+        struct pollfd pfd = { f->inotify_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, EVTX_FOLLOW_INTERVAL_MS) > 0) {
+            char events[4096];
+            while (read(f->inotify_fd, events, sizeof(events)) > 0) {
+                // just drain them, what changed is read from the file
+            }
+        }
+        return;
+    }
+
+    struct timespec ts = { EVTX_FOLLOW_INTERVAL_MS / 1000, (EVTX_FOLLOW_INTERVAL_MS % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+
+
+// ------------------------------------------------------------
+// the records
+// ------------------------------------------------------------
+
+static void follow_report_lost(FOLLOW *f, uint64_t first)
+{
+    if (f->last_id && first > f->last_id + 1) {
+        fprintf(stderr, "WARNING: %s: records %" PRIu64 "-%" PRIu64 " were overwritten before they were read\n",
+                f->path, f->last_id + 1, first - 1);
+    }
+}
+
+// start at the oldest chunk with records after last_id (all of them at first),
+// in a full log it is anywhere in the file
+static int follow_start(FOLLOW *f)
+{
+    uint32_t n = follow_chunks_in_file(f);
+    uint64_t oldest_id = UINT64_MAX;
+    EVTX_CHUNK_HEADER ch;
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (follow_read_header(f, i, &ch) == 0 && ch.last_record_identifier > f->last_id &&
+                ch.first_record_identifier < oldest_id) {
+            oldest_id = ch.first_record_identifier;
+            f->cur    = i;
+        }
+    }
+    if (oldest_id == UINT64_MAX) return -1;     // no records yet
+
+    follow_report_lost(f, oldest_id);
+    f->started   = 1;
+    f->cur_first = oldest_id;
+    f->next_off  = sizeof(EVTX_CHUNK_HEADER);
+    return 0;
+}
+
+// decode the records of the current chunk from next_off on
+static void follow_drain(FOLLOW *f)
+{
+    off_t chunk_off = EVTX_CHUNK_START_OFFSET + (off_t)f->cur * EVTX_CHUNK_SIZE;
+    if (pread(f->fd, f->chunk, EVTX_CHUNK_SIZE, chunk_off) != EVTX_CHUNK_SIZE) return;
+
+    // the header read together with the records, the writer may have gone on since the last look
+    const EVTX_CHUNK_HEADER *ch = (const EVTX_CHUNK_HEADER *)f->chunk;
+    uint32_t end = ch->free_space_offset;
+    if (end > EVTX_CHUNK_SIZE) end = EVTX_CHUNK_SIZE;
+    if (end <= f->next_off) return;
+
+    // 2: the chunk is skipped by the filters, the position still moves on
+    int rtn_code = evtx_chunk_begin(&f->ctx, f->out, f->chunk, (uint16_t)f->cur, f->opts->output_mode);
+    if (rtn_code == 1) return;
+
+    uint32_t off = f->next_off;
+    while (off + sizeof(EVTX_RECORD_HEADER) + 4 <= end) {
+        const EVTX_RECORD_HEADER *rh = (const EVTX_RECORD_HEADER *)&f->chunk[off];
+        uint32_t size = rh->record_size;
+        uint32_t size_copy;
+
+        // a record which is not completely written yet is taken in the next poll
+        if (rh->signature != EVTX_RECORD_SIGNATURE || size <= sizeof(EVTX_RECORD_HEADER) + 4 || size > end - off) {
+            break;
+        }
+        memcpy(&size_copy, &f->chunk[off + size - 4], 4);
+        if (size_copy != size) break;
+
+        if (rh->record_identifier > f->last_id) {
+            if (rtn_code == 0) decode_evtx_record(&f->ctx, off);
+            f->last_id = rh->record_identifier;
+        }
+        off += ALIGN_8(size);
+    }
+    f->next_off = off;
+
+    if (rtn_code == 0) evtx_chunk_end(&f->ctx);
+}
+
+// decode what is new, chunk after chunk around the ring
+static void follow_poll(FOLLOW *f)
+{
+    if (!f->started && follow_start(f) != 0) return;
+
+    uint32_t ring = follow_chunks_in_file(f);
+    for (uint32_t steps = 0; steps <= ring && !follow_stop; steps++) {
+        EVTX_CHUNK_HEADER ch, next;
+
+        // the writer starts the next chunk only when the current one is full:
+        // look at the next one first, then the current one has its last records
+        uint32_t n = (f->cur + 1 < ring) ? f->cur + 1 : 0;
+        int have_next = (n != f->cur && follow_read_header(f, n, &next) == 0);
+
+        if (f->cur >= ring || follow_read_header(f, f->cur, &ch) != 0) {
+            if (f->cur < ring) return;          // being written, try again later
+            ch.first_record_identifier = 0;     // the file got shorter
+        }
+
+        if (ch.first_record_identifier != f->cur_first) {
+            if (ch.first_record_identifier <= f->last_id) {
+                // older records than ours: the log was cleared, or is a different one
+                fprintf(stderr, "WARNING: %s: the log was cleared, following it from its first record\n", f->path);
+                f->started = 0;
+                f->last_id = 0;
+                if (follow_start(f) != 0) return;
+                continue;
+            }
+            // we were a whole ring behind and the chunk was reused,
+            // go on with the oldest records which are still there
+            f->started = 0;
+            if (follow_start(f) != 0) return;
+            continue;
+        }
+
+        if (ch.last_record_identifier > f->last_id) follow_drain(f);
+
+        if (!have_next || next.first_record_identifier <= f->last_id) return;
+
+        follow_report_lost(f, next.first_record_identifier);
+        f->cur       = n;
+        f->cur_first = next.first_record_identifier;
+        f->next_off  = sizeof(EVTX_CHUNK_HEADER);
+    }
+}
+
+
+
+int evtx_follow(const char *path, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    FOLLOW f;
+    memset(&f, 0, sizeof(f));
+    f.path       = path;
+    f.fd         = -1;
+    f.inotify_fd = -1;
+    f.watch      = -1;
+    f.dir_watch  = -1;
+    f.opts       = opts;
+    f.out        = out;
+
+#ifdef __linux__
+    f.inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (f.inotify_fd >= 0) {
+        char dir[4096];
+        const char *slash = strrchr(path, '/');
+        snprintf(dir, sizeof(dir), "%.*s", slash ? (int)(slash - path) + 1 : 1, slash ? path : ".");
+        f.dir_watch = inotify_add_watch(f.inotify_fd, dir, IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+    }
+#endif
+    if (follow_open(&f) != 0) {
+        perror(path);
+        if (f.inotify_fd >= 0) close(f.inotify_fd);
+        return 1;
+    }
+
+    // the file header once, as for a whole file
+    EVTX_FILE_HEADER fh;
+    int rtn_code = 1;
+    if (pread(f.fd, &fh, sizeof(fh), 0) != (ssize_t)sizeof(fh)) {
+        fprintf(stderr, "ERROR: can not read the EVTX file header\n");
+    } else {
+        rtn_code = decode_evtx_file_header(out, &fh, opts->output_mode, opts->sax);
+    }
+    if (rtn_code != 0) {
+        close(f.fd);
+        if (f.inotify_fd >= 0) close(f.inotify_fd);
+        return (rtn_code == 2) ? 0 : 1;
+    }
+    if (!opts->sax) output_header(out, opts->output_mode);
+
+    f.chunk = malloc(EVTX_CHUNK_SIZE);
+    if (!f.chunk) {
+        perror("malloc(chunk_buffer)");
+        close(f.fd);
+        if (f.inotify_fd >= 0) close(f.inotify_fd);
+        return 1;
+    }
+    evtx_chunk_ctx_init(&f.ctx);
+    evtx_options_apply(opts, &f.ctx);
+
+    // Ctrl-C ends the loop, the output written so far is complete
+    struct sigaction sa, old_int, old_term;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = follow_on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, &old_int);
+    sigaction(SIGTERM, &sa, &old_term);
+
+    while (!follow_stop) {
+        follow_check_replaced(&f);
+        follow_poll(&f);
+        out_sink_flush(out);
+        if (out->error) break;      // the reader went away
+        if (!follow_stop) follow_wait(&f);
+    }
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGTERM, &old_term, NULL);
+
+    evtx_chunk_ctx_free(&f.ctx);
+    free(f.chunk);
+    close(f.fd);
+    if (f.inotify_fd >= 0) close(f.inotify_fd);
+    return out->error ? 1 : 0;
+}
@@ -0,0 +1,33 @@
+/* evtx_follow.h
+ *
+ * --follow: decode a live EVTX file which is still being written, like tail -f.
+ *
+ * The records already in the file are decoded first, oldest chunk first,
+ * then the file is watched (inotify, with a poll every second anyway) and
+ * only the new records are decoded. The position is kept as
+ *
+ *     chunk index, offset of the next record in it, last record identifier
+ *
+ * so every poll reads the header of the current chunk and of the one after
+ * it, and the current chunk again only when it got new records. Finished
+ * chunks are never read again.
+ *
+ * A full log (flags 0x02) overwrites its oldest chunk: the chunk after the
+ * current one in the ring (the file wraps to chunk 0) is taken when its
+ * records are newer than the last one decoded. When the file is replaced
+ * (the collection agent copies it again) it is opened again, when the log
+ * was cleared it is followed from its first record.
+ */
+
+#if !defined( EVTX_FOLLOW_H )
+#define EVTX_FOLLOW_H
+
+#include "evtx_file.h"
+
+
+#define EVTX_FOLLOW_INTERVAL_MS     1000
+
+// follow path until SIGINT / SIGTERM, the records go to out (flushed after every poll)
+int evtx_follow(const char *path, const EVTX_OPTIONS *opts, OUT_SINK *out);
+
+#endif /* !defined( EVTX_FOLLOW_H ) */
@@ -0,0 +1,453 @@
+/* evtx_index.c
+ *
+ * sidecar index, see evtx_index.h
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "evtx_index.h"
+#include "evtx_chunk.h"
+#include "evtx_record.h"
+#include "evtx_binxml.h"
+#include "evtx_output.h"
+
+
+
+// ------------------------------------------------------------
+// build
+// ------------------------------------------------------------
+
+typedef struct _INDEX_BUILDER {
+    EVTX_INDEX_CHUNK  *chunks;
+    EVTX_INDEX_RECORD *records;
+    uint32_t *templates;
+    uint16_t *evtids;
+    size_t    record_count,   record_cap;
+    size_t    template_count, template_cap;
+    size_t    evtid_count,    evtid_cap;
+
+    EVTX_EVTID_FILTER evtid_seen;       // EventIDs of the current chunk
+} INDEX_BUILDER;
+
+
+// make room for one more element of an array growing by doubling
+static int grow(void **array, size_t *cap, size_t count, size_t elem_size)
+{
+    if (count < *cap) return 0;
+
+    size_t new_cap = *cap ? *cap * 2 : 1024;
+    void *p = realloc(*array, new_cap * elem_size);
+    if (!p) {
+        perror("realloc(index)");
+        return -1;
+    }
+    *array = p;
+    *cap = new_cap;
+    return 0;
+}
+
+static int cmp_u16(const void *a, const void *b)
+{
+    return (int)*(const uint16_t *)a - (int)*(const uint16_t *)b;
+}
+
+
+// one record: header fields, EventID and template ID
+static int index_record(INDEX_BUILDER *b, EVTX_CHUNK_CTX *ctx, EVTX_INDEX_CHUNK *c,
+                        const EVTX_RECORD_HEADER *rh, uint32_t record_base)
+{
+    // the same value table the decoder builds, nothing is rendered
+    arena_reset(&ctx->scratch);
+
+    BINXML_INSTANCE inst;
+    uint32_t binxml_offset = record_base + sizeof(EVTX_RECORD_HEADER);
+    uint32_t binxml_size = rh->record_size - sizeof(EVTX_RECORD_HEADER) - sizeof(uint32_t);
+    int found = (binxml_read_instance(ctx, binxml_offset, binxml_size, &inst) == 0);
+    int32_t evtid = found ? binxml_event_id(ctx, &inst) : -1;
+
+    if (grow((void **)&b->records, &b->record_cap, b->record_count, sizeof(EVTX_INDEX_RECORD)) != 0) {
+        return -1;
+    }
+    EVTX_INDEX_RECORD *r = &b->records[b->record_count++];
+    r->file_offset       = c->file_offset + record_base;
+    r->record_identifier = rh->record_identifier;
+    r->timestamp         = rh->timestamp;
+    r->event_id          = evtid;
+    r->reserved          = 0;
+
+    if (c->record_count == 0 || rh->timestamp < c->min_time) c->min_time = rh->timestamp;
+    if (c->record_count == 0 || rh->timestamp > c->max_time) c->max_time = rh->timestamp;
+    c->record_count++;
+
+    // distinct EventIDs, sorted when the chunk is done
+    if (evtid >= 0 && !EVTID_FILTER_MATCH(&b->evtid_seen, evtid)) {
+        b->evtid_seen.bits[evtid >> 3] |= (uint8_t)(1 << (evtid & 7));
+        if (grow((void **)&b->evtids, &b->evtid_cap, b->evtid_count, sizeof(uint16_t)) != 0) {
+            return -1;
+        }
+        b->evtids[b->evtid_count++] = (uint16_t)evtid;
+        c->evtid_count++;
+    }
+
+    // distinct template IDs, a chunk has only a handful of them
+    if (found && inst.template_offset + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER) <= EVTX_CHUNK_SIZE) {
+        EVTX_TEMPLATE_DEFINITION_HEADER th;
+        memcpy(&th, &ctx->chunk_buffer[inst.template_offset], sizeof(th));
+
+        for (uint32_t n = 0; n < c->template_count; n++) {
+            if (b->templates[c->first_template + n] == th.template_id) return 0;
+        }
+        if (grow((void **)&b->templates, &b->template_cap, b->template_count, sizeof(uint32_t)) != 0) {
+            return -1;
+        }
+        b->templates[b->template_count++] = th.template_id;
+        c->template_count++;
+    }
+
+    return 0;
+}
+
+
+// all the records of one chunk, walked as decode_evtx_chunk() does
+static int index_chunk(INDEX_BUILDER *b, EVTX_CHUNK_CTX *ctx, uint8_t *chunk_buffer, uint16_t chunk_index)
+{
+    EVTX_INDEX_CHUNK *c = &b->chunks[chunk_index];
+    EVTX_CHUNK_HEADER *ch = (EVTX_CHUNK_HEADER *)chunk_buffer;
+
+    memset(c, 0, sizeof(*c));
+    c->file_offset    = EVTX_CHUNK_START_OFFSET + (uint64_t)chunk_index * EVTX_CHUNK_SIZE;
+    c->first_record   = (uint32_t)b->record_count;
+    c->first_template = (uint32_t)b->template_count;
+    c->first_evtid    = (uint32_t)b->evtid_count;
+
+    // a broken chunk stays in the index without records, the decoder will complain about it
+    if (memcmp(ch->signature, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) != 0) {
+        return 0;
+    }
+    c->first_record_identifier = ch->first_record_identifier;
+    c->last_record_identifier  = ch->last_record_identifier;
+
+    if (evtx_chunk_begin(ctx, &ctx->value_out, chunk_buffer, chunk_index, 0) != 0) {
+        return 0;
+    }
+
+    int rtn_code = 0;
+    if (ch->first_record_identifier > 0) {
+        uint64_t record_count = ch->last_record_identifier - ch->first_record_identifier + 1;
+        uint32_t record_base = sizeof(EVTX_CHUNK_HEADER);
+
+        for (uint64_t i = 0; i < record_count; i++) {
+            if (record_base + sizeof(EVTX_RECORD_HEADER) > EVTX_CHUNK_SIZE) break;
+
+            EVTX_RECORD_HEADER *rh = (EVTX_RECORD_HEADER *)&chunk_buffer[record_base];
+            if (rh->signature != EVTX_RECORD_SIGNATURE) break;
+
+            // a record too small to hold BinXML is skipped by the decoder too
+            if (rh->record_size > sizeof(EVTX_RECORD_HEADER) + 4 &&
+                    (rtn_code = index_record(b, ctx, c, rh, record_base)) != 0) {
+                break;
+            }
+
+            record_base += ALIGN_8(rh->record_size);
+            if (record_base > ch->free_space_offset) break;
+        }
+    }
+    evtx_chunk_end(ctx);
+
+    // sort the EventIDs of the chunk and forget them for the next one
+    uint16_t *ids = &b->evtids[c->first_evtid];
+    if (c->evtid_count) qsort(ids, c->evtid_count, sizeof(uint16_t), cmp_u16);
+    for (uint32_t n = 0; n < c->evtid_count; n++) {
+        b->evtid_seen.bits[ids[n] >> 3] = 0;
+    }
+
+    return rtn_code;
+}
+
+
+static int write_index(const char *path, const INDEX_BUILDER *b, const EVTX_FILE_HEADER *fh, uint32_t chunk_entries)
+{
+    EVTX_INDEX_HEADER h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.signature, EVTX_INDEX_SIGNATURE, sizeof(EVTX_INDEX_SIGNATURE));
+    h.version          = EVTX_INDEX_VERSION;
+    h.header_size      = sizeof(h);
+    h.next_record_id   = fh->next_record_id;
+    h.checksum         = fh->checksum;
+    h.chunk_count      = fh->chunk_count;
+    h.chunk_entries    = chunk_entries;
+    h.template_count   = (uint32_t)b->template_count;
+    h.record_entries   = b->record_count;
+    h.evtid_count      = b->evtid_count;
+    h.chunks_offset    = sizeof(h);
+    h.records_offset   = h.chunks_offset + (uint64_t)chunk_entries * sizeof(EVTX_INDEX_CHUNK);
+    h.templates_offset = h.records_offset + b->record_count * sizeof(EVTX_INDEX_RECORD);
+    h.evtids_offset    = h.templates_offset + b->template_count * sizeof(uint32_t);
+
+    // written next to the final name and renamed, a reader never sees half an index
+    size_t tmp_len = strlen(path) + 5;
+    char *tmp = malloc(tmp_len);
+    if (!tmp) {
+        perror("malloc(index path)");
+        return -1;
+    }
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "wb");
+    if (!fp) {
+        perror(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    int ok = fwrite(&h, sizeof(h), 1, fp) == 1
+          && fwrite(b->chunks, sizeof(EVTX_INDEX_CHUNK), chunk_entries, fp) == chunk_entries
+          && fwrite(b->records, sizeof(EVTX_INDEX_RECORD), b->record_count, fp) == b->record_count
+          && fwrite(b->templates, sizeof(uint32_t), b->template_count, fp) == b->template_count
+          && fwrite(b->evtids, sizeof(uint16_t), b->evtid_count, fp) == b->evtid_count;
+    ok = (fclose(fp) == 0) && ok;
+
+    if (!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "ERROR: can not write the index %s\n", path);
+        remove(tmp);
+        free(tmp);
+        return -1;
+    }
+    free(tmp);
+    return 0;
+}
+
+
+int evtx_index_build(const char *path, uint8_t *file_base, size_t file_size)
+{
+    const EVTX_FILE_HEADER *fh = (const EVTX_FILE_HEADER *)file_base;
+
+    // only chunks which are completely inside the file, as decode_evtx_mapped()
+    size_t chunks_in_file = (file_size - EVTX_CHUNK_START_OFFSET) / EVTX_CHUNK_SIZE;
+    uint32_t chunk_entries = (chunks_in_file < fh->chunk_count) ? (uint32_t)chunks_in_file : fh->chunk_count;
+
+    INDEX_BUILDER *b = calloc(1, sizeof(INDEX_BUILDER));
+    if (!b) {
+        perror("calloc(index)");
+        return -1;
+    }
+    b->chunks = calloc(chunk_entries ? chunk_entries : 1, sizeof(EVTX_INDEX_CHUNK));
+
+    // nothing is printed: a SAX consumer without callbacks
+    static const EVTX_SAX quiet;
+    EVTX_CHUNK_CTX *ctx = malloc(sizeof(EVTX_CHUNK_CTX));
+    if (ctx) {
+        evtx_chunk_ctx_init(ctx);
+        ctx->sax = &quiet;
+    }
+
+    int rtn_code = (b->chunks && ctx) ? 0 : -1;
+    for (uint32_t i = 0; i < chunk_entries && rtn_code == 0; i++) {
+        uint8_t *chunk_buffer = file_base + EVTX_CHUNK_START_OFFSET + (size_t)i * EVTX_CHUNK_SIZE;
+        rtn_code = index_chunk(b, ctx, chunk_buffer, (uint16_t)i);
+    }
+
+    if (rtn_code == 0) {
+        rtn_code = write_index(path, b, fh, chunk_entries);
+    }
+
+    if (ctx) {
+        evtx_chunk_ctx_free(ctx);
+        free(ctx);
+    }
+    free(b->chunks);
+    free(b->records);
+    free(b->templates);
+    free(b->evtids);
+    free(b);
+    return rtn_code;
+}
+
+
+
+// ------------------------------------------------------------
+// open
+// ------------------------------------------------------------
+
+// count elements of elem_size at offset are inside the index
+static int section_ok(const EVTX_INDEX *idx, uint64_t offset, uint64_t count, size_t elem_size)
+{
+    return offset <= idx->size && count <= (idx->size - offset) / elem_size;
+}
+
+
+// everything the decoder will follow must be inside the index and the EVTX file
+static int index_is_valid(const EVTX_INDEX *idx, const EVTX_FILE_HEADER *fh, size_t file_size)
+{
+    const EVTX_INDEX_HEADER *h = idx->header;
+
+    if (memcmp(h->signature, EVTX_INDEX_SIGNATURE, sizeof(EVTX_INDEX_SIGNATURE)) != 0 ||
+        h->version != EVTX_INDEX_VERSION || h->header_size != sizeof(EVTX_INDEX_HEADER)) {
+        return 0;
+    }
+
+    // stale: the log changed since the index was built
+    if (h->next_record_id != fh->next_record_id || h->chunk_count != fh->chunk_count ||
+        h->checksum != fh->checksum) {
+        return 0;
+    }
+
+    size_t chunks_in_file = (file_size - EVTX_CHUNK_START_OFFSET) / EVTX_CHUNK_SIZE;
+    uint32_t chunk_entries = (chunks_in_file < fh->chunk_count) ? (uint32_t)chunks_in_file : fh->chunk_count;
+    if (h->chunk_entries != chunk_entries) {
+        return 0;
+    }
+
+    if (!section_ok(idx, h->chunks_offset,    h->chunk_entries,  sizeof(EVTX_INDEX_CHUNK))  ||
+        !section_ok(idx, h->records_offset,   h->record_entries, sizeof(EVTX_INDEX_RECORD)) ||
+        !section_ok(idx, h->templates_offset, h->template_count, sizeof(uint32_t))          ||
+        !section_ok(idx, h->evtids_offset,    h->evtid_count,    sizeof(uint16_t))) {
+        return 0;
+    }
+
+    const EVTX_INDEX_CHUNK *chunks = (const EVTX_INDEX_CHUNK *)(idx->base + h->chunks_offset);
+    const EVTX_INDEX_RECORD *records = (const EVTX_INDEX_RECORD *)(idx->base + h->records_offset);
+
+    for (uint32_t i = 0; i < h->chunk_entries; i++) {
+        const EVTX_INDEX_CHUNK *c = &chunks[i];
+        if (c->file_offset != EVTX_CHUNK_START_OFFSET + (uint64_t)i * EVTX_CHUNK_SIZE ||
+            (uint64_t)c->first_record + c->record_count > h->record_entries ||
+            (uint64_t)c->first_template + c->template_count > h->template_count ||
+            (uint64_t)c->first_evtid + c->evtid_count > h->evtid_count) {
+            return 0;
+        }
+        for (uint32_t n = 0; n < c->record_count; n++) {
+            uint64_t off = records[c->first_record + n].file_offset;
+            if (off < c->file_offset + sizeof(EVTX_CHUNK_HEADER) ||
+                off + sizeof(EVTX_RECORD_HEADER) > c->file_offset + EVTX_CHUNK_SIZE) {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+int evtx_index_open(EVTX_INDEX *idx, const char *path, const EVTX_FILE_HEADER *fh, size_t file_size)
+{
+    memset(idx, 0, sizeof(*idx));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;      // not built yet
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (size_t)st.st_size < sizeof(EVTX_INDEX_HEADER)) {
+        close(fd);
+        return -1;
+    }
+
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        return -1;
+    }
+
+    idx->base   = base;
+    idx->size   = (size_t)st.st_size;
+    idx->header = (const EVTX_INDEX_HEADER *)idx->base;
+
+    if (!index_is_valid(idx, fh, file_size)) {
+        evtx_index_close(idx);
+        return -1;
+    }
+
+    idx->chunks    = (const EVTX_INDEX_CHUNK *)(idx->base + idx->header->chunks_offset);
+    idx->records   = (const EVTX_INDEX_RECORD *)(idx->base + idx->header->records_offset);
+    idx->templates = (const uint32_t *)(idx->base + idx->header->templates_offset);
+    idx->evtids    = (const uint16_t *)(idx->base + idx->header->evtids_offset);
+    return 0;
+}
+
+
+void evtx_index_close(EVTX_INDEX *idx)
+{
+    if (idx->base) {
+        munmap(idx->base, idx->size);
+    }
+    memset(idx, 0, sizeof(*idx));
+}
+
+
+
+// ------------------------------------------------------------
+// query
+// ------------------------------------------------------------
+
+// can the chunk have anything the filters of opts want
+static int chunk_selected(const EVTX_INDEX *idx, const EVTX_INDEX_CHUNK *c, const EVTX_OPTIONS *opts)
+{
+    if (c->record_count == 0) return 0;
+    if (opts->since && c->max_time < opts->since) return 0;
+    if (opts->until && c->min_time > opts->until) return 0;
+    if (opts->record_last && (c->last_record_identifier < opts->record_first ||
+                              c->first_record_identifier > opts->record_last)) return 0;
+
+    if (opts->evtid_filter) {
+        for (uint32_t n = 0; n < c->evtid_count; n++) {
+            if (EVTID_FILTER_MATCH(opts->evtid_filter, idx->evtids[c->first_evtid + n])) return 1;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+static int record_selected(const EVTX_INDEX_RECORD *r, const EVTX_OPTIONS *opts)
+{
+    if (opts->since && r->timestamp < opts->since) return 0;
+    if (opts->until && r->timestamp > opts->until) return 0;
+    if (opts->record_last && (r->record_identifier < opts->record_first ||
+                              r->record_identifier > opts->record_last)) return 0;
+    if (opts->evtid_filter && (r->event_id < 0 || !EVTID_FILTER_MATCH(opts->evtid_filter, r->event_id))) return 0;
+    return 1;
+}
+
+
+int evtx_index_decode(const EVTX_INDEX *idx, uint8_t *file_base, const EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    EVTX_CHUNK_CTX *ctx = malloc(sizeof(EVTX_CHUNK_CTX));
+    if (!ctx) {
+        perror("malloc(ctx)");
+        return 1;
+    }
+    evtx_chunk_ctx_init(ctx);
+    evtx_options_apply(opts, ctx);
+
+    for (uint32_t i = 0; i < idx->header->chunk_entries; i++) {
+        const EVTX_INDEX_CHUNK *c = &idx->chunks[i];
+        if (!chunk_selected(idx, c, opts)) continue;
+
+        uint8_t *chunk_buffer = file_base + c->file_offset;
+        if (evtx_chunk_begin(ctx, out, chunk_buffer, (uint16_t)i, opts->output_mode) != 0) continue;
+
+        // decode_evtx_record() checks the filters again, the index only saves the walk
+        for (uint32_t n = 0; n < c->record_count; n++) {
+            const EVTX_INDEX_RECORD *r = &idx->records[c->first_record + n];
+            if (!record_selected(r, opts)) continue;
+            if (decode_evtx_record(ctx, (uint32_t)(r->file_offset - c->file_offset)) != 0) break;
+        }
+        evtx_chunk_end(ctx);
+    }
+
+    evtx_chunk_ctx_free(ctx);
+    free(ctx);
+    return 0;
+}
@@ -0,0 +1,102 @@
+/* evtx_index.h
+ *
+ * Sidecar index of an EVTX file (<file>.evtx.idx).
+ *
+ * Built once by a walk over all the records which only reads the record
+ * headers and the value tables (nothing is rendered). Later runs map it and
+ * go straight to the chunks and records a query needs.
+ *
+ *   EVTX_INDEX_HEADER
+ *   EVTX_INDEX_CHUNK  [chunk_entries]
+ *   EVTX_INDEX_RECORD [record_entries]     grouped by chunk, in file order
+ *   uint32_t          [template_count]     template IDs of each chunk
+ *   uint16_t          [evtid_count]        EventIDs of each chunk, sorted
+ *
+ * The header keeps next_record_id, chunk_count and checksum of the EVTX file
+ * header it was built from. When any of them changes (the log was written
+ * to, cleared or replaced) the index is stale and built again.
+ */
+
+#if !defined( EVTX_INDEX_H )
+#define EVTX_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "evtx_file.h"
+
+
+#define EVTX_INDEX_SIGNATURE    "EvtxIdx"
+#define EVTX_INDEX_VERSION      1
+#define EVTX_INDEX_SUFFIX       ".idx"
+
+#pragma pack(push, 1)
+typedef struct _EVTX_INDEX_HEADER {
+    uint8_t  signature[8];          // "EvtxIdx\x00"
+    uint32_t version;
+    uint32_t header_size;
+
+    // the EVTX file header it was built from
+    uint64_t next_record_id;
+    uint32_t checksum;
+    uint16_t chunk_count;
+    uint16_t reserved;
+
+    // sections, offsets from the start of the index
+    uint32_t chunk_entries;         // chunks inside the file, at most chunk_count
+    uint32_t template_count;
+    uint64_t record_entries;
+    uint64_t evtid_count;
+    uint64_t chunks_offset;
+    uint64_t records_offset;
+    uint64_t templates_offset;
+    uint64_t evtids_offset;
+} EVTX_INDEX_HEADER;
+
+typedef struct _EVTX_INDEX_CHUNK {
+    uint64_t file_offset;
+    uint64_t first_record_identifier;   // from the chunk header
+    uint64_t last_record_identifier;
+    uint64_t min_time;                  // record header timestamps, 0 without records
+    uint64_t max_time;
+    uint32_t first_record;              // records of this chunk in the record section
+    uint32_t record_count;
+    uint32_t first_template;            // distinct template IDs
+    uint32_t template_count;
+    uint32_t first_evtid;               // distinct EventIDs
+    uint32_t evtid_count;
+} EVTX_INDEX_CHUNK;
+
+typedef struct _EVTX_INDEX_RECORD {
+    uint64_t file_offset;
+    uint64_t record_identifier;
+    uint64_t timestamp;                 // of the record header
+    int32_t  event_id;                  // -1: not found
+    uint32_t reserved;
+} EVTX_INDEX_RECORD;
+#pragma pack(pop)
+
+
+// a mapped index
+typedef struct _EVTX_INDEX {
+    uint8_t *base;
+    size_t   size;
+    const EVTX_INDEX_HEADER *header;
+    const EVTX_INDEX_CHUNK  *chunks;
+    const EVTX_INDEX_RECORD *records;
+    const uint32_t *templates;
+    const uint16_t *evtids;
+} EVTX_INDEX;
+
+
+// walk the mapped EVTX file and write its index to path, 0 on success
+int  evtx_index_build(const char *path, uint8_t *file_base, size_t file_size);
+
+// map the index at path, -1 if it is missing, broken or stale for fh
+int  evtx_index_open(EVTX_INDEX *idx, const char *path, const EVTX_FILE_HEADER *fh, size_t file_size);
+void evtx_index_close(EVTX_INDEX *idx);
+
+// decode only the chunks and records selected by the filters of opts
+int  evtx_index_decode(const EVTX_INDEX *idx, uint8_t *file_base, const EVTX_OPTIONS *opts, OUT_SINK *out);
+
+#endif /* !defined( EVTX_INDEX_H ) */
@@ -1,35 +1,455 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "evtx_output.h"
 #include "evtx_xmltree.h"
+#include "evtx_binxml.h"
 
 
-void output_xmltree(XML_TREE *xtree, uint32_t output_mode) 
+// ------------------------------------------------------------
+// CSV
+// ------------------------------------------------------------
+// one line per record: the usual fields of <System>, then everything
+// below <EventData> / <UserData> as Name=value pairs in one column
+
+typedef struct {
+    const char *title;
+    const char *element;    // child of <System>
+    const char *attr;       // NULL: the text of the element
+} CSV_COLUMN;
+
+static const CSV_COLUMN csv_columns[] = {
+    { "EventRecordID", "EventRecordID", NULL },
+    { "TimeCreated",   "TimeCreated",   "SystemTime" },
+    { "Provider",      "Provider",      "Name" },
+    { "EventID",       "EventID",       NULL },
+    { "Level",         "Level",         NULL },
+    { "Task",          "Task",          NULL },
+    { "Opcode",        "Opcode",        NULL },
+    { "Keywords",      "Keywords",      NULL },
+    { "ProcessID",     "Execution",     "ProcessID" },
+    { "ThreadID",      "Execution",     "ThreadID" },
+    { "Channel",       "Channel",       NULL },
+    { "Computer",      "Computer",      NULL },
+    { "UserID",        "Security",      "UserID" },
+};
+
+#define CSV_COLUMN_COUNT   (sizeof(csv_columns) / sizeof(csv_columns[0]))
+
+
+static const char *get_attr_value(const XML_ELEMENT *e, const char *name)
+{
+    for (uint16_t i = 0; i < e->attr_count; i++) {
+        if (strcmp(e->attrs[i].name, name) == 0) return e->attrs[i].value;
+    }
+    return NULL;
+}
+
+
+// text inside a quoted field, a quote is doubled
+static void csv_quoted(OUT_SINK *out, const char *s)
+{
+    const char *run = s;
+    for (const char *p = s; *p; p++) {
+        if (*p == '"') {
+            out_write(out, run, (size_t)(p - run + 1));
+            run = p;
+        }
+    }
+    out_puts(out, run);
+}
+
+// RFC 4180: quote the field only when needed
+static void csv_field(OUT_SINK *out, const char *s)
+{
+    if (!s) return;
+    if (!strpbrk(s, ",\"\r\n")) {
+        out_puts(out, s);
+        return;
+    }
+
+    out_putc(out, '"');
+    csv_quoted(out, s);
+    out_putc(out, '"');
+}
+
+
+// Name=value pairs of the leaves below e, separated by "; "
+static void csv_data_pairs(OUT_SINK *out, const XML_ELEMENT *e, int *count)
+{
+    for (const XML_ELEMENT *c = e->first_child; c; c = c->next_sibling) {
+        if (c->first_child) {
+            csv_data_pairs(out, c, count);
+            continue;
+        }
+        if (!c->text) continue;
+
+        const char *key = get_attr_value(c, "Name");
+        if (*count) out_puts(out, "; ");
+        csv_quoted(out, key ? key : c->name);
+        out_putc(out, '=');
+        csv_quoted(out, c->text);
+        (*count)++;
+    }
+}
+
+
+static void output_csv(OUT_SINK *out, XML_TREE *xtree, uint32_t output_mode, const char *source)
+{
+    XML_ELEMENT *root = xtree->root;
+    XML_ELEMENT *system = xml_find_child(root, "System");
+
+    if (source) {
+        csv_field(out, source);
+        out_putc(out, ',');
+    }
+
+    for (size_t n = 0; n < CSV_COLUMN_COUNT; n++) {
+        const XML_ELEMENT *e = system ? xml_find_child(system, csv_columns[n].element) : NULL;
+        if (e) {
+            csv_field(out, csv_columns[n].attr ? get_attr_value(e, csv_columns[n].attr) : e->text);
+        }
+        out_putc(out, ',');
+    }
+
+    // the Data column is always quoted, it is written while walking the tree
+    int count = 0;
+    out_putc(out, '"');
+    for (XML_ELEMENT *c = root->first_child; c; c = c->next_sibling) {
+        if (c != system) csv_data_pairs(out, c, &count);
+    }
+    out_putc(out, '"');
+
+    // always there (0 with --no-slack too), one schema whatever the options
+    out_puts(out, CHECK_OUTMODE(output_mode, OUT_RECOVERED) ? ",1\n" : ",0\n");
+}
+
+
+// ------------------------------------------------------------
+// SCHEMA
+// ------------------------------------------------------------
+// the structure of a record: one line per element and attribute with its
+// value type, e.g.
+//     Event/System/EventID            Uint16Type
+//     Event/System/Provider@Name      Utf16le
+
+static void output_schema_element(OUT_SINK *out, const XML_ELEMENT *e, char *path, size_t len, size_t size)
+{
+    size_t name_len = strlen(e->name);
+    if (len + name_len + 2 >= size) return;     // too deep, should never happen
+
+    if (len) path[len++] = '/';
+    memcpy(&path[len], e->name, name_len + 1);
+    len += name_len;
+
+    out_write(out, path, len);
+    if (e->text) {
+        out_putc(out, '\t');
+        out_puts(out, get_value_type_name(e->text_type));
+    }
+    out_putc(out, '\n');
+
+    for (uint16_t i = 0; i < e->attr_count; i++) {
+        out_write(out, path, len);
+        out_putc(out, '@');
+        out_puts(out, e->attrs[i].name);
+        out_putc(out, '\t');
+        out_puts(out, get_value_type_name(e->attrs[i].value_type));
+        out_putc(out, '\n');
+    }
+
+    for (const XML_ELEMENT *c = e->first_child; c; c = c->next_sibling) {
+        output_schema_element(out, c, path, len, size);
+    }
+}
+
+
+static void output_schema(OUT_SINK *out, XML_TREE *xtree)
+{
+    char path[1024];
+    for (const XML_ELEMENT *e = xtree->root; e; e = e->next_sibling) {
+        output_schema_element(out, e, path, 0, sizeof(path));
+    }
+    out_putc(out, '\n');
+}
+
+
+
+// ------------------------------------------------------------
+// JSON Lines
+// ------------------------------------------------------------
+// one object per line, the content of <Event>:
+//   - attributes are members, NULL attributes are left out as in XML
+//   - a leaf without attributes is "name":value
+//   - a leaf with only a Name attribute, <Data Name="x">v</Data>, is "x":v
+//   - any other element is an object, its own text is "#text"
+//   - siblings with the same key are written as one array
+// integers and booleans are written as JSON values, everything else
+// (FILETIME, GUID, SID, binary as hex ...) as the string XML shows
+
+// the character after the backslash, 'u' for \u00XX, 0 for none
+static const char json_escapes[256] = {
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+    'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+    ['"'] = '"', ['\\'] = '\\',
+};
+
+static void json_string(OUT_SINK *out, const char *s)
+{
+    const char *run = s;
+
+    out_putc(out, '"');
+    for (const char *p = s; *p; p++) {
+        char esc = json_escapes[(unsigned char)*p];
+        if (!esc) continue;
+
+        out_write(out, run, (size_t)(p - run));
+        out_putc(out, '\\');
+        out_putc(out, esc);
+        if (esc == 'u') {
+            out_puts(out, "00");
+            out_hex(out, (unsigned char)*p, 2);
+        }
+        run = p + 1;
+    }
+    out_puts(out, run);
+    out_putc(out, '"');
+}
+
+// an integer as JSON allows it: no leading zeros, no '+'
+static int json_is_integer(const char *s)
+{
+    if (*s == '-') s++;
+    if (*s < '0' || *s > '9' || (*s == '0' && s[1])) return 0;
+    while (*s >= '0' && *s <= '9') s++;
+    return *s == '\0';
+}
+
+// text is the value as print_value() formatted it
+static void json_value(OUT_SINK *out, const char *text, uint8_t type)
+{
+    if (!text) {
+        out_puts(out, "null");
+        return;
+    }
+
+    switch (type) {
+        case 0x03: case 0x04: case 0x05: case 0x06:     // Int8 .. Uint16
+        case 0x07: case 0x08: case 0x09: case 0x0A:     // Int32 .. Uint64
+            if (json_is_integer(text)) {
+                out_puts(out, text);
+                return;
+            }
+            break;
+
+        case 0x0D:                                      // BoolType
+            if (!strcmp(text, "true") || !strcmp(text, "false")) {
+                out_puts(out, text);
+                return;
+            }
+            break;
+    }
+    json_string(out, text);
+}
+
+
+static int json_attr_count(const XML_ELEMENT *e)
+{
+    int n = 0;
+    for (uint16_t i = 0; i < e->attr_count; i++) {
+        if (e->attrs[i].value_type != BINXML_VALUE_NULL && e->attrs[i].value) n++;
+    }
+    return n;
+}
+
+// <Data Name="x">v</Data>: the key is x
+static const char *json_name_attr(const XML_ELEMENT *e)
+{
+    if (e->first_child || json_attr_count(e) != 1) return NULL;
+    return get_attr_value(e, "Name");
+}
+
+static const char *json_key(const XML_ELEMENT *e)
+{
+    const char *name = json_name_attr(e);
+    return name ? name : e->name;
+}
+
+static int json_same_key(const XML_ELEMENT *first, const XML_ELEMENT *last, const char *key)
+{
+    for (const XML_ELEMENT *c = first; c != last; c = c->next_sibling) {
+        if (!strcmp(json_key(c), key)) return 1;
+    }
+    return 0;
+}
+
+static void json_element(OUT_SINK *out, const XML_ELEMENT *e);
+
+// the members of the object of e, n members are already written
+static void json_members(OUT_SINK *out, const XML_ELEMENT *e, int n)
+{
+    for (uint16_t i = 0; i < e->attr_count; i++) {
+        const XML_ATTRIBUTE *a = &e->attrs[i];
+        if (a->value_type == BINXML_VALUE_NULL || !a->value) continue;
+        if (n++) out_putc(out, ',');
+        json_string(out, a->name);
+        out_putc(out, ':');
+        json_value(out, a->value, a->value_type);
+    }
+
+    if (e->text) {
+        if (n++) out_putc(out, ',');
+        out_puts(out, "\"#text\":");
+        json_value(out, e->text, e->text_type);
+    }
+
+    for (const XML_ELEMENT *c = e->first_child; c; c = c->next_sibling) {
+        const char *key = json_key(c);
+        if (json_same_key(e->first_child, c, key)) continue;   // already in the array
+
+        if (n++) out_putc(out, ',');
+        json_string(out, key);
+        out_putc(out, ':');
+
+        if (!json_same_key(c->next_sibling, NULL, key)) {
+            json_element(out, c);
+            continue;
+        }
+
+        out_putc(out, '[');
+        json_element(out, c);
+        for (const XML_ELEMENT *d = c->next_sibling; d; d = d->next_sibling) {
+            if (strcmp(json_key(d), key)) continue;
+            out_putc(out, ',');
+            json_element(out, d);
+        }
+        out_putc(out, ']');
+    }
+}
+
+static void json_element(OUT_SINK *out, const XML_ELEMENT *e)
+{
+    if (!e->first_child && (json_attr_count(e) == 0 || json_name_attr(e))) {
+        json_value(out, e->text, e->text_type);
+        return;
+    }
+
+    out_putc(out, '{');
+    json_members(out, e, 0);
+    out_putc(out, '}');
+}
+
+
+static void output_json(OUT_SINK *out, XML_TREE *xtree, uint32_t output_mode, const char *source)
 {
+    int n = 0;
+
+    out_putc(out, '{');
+    if (source) {
+        out_puts(out, "\"Source\":");
+        json_string(out, source);
+        n++;
+    }
+    if (CHECK_OUTMODE(output_mode, OUT_RECOVERED)) {
+        out_puts(out, n ? ",\"Recovered\":true" : "\"Recovered\":true");
+        n++;
+    }
+    json_members(out, xtree->root, n);
+    out_puts(out, "}\n");
+}
+
 
-    if (IS_OUT_DEFAULT(output_mode)) {
-        //printf("DEBUG: output_xmltree(): DEFAULT\n");
+
+// printed once, before the first record
+void output_header(OUT_SINK *out, uint32_t output_mode)
+{
+    if (CHECK_OUTMODE(output_mode, OUT_CSV)) {
+        if (CHECK_OUTMODE(output_mode, OUT_SOURCE)) out_puts(out, "Source,");
+        for (size_t n = 0; n < CSV_COLUMN_COUNT; n++) {
+            out_puts(out, csv_columns[n].title);
+            out_putc(out, ',');
+        }
+        out_puts(out, "Data,Recovered\n");
+    }
+}
+
+
+// OUT_SOURCE: the formats without a Source field get a line before the records of source
+void output_source_line(OUT_SINK *out, uint32_t output_mode, const char *source)
+{
+    if (!CHECK_OUTMODE(output_mode, OUT_SOURCE)) {
+        return;
     }
+    if (IS_OUT_DEFAULT(output_mode) || CHECK_OUTMODE(output_mode, OUT_TXT | OUT_XML | OUT_SCHEMA)) {
+        out_puts(out, "==> ");
+        out_puts(out, source);
+        out_puts(out, " <==\n");
+    }
+}
+
 
-    if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-//        printf("DEBUG: output_xmltree(): DEBUG\n");
+// all the requested formats are written from the same tree, the record is decoded once
+void output_xmltree(OUT_SINK *out, XML_TREE *xtree, uint32_t output_mode, const char *source)
+{
+    if (!xtree || !xtree->root) {
+        return;
     }
 
     if (CHECK_OUTMODE(output_mode, OUT_CSV)) {
-//        printf("DEBUG: output_xmltree(): CSV\n");
+        output_csv(out, xtree, output_mode, source);
     }
 
     if (CHECK_OUTMODE(output_mode, OUT_XML)) {
-//        printf("DEBUG: output_xmltree(): XML\n");
+        if (CHECK_OUTMODE(output_mode, OUT_RECOVERED)) out_puts(out, "<!-- recovered -->\n");
+        xml_dump_tree_compact(out, xtree);
+    }
+
+    if (CHECK_OUTMODE(output_mode, OUT_JSON)) {
+        output_json(out, xtree, output_mode, source);
     }
 
     if (CHECK_OUTMODE(output_mode, OUT_TXT)) {
-//        printf("DEBUG: output_xmltree(): TXT\n");
+        if (CHECK_OUTMODE(output_mode, OUT_RECOVERED)) out_puts(out, "Recovered: true\n");
+        xml_dump_tree_text(out, xtree);
+        out_putc(out, '\n');
     }
 
     if (CHECK_OUTMODE(output_mode, OUT_SCHEMA)) {
-//        printf("DEBUG: output_xmltree(): SCHEMA\n");
+        output_schema(out, xtree);
+    }
+}
+
+
+
+// ------------------------------------------------------------
+// EventID filter
+// ------------------------------------------------------------
+
+int evtid_filter_parse(EVTX_EVTID_FILTER *f, const char *list)
+{
+    const char *p = list;
+
+    for (;;) {
+        char *end;
+        unsigned long first = strtoul(p, &end, 10);
+        if (end == p || first > 0xffff) return -1;
+
+        unsigned long last = first;
+        p = end;
+        if (*p == '-') {
+            p++;
+            last = strtoul(p, &end, 10);
+            if (end == p || last > 0xffff || last < first) return -1;
+            p = end;
+        }
+
+        for (unsigned long id = first; id <= last; id++) {
+            f->bits[id >> 3] |= (uint8_t)(1 << (id & 7));
+        }
+
+        if (*p == '\0') return 0;
+        if (*p++ != ',') return -1;
     }
 }
@@ -1,6 +1,7 @@
 #ifndef EVTX_OUTPUT_H
 #define EVTX_OUTPUT_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include "evtx_xmltree.h"
 
@@ -12,7 +13,8 @@
  *        EventID               Output flags
  *
  *  - Low 16 bits  : output / behavior flags
- *  - High 16 bits : EventID filter (0 = no filter)
+ *  - High 16 bits : one EventID (0 = none), the -e filter itself is
+ *                   an EVTX_EVTID_FILTER, see below
  */
 
 /* ============================================================
@@ -26,6 +28,8 @@
 #define OUT_TXT         0x0002
 #define OUT_XML         0x0004
 #define OUT_SCHEMA      0x0008
+#define OUT_ARROW       0x0010      /* Arrow IPC stream, see evtx_arrow.h */
+#define OUT_JSON        0x0020      /* JSON Lines, one object per record */
 
 /* ============================================================
  * Auxiliary / behavior flags (low 16 bits)
@@ -33,6 +37,11 @@
  * These modify behavior and can coexist with any format.
  */
 #define OUT_DEBUG       0x0100
+#define OUT_STATS       0x0200      /* cache statistics to stderr at the end */
+#define OUT_RAW         0x0400      /* render with the raw BinXML walker, not the compiled templates */
+#define OUT_SOURCE      0x0800      /* batch: tag every record with its input file (CSV / JSON) */
+#define OUT_SLACK       0x1000      /* also decode the records found in chunk slack (on unless --no-slack) */
+#define OUT_RECOVERED   0x2000      /* set per record by the decoder: this one was recovered, not walked */
 
 /* ============================================================
  * Masks
@@ -42,7 +51,7 @@
 #define EVTID_MASK      0xFFFF0000
 
 /* Mask for format-related flags only */
-#define OUTFMT_MASK     (OUT_CSV | OUT_TXT | OUT_XML | OUT_SCHEMA)
+#define OUTFMT_MASK     (OUT_CSV | OUT_TXT | OUT_XML | OUT_SCHEMA | OUT_ARROW | OUT_JSON)
 
 /* ============================================================
  * Output mode helpers
@@ -96,10 +105,49 @@
 #define CLEAR_EVTID(mode) \
     ((mode) &= OUTMODE_MASK)
 
+/* ============================================================
+ * EventID filter (-e)
+ * ============================================================
+ * One bit per EventID, so any list of IDs and ranges costs one
+ * lookup per record. The decoder checks it right after the value
+ * table of a record is built, a record which does not match is
+ * not rendered at all.
+ */
+typedef struct _EVTX_EVTID_FILTER {
+    uint8_t bits[65536 / 8];
+} EVTX_EVTID_FILTER;
+
+#define EVTID_FILTER_MATCH(f, id) \
+    ((((f)->bits[((id) & 0xffff) >> 3]) >> ((id) & 7)) & 1)
+
+/* add a list like "4624,4625,4768-4771" to the filter, -1 on a syntax error */
+int evtid_filter_parse(EVTX_EVTID_FILTER *f, const char *list);
+
+
+/* ============================================================
+ * Output stream
+ * ============================================================
+ * Everything the decoder prints goes to an OUT_SINK (out_sink.h),
+ * passed down from decode_evtx_file() through EVTX_CHUNK_CTX.
+ * The chunk workers of -j print to memory sinks, which are then
+ * written to the real sink in chunk order.
+ */
+#include "out_sink.h"
+
+
 
+// CSV header etc, once before the first record
+void output_header(OUT_SINK *out, uint32_t output_mode);
 
+// OUT_SOURCE: "==> source <==" before the records of source, for the formats
+// without a Source field (DEFAULT, TXT, XML, SCHEMA)
+void output_source_line(OUT_SINK *out, uint32_t output_mode, const char *source);
 
-void output_xmltree(XML_TREE *xtree, uint32_t output_mode);
+// write the record in xtree in every format requested by output_mode,
+// source is the input file for OUT_SOURCE (NULL otherwise).
+// OUT_RECOVERED marks the record: Recovered 1 in CSV (0 otherwise), a member in JSON,
+// a line before it for XML and TXT
+void output_xmltree(OUT_SINK *out, XML_TREE *xtree, uint32_t output_mode, const char *source);
 
 
 
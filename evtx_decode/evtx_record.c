@@ -10,6 +10,10 @@
 #include <string.h>
 #include <inttypes.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#define RECORD_X86 1
+#include <immintrin.h>
+#endif
 
 #include "evtx_output.h"
 
@@ -20,12 +24,70 @@
 #include "evtx_chunk.h"
 #include "evtx_record.h"
 #include "evtx_binxml.h"
+#include "evtx_sax.h"
+
+
+
+// the XMLTREE is built through the SAX callbacks, the user data is the context
+static void tree_on_element_open(void *user, const char *name, uint32_t len)
+{
+    (void)len;
+    xml_build_open(&((EVTX_CHUNK_CTX *)user)->xtree, name);
+}
+
+static void tree_on_attribute(void *user, const char *name, uint32_t len)
+{
+    (void)len;
+    xml_build_attr(&((EVTX_CHUNK_CTX *)user)->xtree, name);
+}
+
+static void tree_on_start_tag_end(void *user)
+{
+    xml_build_close_start(&((EVTX_CHUNK_CTX *)user)->xtree);
+}
+
+static void tree_on_element_close(void *user)
+{
+    xml_build_close(&((EVTX_CHUNK_CTX *)user)->xtree);
+}
+
+// the tree keeps the value as text, formatted exactly as printed
+static void tree_on_value(void *user, uint8_t type, const void *ptr, uint32_t size)
+{
+    EVTX_CHUNK_CTX *ctx = (EVTX_CHUNK_CTX *)user;
+
+    // NULL or empty values are kept as NULL, they are not printed in XML
+    if (type == 0x00 || size == 0) {
+        xml_build_value(&ctx->xtree, NULL, 0, type);
+        return;
+    }
+
+    OUT_SINK *vout = &ctx->value_out;
+    vout->len = 0;              // a memory sink, just start over
+    print_value(vout, type, ptr, size);
+
+    // static template text is a converted UTF-16LE string
+    if (type == EVTX_SAX_TEXT_UTF8) type = 0x01;
+    xml_build_value(&ctx->xtree, vout->buf, vout->len, type);
+}
+
+static const EVTX_SAX tree_sax = {
+    .on_element_open  = tree_on_element_open,
+    .on_attribute     = tree_on_attribute,
+    .on_start_tag_end = tree_on_start_tag_end,
+    .on_value         = tree_on_value,
+    .on_element_close = tree_on_element_close,
+};
 
 
 
 
-int decode_evtx_record(uint32_t chunk_base, uint32_t record_base, uint8_t *chunk_buffer, uint32_t output_mode)
+int decode_evtx_record(EVTX_CHUNK_CTX *ctx, uint32_t record_base)
 {
+    uint8_t *chunk_buffer = ctx->chunk_buffer;
+    uint32_t chunk_base   = ctx->chunk_base;
+    uint32_t output_mode  = ctx->output_mode;
+
     // the stuct to hold the record header
     EVTX_RECORD_HEADER *rh = (EVTX_RECORD_HEADER *) &chunk_buffer[record_base]; 
     
@@ -39,42 +101,205 @@ int decode_evtx_record(uint32_t chunk_base, uint32_t record_base, uint8_t *chunk
         return 2;
     }
 
-    if (IS_OUT_DEFAULT(output_mode)) {
+    // --since / --until and --record only need the record header, no BinXML is touched
+    if ((ctx->since && rh->timestamp < ctx->since) || (ctx->until && rh->timestamp > ctx->until)) {
+        return 0;
+    }
+    if (ctx->record_last && (rh->record_identifier < ctx->record_first || rh->record_identifier > ctx->record_last)) {
+        return 0;
+    }
+
+    // value tables and element stacks of the previous record are not needed any more
+    arena_reset(&ctx->scratch);
+
+    // find the template and the values first: -e can drop the record before anything is rendered
+    uint32_t binxml_offset = record_base + sizeof(EVTX_RECORD_HEADER);
+    uint32_t binxml_size = rh->record_size - sizeof(EVTX_RECORD_HEADER) - sizeof(uint32_t); 
+                               // the lastt 4B is record_size_COPY, so we do not calculate it 
+    BINXML_INSTANCE inst;
+    int found = (binxml_read_instance(ctx, binxml_offset, binxml_size, &inst) == 0);
+
+    if (ctx->evtid_filter) {
+        int32_t evtid = found ? binxml_event_id(ctx, &inst) : -1;
+        if (evtid < 0 || !EVTID_FILTER_MATCH(ctx->evtid_filter, evtid)) {
+            return 0;
+        }
+    }
+
+    // a SAX consumer gets everything through its callbacks, nothing is printed
+    const EVTX_SAX *sax = ctx->sax;
+    if (sax && sax->on_record_begin && sax->on_record_begin(sax->user, rh) != 0) {
+        return 0;   // not wanted, skip it
+    }
+
+    if (IS_OUT_DEFAULT(output_mode) && !sax) {
         // convert timestamp to ISO format
         char time_written[32]; // Timestamp of writting to evtx file
         format_filetime(rh->timestamp, time_written, sizeof(time_written));
     
         // print summary of the event
-        printf("ElfRec#%06" PRIu64 " (0x%08" PRIx32 ")\t%s\tsize=%" PRIu32 "\n",
+        out_printf(ctx->out, "ElfRec#%06" PRIu64 " (0x%08" PRIx32 ")\t%s\tsize=%" PRIu32 "%s\n",
                 rh->record_identifier,
                 chunk_base + record_base,
                 time_written,
-                rh->record_size 
+                rh->record_size,
+                ctx->recovered ? "\trecovered" : ""
                 );
     }
 
-    // decode binxml 
-    uint32_t binxml_offset = record_base + sizeof(EVTX_RECORD_HEADER);
-    uint32_t binxml_size = rh->record_size - sizeof(EVTX_RECORD_HEADER) - sizeof(uint32_t); 
-                               // the lastt 4B is record_size_COPY, so we do not calculate it 
     if (CHECK_OUTMODE(output_mode, OUT_DEBUG)) {
-        printf("DEBUG: called from decode_evtx_record()\t"); 
+        out_printf(ctx->out, "DEBUG: called from decode_evtx_record()\t"); 
     }
 
 
-    // create the XMLTREE object for this record
-    XML_TREE *xtree = xml_new_tree();
+    if (sax) {
+        binxml_render_instance(ctx, &inst, sax);
+        if (sax->on_record_end) sax->on_record_end(sax->user, rh);
+        return 0;
+    }
 
-    // let decode_binxml to build th XMLTREE
-    decode_binxml(chunk_buffer, binxml_offset, binxml_size, output_mode, xtree);
+    // DEFAULT prints while decoding, the other formats are written from the XMLTREE
+    if (!HAS_OUTFMT(output_mode)) {
+        binxml_render_instance(ctx, &inst, NULL);
+        return 0;
+    }
 
-    // output the XMLTREE
-    output_xmltree(xtree, output_mode);  
+    // the XMLTREE of the previous record is dropped at once, its memory is reused
+    XML_TREE *xtree = &ctx->xtree;
+    xml_reset_tree(xtree);
+
+    // let decode_binxml to build th XMLTREE
+    EVTX_SAX builder = tree_sax;
+    builder.user = ctx;
+    binxml_render_instance(ctx, &inst, &builder);
 
-    // finally free the tree
-    xml_free_tree(xtree);
+    // output the XMLTREE, every requested format from the same tree
+    if (ctx->recovered) SET_OUTMODE(output_mode, OUT_RECOVERED);
+    output_xmltree(ctx->out, xtree, output_mode, ctx->source);
 
     return 0;
 }
 
 
+
+// ------------------------------------------------------------
+// the signature search
+// ------------------------------------------------------------
+// records are 8 byte aligned in their chunk (and the chunk is aligned to a
+// sector in an image), so only every other 32-bit lane can hold a record signature
+
+static size_t find_record_signature_scalar(const uint8_t *p, size_t len)
+{
+    for (size_t i = 0; i + 4 <= len; i += 8) {
+        uint32_t v;
+        memcpy(&v, &p[i], 4);
+        if (v == EVTX_RECORD_SIGNATURE) return i;
+    }
+    return len;
+}
+
+#if defined(RECORD_X86)
+
+__attribute__((target("sse2")))
+static size_t find_record_signature_sse2(const uint8_t *p, size_t len)
+{
+    const __m128i sig = _mm_set1_epi32(EVTX_RECORD_SIGNATURE);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&p[i]);
+        int mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, sig))) & 0x5;
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask) * 4;
+    }
+    size_t rest = find_record_signature_scalar(&p[i], len - i);
+    return i + rest;
+}
+
+__attribute__((target("avx2")))
+static size_t find_record_signature_avx2(const uint8_t *p, size_t len)
+{
+    const __m256i sig = _mm256_set1_epi32(EVTX_RECORD_SIGNATURE);
+    size_t i = 0;
+
+    // two vectors per round, most of an image is not a record
+    for (; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)&p[i]), sig);
+        __m256i b = _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i *)&p[i + 32]), sig);
+        if (_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_or_si256(a, b))) continue;
+
+        int mask = _mm256_movemask_ps(_mm256_castsi256_ps(a)) & 0x55;
+        if (mask) return i + (size_t)__builtin_ctz((unsigned)mask) * 4;
+        mask = _mm256_movemask_ps(_mm256_castsi256_ps(b)) & 0x55;
+        if (mask) return i + 32 + (size_t)__builtin_ctz((unsigned)mask) * 4;
+    }
+    size_t rest = find_record_signature_scalar(&p[i], len - i);
+    return i + rest;
+}
+
+#endif
+
+
+// chosen once at startup from the CPU features
+static size_t (*find_record_signature_impl)(const uint8_t *, size_t) = find_record_signature_scalar;
+
+__attribute__((constructor))
+static void record_select_impl(void)
+{
+#if defined(RECORD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        find_record_signature_impl = find_record_signature_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        find_record_signature_impl = find_record_signature_sse2;
+    }
+#endif
+}
+
+size_t evtx_find_record_signature(const uint8_t *p, size_t len)
+{
+    return find_record_signature_impl(p, len);
+}
+
+
+
+// ------------------------------------------------------------
+// records outside the record walk (slack, carving)
+// ------------------------------------------------------------
+
+uint32_t evtx_record_recoverable(const uint8_t *chunk_buffer, uint32_t record_base)
+{
+    EVTX_RECORD_HEADER rh;
+    uint32_t size_copy;
+
+    if (record_base < sizeof(EVTX_CHUNK_HEADER) || record_base > EVTX_CHUNK_SIZE - sizeof(rh) - 4) {
+        return 0;
+    }
+    memcpy(&rh, &chunk_buffer[record_base], sizeof(rh));
+    if (rh.signature != EVTX_RECORD_SIGNATURE || rh.record_size <= sizeof(rh) + 4 ||
+            rh.record_size > EVTX_CHUNK_SIZE - record_base) {
+        return 0;
+    }
+    memcpy(&size_copy, &chunk_buffer[record_base + rh.record_size - 4], 4);
+    if (size_copy != rh.record_size) {
+        return 0;
+    }
+
+    // the template instance (0x0c 0x01 just after the fragment header, as binxml_read_instance()
+    // finds it) must name a definition of this chunk with the same template id.
+    // a record left from an earlier life of the chunk would be rendered with the wrong tables
+    const uint8_t *binxml = &chunk_buffer[record_base + sizeof(rh)];
+    uint32_t binxml_size = rh.record_size - sizeof(rh) - 4;
+    BINXML_TEMPLATE_INSTANCE_HEADER ti;
+
+    for (uint32_t i = 0; i < 10 && i + 1 + sizeof(ti) <= binxml_size; i++) {
+        if (binxml[i] != 0x0c || binxml[i + 1] != 0x01) continue;
+
+        memcpy(&ti, &binxml[i + 1], sizeof(ti));
+        if (ti.template_offset < sizeof(EVTX_CHUNK_HEADER) ||
+                ti.template_offset > EVTX_CHUNK_SIZE - sizeof(EVTX_TEMPLATE_DEFINITION_HEADER)) {
+            return 0;
+        }
+        return (memcmp(&chunk_buffer[ti.template_offset + 4], &ti.template_id, 4) == 0) ? rh.record_size : 0;
+    }
+    return 0;
+}
@@ -7,6 +7,10 @@
 #if !defined ( EVTX_RECORD_H )
 #define EVTX_RECORD_H
 
+#include <stddef.h>
+
+#include "evtx_chunk.h"
+
 
 #define ALIGN_8(x) (((x) + 7) & ~7)
 
@@ -25,7 +29,16 @@ typedef struct _EVTX_RECORD_HEADER {
 
 
 
-int decode_evtx_record(uint32_t chunk_base, uint32_t record_base, uint8_t *chunk_buffer, uint32_t output_mode);
+int decode_evtx_record(EVTX_CHUNK_CTX *ctx, uint32_t record_base);
+
+// the offset of the first "**\0\0" at an 8 byte boundary in p[0..len), len if none.
+// p must be 8 byte aligned. uses AVX2 or SSE2 when the CPU has it
+size_t evtx_find_record_signature(const uint8_t *p, size_t len);
+
+// the size of the record at record_base when it can be decoded with the tables of this
+// chunk although no record walk reaches it: signature, a size which fits in the chunk,
+// the copy of the size at its end and its template defined here. 0 if not
+uint32_t evtx_record_recoverable(const uint8_t *chunk_buffer, uint32_t record_base);
 
 void get_item_value_by_index(uint8_t *chunk_buffer, int index);
 
@@ -0,0 +1,63 @@
+/* evtx_sax.h
+ *
+ * Streaming (SAX style) interface.
+ *
+ * Instead of printing, the decoder calls back for every piece of a record,
+ * in document order, while it walks the template of the record:
+ *
+ *   on_file_header
+ *   on_chunk                                   for each chunk
+ *     on_record_begin                          for each record
+ *       on_element_open("Event")
+ *         on_attribute("xmlns") on_value(...)
+ *         on_start_tag_end                     ">", the values now are element text
+ *         on_element_open("System") ...
+ *       on_element_close
+ *     on_record_end
+ *
+ * Values are not formatted: on_value() gets the EVTX value type and a view
+ * of the raw bytes inside the chunk (UTF-16LE strings, little endian numbers,
+ * FILETIME, SID, GUID ...), valid until the callback returns. Nothing is
+ * allocated for the consumer, it only pays for the fields it looks at.
+ *
+ *   - embedded BinXML (0x21) is not a value, its elements come as events
+ *   - NULL values come as type 0x00 with size 0
+ *   - static text of a compiled template is already UTF-8, it comes as
+ *     EVTX_SAX_TEXT_UTF8 (pointing into the template, not the chunk)
+ *
+ * Element and attribute names are UTF-8, NUL terminated, len without the NUL.
+ * Every callback may be NULL. The callbacks returning int can skip: non-zero
+ * from on_file_header stops the file, from on_chunk skips the chunk, from
+ * on_record_begin skips the record (no more events until the next one).
+ *
+ * The callbacks come from one thread in file order, -j is not used with SAX.
+ */
+
+#if !defined( EVTX_SAX_H )
+#define EVTX_SAX_H
+
+#include <stdint.h>
+
+#define EVTX_SAX_TEXT_UTF8      0xff    /* pseudo value type, see above */
+
+struct _EVTX_FILE_HEADER;
+struct _EVTX_CHUNK_HEADER;
+struct _EVTX_RECORD_HEADER;
+
+typedef struct _EVTX_SAX {
+    void *user;         // passed to every callback
+
+    int  (*on_file_header)(void *user, const struct _EVTX_FILE_HEADER *fh);
+    int  (*on_chunk)(void *user, uint16_t chunk_index, const struct _EVTX_CHUNK_HEADER *ch);
+    int  (*on_record_begin)(void *user, const struct _EVTX_RECORD_HEADER *rh);
+
+    void (*on_element_open)(void *user, const char *name, uint32_t len);
+    void (*on_attribute)(void *user, const char *name, uint32_t len);
+    void (*on_start_tag_end)(void *user);
+    void (*on_value)(void *user, uint8_t type, const void *ptr, uint32_t size);
+    void (*on_element_close)(void *user);
+
+    void (*on_record_end)(void *user, const struct _EVTX_RECORD_HEADER *rh);
+} EVTX_SAX;
+
+#endif
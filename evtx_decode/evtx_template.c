@@ -0,0 +1,733 @@
+/* evtx_template.c
+ *
+ * compile template BinXML into an EVTX_OP program, the per-chunk template cache
+ * and the process wide template cache
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "evtx_chunk.h"
+#include "evtx_binxml.h"
+#include "evtx_template.h"
+#include "utf16le.h"
+
+
+
+// growing arrays used while compiling
+typedef struct _TEMPLATE_BUILDER {
+    EVTX_TEMPLATE *tpl;
+    uint32_t op_cap;
+    uint32_t name_cap;
+    uint32_t names_buf_size;
+    uint32_t names_buf_cap;
+    uint32_t text_cap;
+    uint32_t subs_cap;
+    uint16_t *open_ids;         // names of the open elements, for the end element tokens
+    uint32_t open_count;
+    uint32_t open_cap;
+} TEMPLATE_BUILDER;
+
+
+// grow *array to hold at least need items of item_size
+static int builder_reserve(void **array, uint32_t *cap, uint32_t need, size_t item_size, uint32_t first_cap)
+{
+    if (need <= *cap) return 0;
+
+    uint32_t n = *cap ? *cap : first_cap;
+    while (n < need) n *= 2;
+
+    void *p = realloc(*array, (size_t)n * item_size);
+    if (!p) return -1;
+    *array = p;
+    *cap = n;
+    return 0;
+}
+
+
+// id of an element or attribute name, each distinct name is stored once
+static int builder_name_id(TEMPLATE_BUILDER *b, const char *str, uint32_t len, uint16_t *id)
+{
+    EVTX_TEMPLATE *tpl = b->tpl;
+
+    for (uint32_t n = 0; n < tpl->name_count; n++) {
+        if (tpl->names[n].len == len && memcmp(TEMPLATE_NAME(tpl, n), str, len) == 0) {
+            *id = (uint16_t)n;
+            return 0;
+        }
+    }
+
+    if (tpl->name_count >= 0xffff) return -1;
+    if (builder_reserve((void **)&tpl->names, &b->name_cap, tpl->name_count + 1, sizeof(EVTX_NAME), 16) != 0) return -1;
+    if (builder_reserve((void **)&tpl->names_buf, &b->names_buf_cap, b->names_buf_size + len + 1, 1, 256) != 0) return -1;
+
+    memcpy(&tpl->names_buf[b->names_buf_size], str, len + 1);
+    tpl->names[tpl->name_count].off = b->names_buf_size;
+    tpl->names[tpl->name_count].len = len;
+    b->names_buf_size += len + 1;
+
+    *id = (uint16_t)tpl->name_count++;
+    return 0;
+}
+
+
+// append one op, and its printed form (up to 3 pieces) to the text
+static int builder_emit(TEMPLATE_BUILDER *b, uint8_t code, uint8_t value_type, uint16_t arg,
+                        const char *s1, const char *s2, const char *s3)
+{
+    EVTX_TEMPLATE *tpl = b->tpl;
+    const char *pieces[3] = { s1, s2, s3 };
+    size_t lens[3] = { 0, 0, 0 };
+    size_t text_len = 0;
+
+    for (int n = 0; n < 3; n++) {
+        if (pieces[n]) lens[n] = strlen(pieces[n]);
+        text_len += lens[n];
+    }
+    if (text_len > 0xffff) return -1;   // very long static text, leave it to the raw walker
+
+    if (builder_reserve((void **)&tpl->ops, &b->op_cap, tpl->op_count + 1, sizeof(EVTX_OP), 64) != 0) return -1;
+    if (builder_reserve((void **)&tpl->text, &b->text_cap, tpl->text_size + (uint32_t)text_len + 1, 1, 1024) != 0) return -1;
+
+    EVTX_OP *op = &tpl->ops[tpl->op_count];
+    op->code       = code;
+    op->value_type = value_type;
+    op->arg        = arg;
+    op->text_len   = (uint16_t)text_len;
+    op->text_off   = tpl->text_size;
+    op->run_ops    = 0;
+    op->run_len    = 0;
+
+    for (int n = 0; n < 3; n++) {
+        memcpy(&tpl->text[tpl->text_size], pieces[n] ? pieces[n] : "", lens[n]);
+        tpl->text_size += (uint32_t)lens[n];
+    }
+    tpl->text[tpl->text_size] = '\0';
+
+    // remember where the substitutions are
+    if (code == EVTX_OP_SUBST || code == EVTX_OP_SUBST_OPT) {
+        if (builder_reserve((void **)&tpl->subs, &b->subs_cap, tpl->subs_count + 1, sizeof(uint32_t), 16) != 0) return -1;
+        tpl->subs[tpl->subs_count++] = tpl->op_count;
+    }
+
+    tpl->op_count++;
+    return 0;
+}
+
+
+static int builder_emit_name(TEMPLATE_BUILDER *b, uint8_t code, const char *name, uint32_t len)
+{
+    uint16_t id;
+    if (builder_name_id(b, name, len, &id) != 0) return -1;
+
+    switch (code) {
+        case EVTX_OP_OPEN:
+            if (builder_reserve((void **)&b->open_ids, &b->open_cap, b->open_count + 1, sizeof(uint16_t), 16) != 0) return -1;
+            b->open_ids[b->open_count++] = id;
+            return builder_emit(b, code, 0, id, "<", name, NULL);
+        case EVTX_OP_ATTR:
+            return builder_emit(b, code, 0, id, " ", name, "=");
+        default:
+            return builder_emit(b, code, 0, id, "</", name, ">\n");
+    }
+}
+
+
+// static runs: every op without substitution starts a run that goes up to
+// the next substitution (at most 65535 ops), computed from the end
+static void builder_link_runs(EVTX_TEMPLATE *tpl)
+{
+    for (uint32_t n = tpl->op_count; n-- > 0; ) {
+        EVTX_OP *op = &tpl->ops[n];
+        if (op->code == EVTX_OP_SUBST || op->code == EVTX_OP_SUBST_OPT) continue;
+
+        op->run_ops = 1;
+        op->run_len = op->text_len;
+
+        EVTX_OP *next = op + 1;
+        if (n + 1 < tpl->op_count && next->run_ops && next->run_ops < 0xffff) {
+            op->run_ops += next->run_ops;
+            op->run_len += next->run_len;
+        }
+    }
+}
+
+
+// the -e filter looks at one value only: the text of /Event/System/EventID.
+// remember which op gives it, so a record is filtered without rendering anything
+static void builder_find_event_id(EVTX_TEMPLATE *tpl)
+{
+    uint32_t depth = 0;
+    int in_system = 0;
+
+    tpl->evtid_op = -1;
+
+    for (uint32_t n = 0; n < tpl->op_count; n++) {
+        const EVTX_OP *op = &tpl->ops[n];
+
+        if (op->code == EVTX_OP_OPEN) {
+            depth++;
+            const char *name = TEMPLATE_NAME(tpl, op->arg);
+            if (depth == 2) in_system = (strcmp(name, "System") == 0);
+            if (depth != 3 || !in_system || strcmp(name, "EventID") != 0) continue;
+
+            // skip the attributes (Qualifiers), the first op after ">" is the text
+            while (++n < tpl->op_count && tpl->ops[n].code != EVTX_OP_CLOSE_START) {
+                if (tpl->ops[n].code == EVTX_OP_CLOSE_EMPTY) return;
+            }
+            if (++n >= tpl->op_count) return;
+
+            uint8_t code = tpl->ops[n].code;
+            if (code == EVTX_OP_SUBST || code == EVTX_OP_SUBST_OPT || code == EVTX_OP_VALUE) {
+                tpl->evtid_op = (int32_t)n;
+            }
+            return;
+        }
+        if (op->code == EVTX_OP_CLOSE || op->code == EVTX_OP_CLOSE_EMPTY) {
+            depth--;
+        }
+    }
+}
+
+
+
+// same walk as decode_template_with_values(), but only recording what to print.
+// returns NULL for anything the raw walker would complain about, so the
+// fallback prints exactly the same warnings as before.
+// the caller already checked the definition is inside the chunk
+static EVTX_TEMPLATE *evtx_template_compile(EVTX_CHUNK_CTX *ctx, uint32_t template_offset)
+{
+    uint8_t *chunk_buffer = ctx->chunk_buffer;
+
+    EVTX_TEMPLATE_DEFINITION_HEADER th;
+    memcpy(&th, &chunk_buffer[template_offset], sizeof(th));
+
+    uint32_t i = template_offset + sizeof(th);      // cursor
+    uint32_t binxml_limit = i + th.data_size;       // hard limit of cursor
+
+    EVTX_TEMPLATE *tpl = calloc(1, sizeof(EVTX_TEMPLATE));
+    if (!tpl) return NULL;
+    memcpy(tpl->guid, &chunk_buffer[template_offset + 4], sizeof(tpl->guid));
+    tpl->template_id = th.template_id;
+    tpl->data_size   = th.data_size;
+
+    TEMPLATE_BUILDER b;
+    memset(&b, 0, sizeof(b));
+    b.tpl = tpl;
+
+    int ok = 1;
+
+    while (ok && i < binxml_limit) {
+        uint8_t raw_token = chunk_buffer[i];
+
+        switch (raw_token) {
+
+            case 0x0f: // BinXmlFragmentHeaderToken
+                i += sizeof(TOKEN_0F_FRAGMENT_HEADER);
+                break;
+
+            case 0x01: // BinXmlTokenOpenStartElement
+            case 0x41: // BinXmlTokenOpenStartElement | BinXmlTokenMoreData
+            {
+                TOKEN_01_OPEN_ELEMENT_HEADER open_el;
+                memcpy(&open_el, &chunk_buffer[i], sizeof(open_el));
+                i += sizeof(open_el);
+
+                uint32_t name_len;
+                const char *name = chunk_get_name(ctx, open_el.name_offset, &name_len);
+                ok = (builder_emit_name(&b, EVTX_OP_OPEN, name, name_len) == 0);
+
+                i += get_inline_name_skip_bytes(ctx, i, open_el.name_offset);
+                if (raw_token & 0x40) {
+                    i += 4; // attr_list_size
+                }
+                break;
+            }
+
+            case 0x06: // BinXmlTokenAttribute
+            case 0x46: // BinXmlTokenAttribute | BinXmlTokenMoreData
+            case 0x36: // new token seems for attribute name
+            {
+                uint32_t name_offset;
+                if (raw_token == 0x36) {
+                    TOKEN_36_ATTRIBUTE_NAME_HEADER attr;
+                    memcpy(&attr, &chunk_buffer[i], sizeof(attr));
+                    i += sizeof(attr);
+                    name_offset = attr.name_offset;
+                } else {
+                    TOKEN_06_ATTRIBUTE_NAME_HEADER attr;
+                    memcpy(&attr, &chunk_buffer[i], sizeof(attr));
+                    i += sizeof(attr);
+                    name_offset = attr.name_offset;
+                }
+
+                uint32_t name_len;
+                const char *name = chunk_get_name(ctx, name_offset, &name_len);
+                ok = (builder_emit_name(&b, EVTX_OP_ATTR, name, name_len) == 0);
+
+                i += get_inline_name_skip_bytes(ctx, i, name_offset);
+                break;
+            }
+
+            case 0x05: // BinXmlTokenValue
+            case 0x45: // BinXmlTokenValue | BinXmlTokenMoreData
+            {
+                TOKEN_05_ATTRIBUTE_VALUE_HEADER vh;
+                memcpy(&vh, &chunk_buffer[i], sizeof(vh));
+                i += sizeof(vh);
+
+                if (vh.value_type == 0x01) { // Unicode String
+                    uint16_t char_count = *(uint16_t *)&chunk_buffer[i];
+                    i += 2;
+
+                    // same conversion as print_utf16le_string()
+                    char *text = calloc(1, (size_t)char_count * 4 + 1);
+                    if (!text) { ok = 0; break; }
+                    get_utf16le_string(char_count, (uint16_t *)&chunk_buffer[i], text, (size_t)char_count * 4 + 1);
+                    ok = (builder_emit(&b, EVTX_OP_VALUE, 0x01, 0, text, NULL, NULL) == 0);
+                    free(text);
+
+                    i += (char_count * 2);
+                } else if (vh.value_type == 0x00) { // nulltype
+                    ok = (builder_emit(&b, EVTX_OP_VALUE, 0x00, 0, "null", NULL, NULL) == 0);
+                } else {
+                    ok = 0; // the raw walker warns about it
+                }
+                break;
+            }
+
+            case 0x0d: // BinXmlTokenNormalSubstitution
+            case 0x0e: // BinXmlTokenOptionalSubstitution
+            {
+                TOKEN_0E_SUBSTITUTION_HEADER sh;
+                memcpy(&sh, &chunk_buffer[i], sizeof(sh));
+                i += sizeof(sh);
+
+                ok = (builder_emit(&b, (raw_token == 0x0d) ? EVTX_OP_SUBST : EVTX_OP_SUBST_OPT,
+                                   sh.value_type, sh.subs_id, NULL, NULL, NULL) == 0);
+                break;
+            }
+
+            case 0x02: // BinXmlTokenCloseStartElementTag
+                i += 1;
+                ok = (builder_emit(&b, EVTX_OP_CLOSE_START, 0, 0, ">", NULL, NULL) == 0);
+                break;
+
+            case 0x03: // BinXmlTokenCloseEmptyElementTag
+                i += 1;
+                ok = (builder_emit(&b, EVTX_OP_CLOSE_EMPTY, 0, 0, "/>\n", NULL, NULL) == 0);
+                if (b.open_count > 0) b.open_count--;
+                break;
+
+            case 0x04: // BinXmlTokenEndElementTag
+                i += 1;
+                if (b.open_count > 0) {
+                    uint16_t id = b.open_ids[--b.open_count];
+                    ok = (builder_emit(&b, EVTX_OP_CLOSE, 0, id, "</", TEMPLATE_NAME(tpl, id), ">\n") == 0);
+                } else {
+                    ok = (builder_emit_name(&b, EVTX_OP_CLOSE, "(null)", 6) == 0);
+                }
+                break;
+
+            case 0x00: // BinXmlTokenEOF
+                i += 1;
+                break;
+
+            default:   // CharRef, EntityRef, CDATA, PI, nested 0x0c, unknown ...
+                ok = 0;
+                break;
+        }
+    }
+
+    free(b.open_ids);
+
+    if (!ok) {
+        evtx_template_free(tpl);
+        return NULL;
+    }
+
+    builder_link_runs(tpl);
+    builder_find_event_id(tpl);
+    return tpl;
+}
+
+
+
+void evtx_template_free(EVTX_TEMPLATE *tpl)
+{
+    if (!tpl) return;
+    free(tpl->ops);
+    free(tpl->names);
+    free(tpl->names_buf);
+    free(tpl->text);
+    free(tpl->subs);
+    free(tpl);
+}
+
+
+
+
+// ------------------------------------------------------------
+// template hash
+// ------------------------------------------------------------
+// The same template is defined again in every chunk, but its bytes are not
+// always the same: names are referenced by chunk offset, and defined inline
+// only the first time they are used in a chunk (which also changes the size
+// fields). So the hash follows the tokens and uses the name strings instead
+// of name offsets, inline name entries and size fields. Everything else is
+// hashed as is. Walking the tokens is cheap, nothing is converted or allocated.
+
+#define FNV64_OFFSET    0xcbf29ce484222325ULL
+#define FNV64_PRIME     0x100000001b3ULL
+
+static uint64_t fnv1a(uint64_t h, const uint8_t *p, uint32_t len)
+{
+    for (uint32_t n = 0; n < len; n++) {
+        h ^= p[n];
+        h *= FNV64_PRIME;
+    }
+    return h;
+}
+
+
+// hash the UTF-16 characters of the name entry at name_offset
+static uint64_t hash_name(uint64_t h, uint8_t *chunk_buffer, uint32_t name_offset)
+{
+    if (name_offset + sizeof(EVTX_NAME_ENTRY_HEADER) > EVTX_CHUNK_SIZE) {
+        return h;
+    }
+
+    EVTX_NAME_ENTRY_HEADER nh;
+    memcpy(&nh, &chunk_buffer[name_offset], sizeof(nh));
+
+    uint32_t chars = name_offset + sizeof(nh);
+    uint32_t len   = nh.char_count * 2;
+    if (chars + len > EVTX_CHUNK_SIZE) {
+        return h;
+    }
+
+    h = fnv1a(h, (uint8_t *)&nh.char_count, sizeof(nh.char_count));
+    return fnv1a(h, &chunk_buffer[chars], len);
+}
+
+
+static uint64_t template_hash(EVTX_CHUNK_CTX *ctx, uint32_t template_offset)
+{
+    uint8_t *chunk_buffer = ctx->chunk_buffer;
+
+    EVTX_TEMPLATE_DEFINITION_HEADER th;
+    memcpy(&th, &chunk_buffer[template_offset], sizeof(th));
+
+    uint32_t i = template_offset + sizeof(th);
+    uint32_t binxml_limit = i + th.data_size;
+    uint64_t h = FNV64_OFFSET;
+
+    while (i < binxml_limit) {
+        uint8_t raw_token = chunk_buffer[i];
+        uint32_t name_offset;
+
+        switch (raw_token) {
+            case 0x01:
+            case 0x41:
+            {
+                TOKEN_01_OPEN_ELEMENT_HEADER open_el;
+                memcpy(&open_el, &chunk_buffer[i], sizeof(open_el));
+                h = fnv1a(h, &chunk_buffer[i], 3);  // token + dependency_id
+                i += sizeof(open_el);
+                name_offset = open_el.name_offset;
+                h = hash_name(h, chunk_buffer, name_offset);
+                i += get_inline_name_skip_bytes(ctx, i, name_offset);
+                if (raw_token & 0x40) i += 4;
+                break;
+            }
+
+            case 0x06:
+            case 0x46:
+            case 0x36:
+            {
+                uint32_t header_size = (raw_token == 0x36) ? sizeof(TOKEN_36_ATTRIBUTE_NAME_HEADER)
+                                                           : sizeof(TOKEN_06_ATTRIBUTE_NAME_HEADER);
+                h = fnv1a(h, &chunk_buffer[i], header_size - 4);    // all but the name offset
+                memcpy(&name_offset, &chunk_buffer[i + header_size - 4], 4);
+                i += header_size;
+                h = hash_name(h, chunk_buffer, name_offset);
+                i += get_inline_name_skip_bytes(ctx, i, name_offset);
+                break;
+            }
+
+            case 0x05:
+            case 0x45:
+            {
+                uint8_t v_type = chunk_buffer[i + 1];
+                if (v_type == 0x01) {
+                    uint16_t char_count = *(uint16_t *)&chunk_buffer[i + 2];
+                    uint32_t len = 4 + char_count * 2;
+                    if (i + len > binxml_limit) len = binxml_limit - i;
+                    h = fnv1a(h, &chunk_buffer[i], len);
+                    i += len;
+                } else if (v_type == 0x00) {
+                    h = fnv1a(h, &chunk_buffer[i], 2);
+                    i += 2;
+                } else {
+                    // not compiled anyway, hash the rest as is
+                    return fnv1a(h, &chunk_buffer[i], binxml_limit - i);
+                }
+                break;
+            }
+
+            case 0x0d:
+            case 0x0e:
+            case 0x0f:
+                h = fnv1a(h, &chunk_buffer[i], 4);
+                i += 4;
+                break;
+
+            case 0x00:
+            case 0x02:
+            case 0x03:
+            case 0x04:
+                h = fnv1a(h, &chunk_buffer[i], 1);
+                i += 1;
+                break;
+
+            default:
+                return fnv1a(h, &chunk_buffer[i], binxml_limit - i);
+        }
+    }
+
+    return h;
+}
+
+
+
+
+// ------------------------------------------------------------
+// process wide cache
+// ------------------------------------------------------------
+// open addressing keyed by (guid, hash), protected by one mutex.
+// entries are never removed, so a template pointer stays valid until
+// evtx_template_cache_free_all().
+
+typedef struct _TEMPLATE_ENTRY {
+    uint8_t  guid[16];
+    uint64_t hash;
+    int      used;
+    EVTX_TEMPLATE *tpl;     // NULL: the template can not be compiled
+} TEMPLATE_ENTRY;
+
+static struct {
+    pthread_mutex_t lock;
+    TEMPLATE_ENTRY *entries;
+    uint32_t        cap;        // power of 2
+    uint32_t        used;
+    uint64_t        hits;
+    uint64_t        misses;
+} g_templates = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0 };
+
+
+static TEMPLATE_ENTRY *global_find(const uint8_t *guid, uint64_t hash)
+{
+    if (!g_templates.entries) return NULL;
+
+    uint32_t mask = g_templates.cap - 1;
+    for (uint32_t n = (uint32_t)hash & mask; ; n = (n + 1) & mask) {
+        TEMPLATE_ENTRY *e = &g_templates.entries[n];
+        if (!e->used) return e;
+        if (e->hash == hash && memcmp(e->guid, guid, 16) == 0) return e;
+    }
+}
+
+
+static int global_grow(void)
+{
+    uint32_t cap = g_templates.cap ? g_templates.cap * 2 : 256;
+    TEMPLATE_ENTRY *entries = calloc(cap, sizeof(TEMPLATE_ENTRY));
+    if (!entries) return -1;
+
+    TEMPLATE_ENTRY *old = g_templates.entries;
+    uint32_t old_cap = g_templates.cap;
+
+    g_templates.entries = entries;
+    g_templates.cap = cap;
+    for (uint32_t n = 0; n < old_cap; n++) {
+        if (old[n].used) {
+            *global_find(old[n].guid, old[n].hash) = old[n];
+        }
+    }
+    free(old);
+
+    return 0;
+}
+
+
+// find the compiled template in the process wide cache, compile and add it if missing
+static const EVTX_TEMPLATE *global_get(EVTX_CHUNK_CTX *ctx, uint32_t template_offset)
+{
+    const uint8_t *guid = &ctx->chunk_buffer[template_offset + 4];
+    uint64_t hash = template_hash(ctx, template_offset);
+
+    pthread_mutex_lock(&g_templates.lock);
+    TEMPLATE_ENTRY *e = global_find(guid, hash);
+    if (e && e->used) {
+        g_templates.hits++;
+        const EVTX_TEMPLATE *tpl = e->tpl;
+        pthread_mutex_unlock(&g_templates.lock);
+        return tpl;
+    }
+    g_templates.misses++;
+    pthread_mutex_unlock(&g_templates.lock);
+
+    // compile without holding the lock, another thread may do the same
+    EVTX_TEMPLATE *tpl = evtx_template_compile(ctx, template_offset);
+    if (tpl) tpl->hash = hash;
+
+    pthread_mutex_lock(&g_templates.lock);
+    e = global_find(guid, hash);
+    if (e && e->used) {
+        // lost the race, use the one already there
+        evtx_template_free(tpl);
+        tpl = e->tpl;
+    } else if ((g_templates.used + 1) * 2 > g_templates.cap && global_grow() != 0) {
+        // out of memory: do not cache, and do not leak
+        evtx_template_free(tpl);
+        tpl = NULL;
+    } else {
+        e = global_find(guid, hash);
+        memcpy(e->guid, guid, 16);
+        e->hash = hash;
+        e->used = 1;
+        e->tpl  = tpl;
+        g_templates.used++;
+    }
+    pthread_mutex_unlock(&g_templates.lock);
+
+    return tpl;
+}
+
+
+void evtx_template_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+    pthread_mutex_lock(&g_templates.lock);
+    *hits   = g_templates.hits;
+    *misses = g_templates.misses;
+    pthread_mutex_unlock(&g_templates.lock);
+}
+
+
+void evtx_template_cache_free_all(void)
+{
+    pthread_mutex_lock(&g_templates.lock);
+    for (uint32_t n = 0; n < g_templates.cap; n++) {
+        evtx_template_free(g_templates.entries[n].tpl);
+    }
+    free(g_templates.entries);
+    g_templates.entries = NULL;
+    g_templates.cap  = 0;
+    g_templates.used = 0;
+    pthread_mutex_unlock(&g_templates.lock);
+}
+
+
+
+
+// ------------------------------------------------------------
+// per-chunk cache
+// ------------------------------------------------------------
+
+// find the slot of template_offset, or the empty slot where it should go
+static EVTX_TEMPLATE_SLOT *template_cache_slot(EVTX_TEMPLATE_CACHE *cache, uint32_t template_offset)
+{
+    uint32_t h = (template_offset >> 3) & (EVTX_TEMPLATE_SLOTS - 1);
+
+    for (uint32_t n = 0; n < EVTX_TEMPLATE_SLOTS; n++) {
+        EVTX_TEMPLATE_SLOT *slot = &cache->slots[(h + n) & (EVTX_TEMPLATE_SLOTS - 1)];
+        if (slot->offset == template_offset || slot->offset == 0) {
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+
+static EVTX_TEMPLATE_SLOT *template_cache_add(EVTX_TEMPLATE_CACHE *cache, uint32_t template_offset)
+{
+    EVTX_TEMPLATE_SLOT *slot = template_cache_slot(cache, template_offset);
+    if (!slot) return NULL;
+
+    if (slot->offset == 0) {
+        if (cache->used >= EVTX_TEMPLATE_MAX_USED) return NULL;
+        slot->offset = template_offset;
+        cache->used++;
+    }
+    return slot;
+}
+
+
+// register every template definition of the chunk header: 32 hash buckets, each a chain by next_offset
+static void template_cache_build(EVTX_CHUNK_CTX *ctx)
+{
+    EVTX_CHUNK_HEADER *ch = (EVTX_CHUNK_HEADER *)ctx->chunk_buffer;
+
+    for (int i = 0; i < 32; i++) {
+        uint32_t offset = ch->template_ptr_array[i];
+        uint32_t hops = 0;
+
+        while (offset > 0 && offset + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER) <= EVTX_CHUNK_SIZE
+                          && hops++ < EVTX_TEMPLATE_MAX_USED) {
+            if (!template_cache_add(&ctx->templates, offset)) return;
+
+            EVTX_TEMPLATE_DEFINITION_HEADER *th =
+                (EVTX_TEMPLATE_DEFINITION_HEADER *)&ctx->chunk_buffer[offset];
+            offset = th->next_offset;
+        }
+    }
+
+    ctx->templates.ready = 1;
+}
+
+
+
+const EVTX_TEMPLATE *evtx_template_get(EVTX_CHUNK_CTX *ctx, uint32_t template_offset)
+{
+    EVTX_TEMPLATE_CACHE *cache = &ctx->templates;
+
+    if (!cache->ready) {
+        template_cache_build(ctx);
+    }
+
+    // the definition and its BinXML must be inside the chunk
+    if (template_offset + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER) > EVTX_CHUNK_SIZE) {
+        return NULL;
+    }
+    EVTX_TEMPLATE_DEFINITION_HEADER *th =
+        (EVTX_TEMPLATE_DEFINITION_HEADER *)&ctx->chunk_buffer[template_offset];
+    if (template_offset + sizeof(EVTX_TEMPLATE_DEFINITION_HEADER) + th->data_size > EVTX_CHUNK_SIZE) {
+        return NULL;
+    }
+
+    // also works for templates missing from template_ptr_array
+    EVTX_TEMPLATE_SLOT *slot = template_cache_add(cache, template_offset);
+    if (!slot) {
+        return global_get(ctx, template_offset);    // chunk cache full
+    }
+
+    if (!slot->tpl && !slot->failed) {
+        slot->tpl = global_get(ctx, template_offset);
+        if (!slot->tpl) slot->failed = 1;
+    }
+
+    return slot->tpl;
+}
+
+
+
+void evtx_template_cache_clear(EVTX_TEMPLATE_CACHE *cache)
+{
+    // the templates themselves belong to the process wide cache
+    memset(cache, 0, sizeof(*cache));
+}
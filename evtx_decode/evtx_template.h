@@ -0,0 +1,129 @@
+/* evtx_template.h
+ *
+ * Compiled templates.
+ *
+ * A template definition is plain BinXML (element names by offset, inline
+ * names, static values and %n substitutions). Most records of a chunk share
+ * a handful of templates, so each template is parsed once and lowered into
+ * a small program (see EVTX_OP below) with every element and attribute name
+ * already converted to UTF-8. Rendering a record is then a run of that
+ * program against the value table of the record.
+ *
+ * Two levels of caching:
+ *   - per chunk, keyed by the template offset (no locking, lives in EVTX_CHUNK_CTX)
+ *   - process wide, keyed by the 16-byte template GUID and a hash of the
+ *     template BinXML, shared by all chunks, files and threads
+ */
+
+#if !defined( EVTX_TEMPLATE_H )
+#define EVTX_TEMPLATE_H
+
+#include <stdint.h>
+
+
+// ------------------------------------------------------------
+// template program
+// ------------------------------------------------------------
+// A template is lowered into a flat array of EVTX_OP:
+//
+//     OPEN(name_id)              <Name
+//     ATTR(name_id)               Name=
+//     VALUE                      static text of the template
+//     SUBST(index, type)         value %index of the record
+//     SUBST_OPT(index, type)     same, optional substitution
+//     CLOSE_START                >
+//     CLOSE_EMPTY                />
+//     CLOSE(name_id)             </Name>
+//
+// The printed form of every op is precomputed into EVTX_TEMPLATE.text, in op
+// order, so a run of ops without substitution is one contiguous piece of text:
+// the printer writes the whole run at once (run_len bytes) and skips run_ops ops.
+
+enum {
+    EVTX_OP_OPEN = 1,
+    EVTX_OP_ATTR,
+    EVTX_OP_VALUE,
+    EVTX_OP_SUBST,
+    EVTX_OP_SUBST_OPT,
+    EVTX_OP_CLOSE_START,
+    EVTX_OP_CLOSE_EMPTY,
+    EVTX_OP_CLOSE,
+};
+
+typedef struct _EVTX_OP {
+    uint8_t  code;          // EVTX_OP_*
+    uint8_t  value_type;    // SUBST: value type in the template, VALUE: 0x00 null or 0x01 string
+    uint16_t arg;           // OPEN/ATTR/CLOSE: name id, SUBST: value index
+    uint16_t text_len;      // printed form of this op
+    uint16_t run_ops;       // static run starting at this op (0 for SUBST)
+    uint32_t text_off;
+    uint32_t run_len;
+} EVTX_OP;
+
+typedef struct _EVTX_NAME {
+    uint32_t off;           // in EVTX_TEMPLATE.names_buf, NULL terminated
+    uint32_t len;
+} EVTX_NAME;
+
+typedef struct _EVTX_TEMPLATE {
+    uint8_t  guid[16];              // template_id + unknown_guid of the definition header
+    uint32_t template_id;
+    uint32_t data_size;             // size of the template BinXML
+    uint64_t hash;                  // see template_hash()
+
+    uint32_t op_count;
+    EVTX_OP *ops;
+
+    uint32_t   name_count;          // distinct element and attribute names
+    EVTX_NAME *names;
+    char      *names_buf;
+
+    char    *text;                  // printed form of the ops, see above
+    uint32_t text_size;
+
+    uint32_t  subs_count;           // substitution points, as index into ops
+    uint32_t *subs;
+
+    int32_t   evtid_op;             // the op giving the text of <System><EventID>
+                                    // (SUBST or VALUE), -1 if there is none
+} EVTX_TEMPLATE;
+
+#define TEMPLATE_NAME(tpl, id)      (&(tpl)->names_buf[(tpl)->names[id].off])
+#define TEMPLATE_OP_TEXT(tpl, op)   (&(tpl)->text[(op)->text_off])
+
+
+// per-chunk cache, open addressing keyed by the template offset
+#define EVTX_TEMPLATE_SLOTS     256     // power of 2
+#define EVTX_TEMPLATE_MAX_USED  192     // keep the table sparse
+
+typedef struct _EVTX_TEMPLATE_SLOT {
+    uint32_t       offset;          // 0 = empty slot
+    uint32_t       failed;          // could not be compiled, use the raw BinXML walker
+    const EVTX_TEMPLATE *tpl;       // NULL until the first record uses it, owned by the global cache
+} EVTX_TEMPLATE_SLOT;
+
+typedef struct _EVTX_TEMPLATE_CACHE {
+    int       ready;                // template_ptr_array already walked
+    uint32_t  used;
+    EVTX_TEMPLATE_SLOT slots[EVTX_TEMPLATE_SLOTS];
+} EVTX_TEMPLATE_CACHE;
+
+
+struct _EVTX_CHUNK_CTX;
+
+// get the compiled template defined at template_offset of the current chunk
+// NULL if it can not be compiled (unsupported tokens), the caller falls back to the raw walker
+const EVTX_TEMPLATE *evtx_template_get(struct _EVTX_CHUNK_CTX *ctx, uint32_t template_offset);
+
+// forget the templates of the chunk, called when a chunk is done
+void evtx_template_cache_clear(EVTX_TEMPLATE_CACHE *cache);
+
+// lookups of the process wide cache (one per template per chunk)
+void evtx_template_cache_stats(uint64_t *hits, uint64_t *misses);
+
+// free the process wide cache, no decoding may run at the same time
+void evtx_template_cache_free_all(void);
+
+void evtx_template_free(EVTX_TEMPLATE *tpl);
+
+#endif /* !defined( EVTX_TEMPLATE_H ) */
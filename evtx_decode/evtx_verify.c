@@ -0,0 +1,74 @@
+/* evtx_verify.c
+ *
+ * --verify, see evtx_verify.h
+ */
+
+
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "evtx_verify.h"
+#include "evtx_chunk.h"
+#include "crc32.h"
+
+
+// the checksum covers the header up to the flags (120 bytes)
+#define EVTX_HEADER_CRC_SIZE    0x78
+
+
+int evtx_verify_file_header(OUT_SINK *out, const char *path, const EVTX_FILE_HEADER *fh)
+{
+    uint32_t crc = crc32_update(0, fh, EVTX_HEADER_CRC_SIZE);
+    if (crc == fh->checksum) return EVTX_VERIFY_OK;
+
+    out_printf(out, "%s: file header at 0x00000000: checksum %08" PRIx32 ", computed %08" PRIx32 "\n",
+               path, fh->checksum, crc);
+    return EVTX_VERIFY_CORRUPT;
+}
+
+
+int evtx_verify_chunk(OUT_SINK *out, const char *path, const uint8_t *chunk, uint32_t chunk_index)
+{
+    const EVTX_CHUNK_HEADER *ch = (const EVTX_CHUNK_HEADER *)chunk;
+    uint64_t offset = EVTX_CHUNK_START_OFFSET + (uint64_t)chunk_index * EVTX_CHUNK_SIZE;
+
+    if (memcmp(ch->signature, EVTX_CHUNK_SIGNATURE, sizeof(EVTX_CHUNK_SIGNATURE)) != 0) {
+        for (uint32_t i = 0; i < EVTX_CHUNK_SIZE; i++) {
+            if (chunk[i] != 0) {
+                if (out) out_printf(out, "%s: chunk #%" PRIu32 " at 0x%08" PRIx64 ": no chunk signature\n",
+                                    path, chunk_index, offset);
+                return EVTX_VERIFY_CORRUPT;
+            }
+        }
+        return EVTX_VERIFY_EMPTY;
+    }
+    int rtn_code = EVTX_VERIFY_OK;
+
+    // the header without its checksum field, then the string and template offset tables
+    uint32_t crc = crc32_update(0, chunk, EVTX_HEADER_CRC_SIZE);
+    size_t tables = offsetof(EVTX_CHUNK_HEADER, string_offset_array);
+    crc = crc32_update(crc, chunk + tables, sizeof(EVTX_CHUNK_HEADER) - tables);
+    if (crc != ch->checksum) {
+        if (out) out_printf(out, "%s: chunk #%" PRIu32 " at 0x%08" PRIx64 ": header checksum %08" PRIx32 ", computed %08" PRIx32 "\n",
+                            path, chunk_index, offset, ch->checksum, crc);
+        rtn_code = EVTX_VERIFY_CORRUPT;
+    }
+
+    // the records, up to the free space
+    uint32_t end = ch->free_space_offset;
+    if (end < sizeof(EVTX_CHUNK_HEADER) || end > EVTX_CHUNK_SIZE) {
+        if (out) out_printf(out, "%s: chunk #%" PRIu32 " at 0x%08" PRIx64 ": free space offset 0x%" PRIx32 " is outside the chunk\n",
+                            path, chunk_index, offset, end);
+        return EVTX_VERIFY_CORRUPT;
+    }
+    crc = crc32_update(0, chunk + sizeof(EVTX_CHUNK_HEADER), end - sizeof(EVTX_CHUNK_HEADER));
+    if (crc != ch->data_checksum) {
+        if (out) out_printf(out, "%s: chunk #%" PRIu32 " at 0x%08" PRIx64 ": data checksum %08" PRIx32 ", computed %08" PRIx32 "\n",
+                            path, chunk_index, offset, ch->data_checksum, crc);
+        rtn_code = EVTX_VERIFY_CORRUPT;
+    }
+
+    return rtn_code;
+}
@@ -0,0 +1,36 @@
+/* evtx_verify.h
+ *
+ * --verify: check the CRC32 checksums of an EVTX file instead of decoding it.
+ *
+ *     file header    checksum       bytes 0x00-0x77 of the file header
+ *     chunk header   checksum       bytes 0x00-0x77 and 0x80-0x1ff of the chunk
+ *     chunk records  data_checksum  bytes 0x200 up to free_space_offset
+ *
+ * Only the CRCs are computed (crc32.h), no record is decoded, so a file is
+ * checked about as fast as it can be read. The files and their chunks are
+ * spread over the -j threads by batch mode (evtx_batch.h). A line is printed
+ * for every broken header / chunk, with its offset in the file.
+ */
+
+#if !defined( EVTX_VERIFY_H )
+#define EVTX_VERIFY_H
+
+#include <stdint.h>
+
+#include "evtx_file.h"
+#include "out_sink.h"
+
+
+// what was found in a chunk
+#define EVTX_VERIFY_OK          0
+#define EVTX_VERIFY_CORRUPT     1
+#define EVTX_VERIFY_EMPTY       2   // never written (all zero), not an error
+
+// 0 or EVTX_VERIFY_CORRUPT, the problem is printed to out with path
+int evtx_verify_file_header(OUT_SINK *out, const char *path, const EVTX_FILE_HEADER *fh);
+
+// chunk is the whole 64KB chunk #chunk_index of the file, an EVTX_VERIFY_* value.
+// out NULL: nothing is printed, just the check
+int evtx_verify_chunk(OUT_SINK *out, const char *path, const uint8_t *chunk, uint32_t chunk_index);
+
+#endif /* !defined( EVTX_VERIFY_H ) */
@@ -4,11 +4,16 @@
 // NOT a full XML implementation.
 //
 // Memory model:
-//   - xml_new_tree() allocates an empty tree (root=NULL)
-//   - xml_new_element() allocates a node and duplicates strings
-//   - xml_add_attribute() appends to a dynamic array
+//   - xml_new_tree() allocates an empty tree (root=NULL) with its own arena
+//   - xml_new_element() takes a node from the tree arena and copies strings there
+//   - xml_add_attribute() appends to an array which doubles in the arena
 //   - xml_add_child() appends child in O(1) using last_child
-//   - xml_free_tree() frees everything recursively
+//   - xml_reset_tree() / xml_free_tree() drop the whole arena, no walk over the nodes
+//
+// Building from a stream of tokens (BinXML) uses the xml_build_*() calls,
+// which keep the open element in tree->cursor.
+//
+// All dumps write to an OUT_SINK.
 //
 
 #include "evtx_xmltree.h"
@@ -16,20 +21,18 @@
 #include <string.h>   // strlen, memcpy
 #include <stdio.h>    // optional (not required), but handy for debugging
 
-#define BINXML_VALUE_NULL 0x00
-
 // -------------------------
 // Internal helpers
 // -------------------------
 
-static void xml_dump_indent(int depth)
+static void xml_dump_indent(OUT_SINK *out, int depth)
 {
     for (int i = 0; i < depth; i++)
-        fputs("  ", stdout);
+        out_puts(out, "  ");
 }
 
 
-static void xml_dump_attrs(XML_ELEMENT *e)
+static void xml_dump_attrs(OUT_SINK *out, XML_ELEMENT *e)
 {
     for (uint16_t i = 0; i < e->attr_count; i++) {
         XML_ATTRIBUTE *a = &e->attrs[i];
@@ -37,7 +40,6 @@ static void xml_dump_attrs(XML_ELEMENT *e)
 
         // NULL value type は出力しない（EventViewerの <Correlation /> など）
         if (a->value_type == BINXML_VALUE_NULL) {
-            //printf("\nDEBUG: Attribute Name:%s Value:\"%s\" value_type=0x%x\n", a->name, a->value, a->value_type);
             continue;
         }
 
@@ -46,173 +48,160 @@ static void xml_dump_attrs(XML_ELEMENT *e)
             continue;
         }
 
-        printf(" %s=\"%s\"", a->name, a->value);
+        out_putc(out, ' ');
+        out_puts(out, a->name);
+        out_puts(out, "=\"");
+        out_xml_escaped(out, a->value, strlen(a->value));
+        out_putc(out, '"');
     }
 }
 
 
-static char *xml_strdup(const char *s)
+static char *xml_strdup(XML_TREE *tree, const char *s)
 {
     if (!s) return NULL;
-    size_t n = strlen(s);
-    char *p = (char *)malloc(n + 1);
-    if (!p) return NULL;
-    memcpy(p, s, n + 1);
-    return p;
+    return arena_strdup(&tree->arena, s);
 }
 
 
-static void xml_free_element(XML_ELEMENT *elem)
-{
-    if (!elem) return;
-
-    // free children
-    XML_ELEMENT *child = elem->first_child;
-    while (child) {
-        XML_ELEMENT *next = child->next_sibling;
-        xml_free_element(child);
-        child = next;
-    }
-
-    // free attributes
-    for (uint16_t i = 0; i < elem->attr_count; i++) {
-        free(elem->attrs[i].name);
-        free(elem->attrs[i].value);
-    }
-    free(elem->attrs);
-
-    // free strings
-    free(elem->name);
-    free(elem->text);
-
-    // free element itself
-    free(elem);
-}
+#define XML_FIRST_ATTRS  4
 
-static void xml_dump_element_pretty(XML_ELEMENT *e, int depth)
+static void xml_dump_element_pretty(OUT_SINK *out, XML_ELEMENT *e, int depth)
 {
     if (!e) return;
 
-    xml_dump_indent(depth);
-    printf("<%s", e->name);
-    xml_dump_attrs(e);
+    xml_dump_indent(out, depth);
+    out_putc(out, '<');
+    out_puts(out, e->name);
+    xml_dump_attrs(out, e);
 
     // self-closing
     if (!e->first_child && !e->text) {
-        puts(" />");
+        out_puts(out, " />\n");
         return;
     }
 
-    puts(">");
+    // text only, on the same line
+    if (!e->first_child) {
+        out_putc(out, '>');
+        out_xml_escaped(out, e->text, strlen(e->text));
+        out_puts(out, "</");
+        out_puts(out, e->name);
+        out_puts(out, ">\n");
+        return;
+    }
+
+    out_puts(out, ">\n");
 
     // text
     if (e->text) {
-        xml_dump_indent(depth + 1);
-        puts(e->text);
+        xml_dump_indent(out, depth + 1);
+        out_xml_escaped(out, e->text, strlen(e->text));
+        out_putc(out, '\n');
     }
 
     // children
     for (XML_ELEMENT *c = e->first_child; c; c = c->next_sibling) {
-        xml_dump_element_pretty(c, depth + 1);
+        xml_dump_element_pretty(out, c, depth + 1);
     }
 
-    xml_dump_indent(depth);
-    printf("</%s>\n", e->name);
-}
-
-static void xml_dump_element(XML_ELEMENT *elem)
-{
-    xml_dump_element_pretty(elem, 0);
+    xml_dump_indent(out, depth);
+    out_puts(out, "</");
+    out_puts(out, e->name);
+    out_puts(out, ">\n");
 }
 
-static void xml_dump_element_compact_rec(XML_ELEMENT *e)
+static void xml_dump_element_compact_rec(OUT_SINK *out, XML_ELEMENT *e)
 {
     if (!e) return;
 
-    printf("<%s", e->name);
-    xml_dump_attrs(e);
+    out_putc(out, '<');
+    out_puts(out, e->name);
+    xml_dump_attrs(out, e);
 
     if (!e->first_child && !e->text) {
-        printf("/>");
+        out_puts(out, "/>");
         return;
     }
 
-    printf(">");
+    out_putc(out, '>');
 
     if (e->text)
-        fputs(e->text, stdout);
+        out_xml_escaped(out, e->text, strlen(e->text));
 
     for (XML_ELEMENT *c = e->first_child; c; c = c->next_sibling)
-        xml_dump_element_compact_rec(c);
+        xml_dump_element_compact_rec(out, c);
 
-    printf("</%s>", e->name);
+    out_puts(out, "</");
+    out_puts(out, e->name);
+    out_putc(out, '>');
 }
 
 
-static void xml_print_attribute(const XML_ATTRIBUTE *a)
+static void xml_emit_kv(OUT_SINK *out, const char *key1, const char *key2, const char *value)
 {
-    if (!a) return;
-
-    if (a->value_type == BINXML_VALUE_NULL) {
-        return; // ← 出力しない
+    if (!key1 || !value) return;
+    out_puts(out, key1);
+    if (key2) {
+        out_putc(out, '.');
+        out_puts(out, key2);
     }
-
-    printf(" %s=\"%s\"", a->name, a->value);
+    out_puts(out, ": ");
+    out_puts(out, value);
+    out_putc(out, '\n');
 }
 
-
-static void xml_print_text(const XML_ELEMENT *e)
+static void xml_dump_element_text(OUT_SINK *out, XML_ELEMENT *e)
 {
-    if (!e || !e->text) return;
+    if (!e) return;
 
-    if (e->text_type == BINXML_VALUE_NULL) {
-        return;
+    // <Data Name="TargetUserName">SYSTEM</Data> は TargetUserName: SYSTEM にする
+    const char *key = e->name;
+    const XML_ATTRIBUTE *key_attr = NULL;
+    if (e->text && e->text[0] != '\0') {
+        for (uint16_t i = 0; i < e->attr_count; i++) {
+            if (e->attrs[i].value && strcmp(e->attrs[i].name, "Name") == 0) {
+                key_attr = &e->attrs[i];
+                key = key_attr->value;
+                break;
+            }
+        }
     }
 
-    printf("%s", e->text);
-}
-
-
-
-static void xml_dump_element_compact(XML_ELEMENT *elem)
-{
-    xml_dump_element_compact_rec(elem);
-    putchar('\n');
-}
-
-
-static void xml_emit_kv(const char *key, const char *value)
-{
-    if (!key || !value) return;
-    printf("%s: %s\n", key, value);
-}
-
-static void xml_dump_element_text(XML_ELEMENT *e)
-{
-    if (!e) return;
-
     // 1) element text
     if (e->text && e->text[0] != '\0') {
-        xml_emit_kv(e->name, e->text);
+        xml_emit_kv(out, key, NULL, e->text);
     }
 
     // 2) attributes
     for (uint16_t i = 0; i < e->attr_count; i++) {
-        char key[512];
-
-        snprintf(key, sizeof(key),
-                 "%s.%s", e->name, e->attrs[i].name);
-
-        xml_emit_kv(key, e->attrs[i].value);
+        if (&e->attrs[i] == key_attr) continue;
+        xml_emit_kv(out, e->name, e->attrs[i].name, e->attrs[i].value);
     }
 
     // 3) children
     for (XML_ELEMENT *c = e->first_child; c; c = c->next_sibling) {
-        xml_dump_element_text(c);
+        xml_dump_element_text(out, c);
     }
 }
 
 
+// append len bytes to *dst, the old string stays in the arena
+static int xml_append(XML_TREE *tree, char **dst, const char *s, size_t len)
+{
+    size_t old = *dst ? strlen(*dst) : 0;
+
+    char *p = arena_alloc_align(&tree->arena, old + len + 1, 1);
+    if (!p) return -1;
+
+    if (old) memcpy(p, *dst, old);
+    memcpy(p + old, s, len);
+    p[old + len] = '\0';
+    *dst = p;
+    return 0;
+}
+
+
 
 
 
@@ -223,20 +212,18 @@ static void xml_dump_element_text(XML_ELEMENT *e)
 // Public APIs for XML_ATTRIBUTE
 // -------------------------
 
-XML_ATTRIBUTE *xml_new_attribute(const char *name)
+XML_ATTRIBUTE *xml_new_attribute(XML_TREE *tree, const char *name)
 {
-    if (!name)
+    if (!tree || !name)
         return NULL;
 
-    XML_ATTRIBUTE *a = (XML_ATTRIBUTE *)calloc(1, sizeof(XML_ATTRIBUTE));
+    XML_ATTRIBUTE *a = (XML_ATTRIBUTE *)arena_alloc(&tree->arena, sizeof(XML_ATTRIBUTE));
     if (!a)
         return NULL;
 
-    a->name = xml_strdup(name);
-    if (!a->name) {
-        free(a);
+    a->name = xml_strdup(tree, name);
+    if (!a->name)
         return NULL;
-    }
 
     a->value = NULL;
     a->value_type = 0xFF;   // undefined yet
@@ -244,21 +231,16 @@ XML_ATTRIBUTE *xml_new_attribute(const char *name)
     return a;
 }
 
-int xml_set_attribute(XML_ATTRIBUTE *attr, const char *value, uint8_t value_type)
+int xml_set_attribute(XML_TREE *tree, XML_ATTRIBUTE *attr, const char *value, uint8_t value_type)
 {
-    if (!attr)
+    if (!tree || !attr)
         return -1;
 
-    // free previous value if any
-    if (attr->value) {
-        free(attr->value);
-        attr->value = NULL;
-    }
-
+    // a previous value just stays in the arena until the reset
     attr->value_type = value_type;
 
     if (value_type != 0x00 && value) {   // 0x00 = NULL type
-        attr->value = xml_strdup(value);
+        attr->value = xml_strdup(tree, value);
         if (!attr->value)
             return -1;
     } else {
@@ -280,32 +262,24 @@ int xml_set_attribute(XML_ATTRIBUTE *attr, const char *value, uint8_t value_type
 // Public APIs for XML_ELEMENT
 // -------------------------
 
-XML_ELEMENT *xml_new_element(const char *name)
+XML_ELEMENT *xml_new_element(XML_TREE *tree, const char *name)
 {
-    if (!name) return NULL;
+    if (!tree || !name) return NULL;
 
-    XML_ELEMENT *e = (XML_ELEMENT *)calloc(1, sizeof(XML_ELEMENT));
+    XML_ELEMENT *e = (XML_ELEMENT *)arena_calloc(&tree->arena, 1, sizeof(XML_ELEMENT));
     if (!e) return NULL;
 
-    e->name = xml_strdup(name);
-    if (!e->name) {
-        free(e);
-        return NULL;
-    }
+    e->name = xml_strdup(tree, name);
+    if (!e->name) return NULL;
 
-    // text=NULL, attrs=NULL, counts=0, links=NULL by calloc
+    // text=NULL, attrs=NULL, counts=0, links=NULL by arena_calloc
     return e;
 }
 
 
-int xml_set_element(XML_ELEMENT *elem, const char *text, uint8_t text_type)
+int xml_set_element(XML_TREE *tree, XML_ELEMENT *elem, const char *text, uint8_t text_type)
 {
-    if (!elem) return -1;
-
-    if (elem->text) {
-        free(elem->text);
-        elem->text = NULL;
-    }
+    if (!tree || !elem) return -1;
 
     elem->text_type = text_type;
 
@@ -314,33 +288,40 @@ int xml_set_element(XML_ELEMENT *elem, const char *text, uint8_t text_type)
         return 0;
     }
 
-    elem->text = xml_strdup(text);
+    elem->text = xml_strdup(tree, text);
     return (elem->text != NULL) ? 0 : -1;
 }
 
 
-int xml_add_attribute(XML_ELEMENT *elem, XML_ATTRIBUTE *attr)
+int xml_add_attribute(XML_TREE *tree, XML_ELEMENT *elem, XML_ATTRIBUTE *attr)
 {
-    if (!elem || !attr)
+    if (!tree || !elem || !attr)
         return -1;
 
-    XML_ATTRIBUTE *new_attrs =
-        (XML_ATTRIBUTE *)realloc(elem->attrs,
-                                 (elem->attr_count + 1) * sizeof(XML_ATTRIBUTE));
-    if (!new_attrs)
-        return -1;
+    if (elem->attr_count == elem->attr_cap) {
+        // 配列を倍にする、古い配列は arena に残るだけ
+        uint32_t cap = elem->attr_cap ? (uint32_t)elem->attr_cap * 2 : XML_FIRST_ATTRS;
+        if (cap > UINT16_MAX) cap = UINT16_MAX;
+        if (cap == elem->attr_count)
+            return -1;
 
-    elem->attrs = new_attrs;
+        XML_ATTRIBUTE *new_attrs =
+            (XML_ATTRIBUTE *)arena_alloc(&tree->arena, cap * sizeof(XML_ATTRIBUTE));
+        if (!new_attrs)
+            return -1;
+
+        if (elem->attr_count)
+            memcpy(new_attrs, elem->attrs, elem->attr_count * sizeof(XML_ATTRIBUTE));
+        elem->attrs = new_attrs;
+        elem->attr_cap = (uint16_t)cap;
+    }
 
     // Copy struct contents (shallow copy is OK —
-    // name/value pointers move into element ownership)
+    // name/value live in the tree arena anyway)
     elem->attrs[elem->attr_count] = *attr;
 
     elem->attr_count++;
 
-    // free only container struct, not name/value
-    free(attr);
-
     return 0;
 }
 
@@ -380,42 +361,146 @@ XML_ELEMENT *xml_find_child(XML_ELEMENT *parent, const char *name)
 // -------------------------
 // Public APIs for XML_TREE
 // -------------------------
+void xml_init_tree(XML_TREE *tree)
+{
+    tree->root    = NULL;
+    tree->cursor  = NULL;
+    tree->pending = NULL;
+    arena_init(&tree->arena, 0);
+}
+
+void xml_release_tree(XML_TREE *tree)
+{
+    tree->root    = NULL;
+    tree->cursor  = NULL;
+    tree->pending = NULL;
+    arena_free(&tree->arena);
+}
+
+void xml_reset_tree(XML_TREE *tree)
+{
+    if (!tree) return;
+    tree->root    = NULL;
+    tree->cursor  = NULL;
+    tree->pending = NULL;
+    arena_reset(&tree->arena);
+}
+
 XML_TREE *xml_new_tree(void)
 {
-    XML_TREE *t = (XML_TREE *)calloc(1, sizeof(XML_TREE));
-    // calloc initializes root=NULL
+    XML_TREE *t = (XML_TREE *)malloc(sizeof(XML_TREE));
+    if (t) xml_init_tree(t);
     return t;
 }
 
 void xml_free_tree(XML_TREE *tree)
 {
     if (!tree) return;
-    xml_free_element(tree->root);
+    xml_release_tree(tree);
     free(tree);
 }
 
-void xml_dump_tree(XML_TREE *tree)
+// -------------------------
+// Public APIs for building a tree token by token
+// -------------------------
+
+// a pending attribute is added when its value is known (or the start tag is closed)
+static void xml_build_flush_attr(XML_TREE *tree)
 {
-    if (!tree || !tree->root) return;
-    xml_dump_element(tree->root);
+    if (tree->pending && tree->cursor) {
+        xml_add_attribute(tree, tree->cursor, tree->pending);
+    }
+    tree->pending = NULL;
 }
 
-void xml_dump_tree_compact(XML_TREE *tree)
+XML_ELEMENT *xml_build_open(XML_TREE *tree, const char *name)
 {
-    if (!tree || !tree->root) return;
-    xml_dump_element_compact(tree->root);
+    xml_build_flush_attr(tree);
+
+    XML_ELEMENT *e = xml_new_element(tree, name);
+    if (!e) return NULL;
+
+    if (tree->cursor) {
+        xml_add_child(tree->cursor, e);
+    } else if (!tree->root) {
+        tree->root = e;
+    } else {
+        // a second top level element, keep it as a sibling of the root
+        XML_ELEMENT *last = tree->root;
+        while (last->next_sibling) last = last->next_sibling;
+        last->next_sibling = e;
+    }
+    tree->cursor = e;
+    return e;
 }
 
+int xml_build_attr(XML_TREE *tree, const char *name)
+{
+    xml_build_flush_attr(tree);
+    if (!tree->cursor) return -1;
+
+    tree->pending = xml_new_attribute(tree, name);
+    return tree->pending ? 0 : -1;
+}
 
-void xml_dump_tree_text(XML_TREE *tree)
+int xml_build_value(XML_TREE *tree, const char *text, size_t len, uint8_t value_type)
 {
-    if (!tree || !tree->root) return;
-    xml_dump_element_text(tree->root);
+    if (tree->pending) {
+        XML_ATTRIBUTE *a = tree->pending;
+        if (text && value_type != BINXML_VALUE_NULL) {
+            if (xml_append(tree, &a->value, text, len) != 0) return -1;
+            a->value_type = value_type;
+        } else if (!a->value) {
+            a->value_type = BINXML_VALUE_NULL;
+        }
+        return 0;
+    }
+
+    XML_ELEMENT *e = tree->cursor;
+    if (!e) return -1;
+
+    if (text && value_type != BINXML_VALUE_NULL) {
+        if (xml_append(tree, &e->text, text, len) != 0) return -1;
+        e->text_type = value_type;
+    } else if (!e->text) {
+        e->text_type = value_type;
+    }
+    return 0;
 }
 
+void xml_build_close_start(XML_TREE *tree)
+{
+    xml_build_flush_attr(tree);
+}
 
+void xml_build_close(XML_TREE *tree)
+{
+    xml_build_flush_attr(tree);
+    if (tree->cursor) tree->cursor = tree->cursor->parent;
+}
 
 
 
 
+void xml_dump_tree(OUT_SINK *out, XML_TREE *tree)
+{
+    if (!tree) return;
+    for (XML_ELEMENT *e = tree->root; e; e = e->next_sibling)
+        xml_dump_element_pretty(out, e, 0);
+}
 
+void xml_dump_tree_compact(OUT_SINK *out, XML_TREE *tree)
+{
+    if (!tree || !tree->root) return;
+    for (XML_ELEMENT *e = tree->root; e; e = e->next_sibling)
+        xml_dump_element_compact_rec(out, e);
+    out_putc(out, '\n');
+}
+
+
+void xml_dump_tree_text(OUT_SINK *out, XML_TREE *tree)
+{
+    if (!tree) return;
+    for (XML_ELEMENT *e = tree->root; e; e = e->next_sibling)
+        xml_dump_element_text(out, e);
+}
@@ -15,10 +15,16 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "arena.h"
+#include "out_sink.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// value_type / text_type of a NULL value, which is not printed
+#define BINXML_VALUE_NULL 0x00
+
 // ------------------------------------------------------------
 // XML Attribute
 // ------------------------------------------------------------
@@ -47,6 +53,7 @@ typedef struct _XML_ELEMENT {
     uint8_t text_type;
 
     uint16_t attr_count;
+    uint16_t attr_cap;          // slots allocated in attrs
     XML_ATTRIBUTE *attrs;
 
     // tree links
@@ -61,9 +68,17 @@ typedef struct _XML_ELEMENT {
 // XML Tree (top-level owner)
 // ------------------------------------------------------------
 // One XML_TREE corresponds to one EVTX record.
+// All elements, attribute arrays and strings of the tree come from its
+// arena. Nothing is freed one by one: xml_reset_tree() drops the whole
+// tree at once and keeps the memory for the next record.
 //
 typedef struct _XML_TREE {
     XML_ELEMENT *root;          // root element (<Event>)
+    ARENA arena;
+
+    // while building with xml_build_*()
+    XML_ELEMENT   *cursor;      // the open element, new elements become its children
+    XML_ATTRIBUTE *pending;     // attribute waiting for its value
 } XML_TREE;
 
 
@@ -73,18 +88,38 @@ typedef struct _XML_TREE {
 
 XML_TREE *xml_new_tree(void);
 void      xml_free_tree(XML_TREE *tree);
-void      xml_dump_tree(XML_TREE *tree);
-void      xml_dump_tree_compact(XML_TREE *tree);
-void      xml_dump_tree_text(XML_TREE *tree);
-
-XML_ELEMENT *xml_new_element(const char *name);
-int          xml_set_element(XML_ELEMENT *e, const char *text, uint8_t text_type);
-int          xml_add_attribute(XML_ELEMENT *e, XML_ATTRIBUTE *a);
+void      xml_init_tree(XML_TREE *tree);        // a tree embedded in another struct
+void      xml_release_tree(XML_TREE *tree);     // counterpart of xml_init_tree()
+void      xml_reset_tree(XML_TREE *tree);       // empty again, O(1)
+
+// pretty XML, XML on one line (one record per line), "Name: value" lines
+void      xml_dump_tree(OUT_SINK *out, XML_TREE *tree);
+void      xml_dump_tree_compact(OUT_SINK *out, XML_TREE *tree);
+void      xml_dump_tree_text(OUT_SINK *out, XML_TREE *tree);
+
+// elements and attributes belong to the tree they were created for,
+// they are valid until the tree is reset or freed
+XML_ELEMENT *xml_new_element(XML_TREE *tree, const char *name);
+int          xml_set_element(XML_TREE *tree, XML_ELEMENT *e, const char *text, uint8_t text_type);
+int          xml_add_attribute(XML_TREE *tree, XML_ELEMENT *e, XML_ATTRIBUTE *a);
 void         xml_add_child(XML_ELEMENT *parent, XML_ELEMENT *child);
 XML_ELEMENT *xml_find_child(XML_ELEMENT *parent, const char *name);
 
-XML_ATTRIBUTE *xml_new_attribute(const char *name);
-int            xml_set_attribute(XML_ATTRIBUTE *a, const char *value, uint8_t value_type);
+XML_ATTRIBUTE *xml_new_attribute(XML_TREE *tree, const char *name);
+int            xml_set_attribute(XML_TREE *tree, XML_ATTRIBUTE *a, const char *value, uint8_t value_type);
+
+// build the tree in document order, as the BinXML tokens come:
+//   open(name)   <name     a child of the cursor, becomes the cursor
+//   attr(name)    name=    the next value goes to this attribute
+//   value(...)             attribute value or element text, appended
+//   close_start  >
+//   close        /> or </name>, the cursor goes back to the parent
+// a NULL text (or value_type 0x00) records a NULL value
+XML_ELEMENT *xml_build_open(XML_TREE *tree, const char *name);
+int          xml_build_attr(XML_TREE *tree, const char *name);
+int          xml_build_value(XML_TREE *tree, const char *text, size_t len, uint8_t value_type);
+void         xml_build_close_start(XML_TREE *tree);
+void         xml_build_close(XML_TREE *tree);
 
 
 
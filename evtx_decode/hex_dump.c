@@ -6,13 +6,16 @@
 #include <inttypes.h>
 #include <ctype.h>
 
+#include "out_sink.h"
+#include "hex_dump.h"
+
 
 #define BYTES_PER_LINE  16
 
-void hex_dump_bytes(const uint8_t *ptr, uint32_t size)
+void hex_dump_bytes(OUT_SINK *out, const uint8_t *ptr, uint32_t size)
 {
     if (size == 0) {
-        printf("    [hex_dump_bytes] size = 0, nothing to dump\n");
+        out_printf(out, "    [hex_dump_bytes] size = 0, nothing to dump\n");
         return;
     }
 
@@ -24,36 +27,36 @@ void hex_dump_bytes(const uint8_t *ptr, uint32_t size)
             remaining > BYTES_PER_LINE ? BYTES_PER_LINE : remaining;
 
         /* hex part */
-        printf("%08x  ", offset);
+        out_printf(out, "%08x  ", offset);
         for (uint32_t i = 0; i < BYTES_PER_LINE; i++) {
             if (i < line_bytes) {
-                printf("%02x ", ptr[offset + i]);
+                out_printf(out, "%02x ", ptr[offset + i]);
             } else {
-                printf("   ");
+                out_printf(out, "   ");
             }
-            if (i == (BYTES_PER_LINE / 2 - 1)) printf(" ");
+            if (i == (BYTES_PER_LINE / 2 - 1)) out_printf(out, " ");
         }
 
         /* ASCII part */
-        printf(" |");
+        out_printf(out, " |");
         for (uint32_t i = 0; i < line_bytes; i++) {
             uint8_t c = ptr[offset + i];
-            printf("%c", isprint(c) ? c : '.');
-            if (i == (BYTES_PER_LINE / 2 - 1)) printf(" ");
+            out_putc(out, isprint(c) ? (char)c : '.');
+            if (i == (BYTES_PER_LINE / 2 - 1)) out_printf(out, " ");
         }
-        printf("|\n");
+        out_printf(out, "|\n");
 
         offset += line_bytes;
     }
 }
 
 
-void hex_dump_file(FILE *fp,
+void hex_dump_file(OUT_SINK *out, FILE *fp,
                    uint32_t offset,
                    uint32_t size)
 {
     if (size == 0) {
-        printf("    [hex_dump_file] size = 0, nothing to dump\n");
+        out_printf(out, "    [hex_dump_file] size = 0, nothing to dump\n");
         return;
     }
 
@@ -70,13 +73,13 @@ void hex_dump_file(FILE *fp,
 
     size_t n = fread(buf, 1, size, fp);
     if (n != size) {
-        printf("    [hex_dump_file] fread failed or EOF "
+        out_printf(out, "    [hex_dump_file] fread failed or EOF "
                "(expected %u, got %zu)\n", size, n);
         free(buf);
         return;
     }
 
-    hex_dump_bytes(buf, size);
+    hex_dump_bytes(out, buf, size);
 
     free(buf);
 }
@@ -2,9 +2,13 @@
 #if !defined( HEX_DUMP_H )
 #define HEX_DUMP_H
 
-void hex_dump_bytes(const uint8_t *ptr, uint32_t size);
+#include <stdio.h>
+#include <stdint.h>
+#include "out_sink.h"
 
-void hex_dump_file(FILE *fp, uint32_t offset, uint32_t size);
+void hex_dump_bytes(OUT_SINK *out, const uint8_t *ptr, uint32_t size);
+
+void hex_dump_file(OUT_SINK *out, FILE *fp, uint32_t offset, uint32_t size);
 
 
 #endif
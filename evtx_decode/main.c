@@ -7,9 +7,18 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "evtx_output.h"
 #include "evtx_file.h"
+#include "evtx_template.h"
+#include "timestamp.h"
+#include "evtx_index.h"
+#include "evtx_arrow.h"
+#include "evtx_batch.h"
+#include "evtx_follow.h"
+#include "evtx_carve.h"
 
 
 
@@ -17,27 +26,97 @@ static void usage(const char *prog)
 {
     fprintf(stderr,
         "Usage: %s [options] evtxfile\n"
+        "       %s [options] evtxfile|directory ...\n"
         "\n"
         "Output options (can be combined):\n"
         "  -c, --csv        CSV output\n"
         "  -t, --txt        Text output\n"
         "  -x, --xml        XML output\n"
+        "  -J, --json       JSON Lines output, one object per record\n"
         "  -s, --schema     Schema output\n"
+        "  -a, --arrow      Apache Arrow IPC stream (record_id, timestamp, event_id,\n"
+        "                   level, provider, channel, computer, event_data as JSON)\n"
         "  -d, --debug      Debug output\n"
+        "      --stats      Print template cache statistics to stderr\n"
         "\n"
         "Filter options:\n"
-        "  -e <EventID>     Filter by EventID (e.g. 4624)\n"
+        "  -e <EventIDs>    Only records with these EventIDs, a list of IDs and\n"
+        "                   ranges (e.g. 4624 or 4624,4625,4768-4771)\n"
+        "  --since <time>   Only records written at or after this time (UTC)\n"
+        "  --until <time>   Only records written at or before this time (UTC), a date\n"
+        "                   or a time without seconds takes the whole day or minute\n"
+        "                   time: 2026-01-14, 2026-01-14T21:00 or 2026-01-14T21:39:15.3995512Z\n"
+        "  --record N[:M]   Only record N (or records N to M), found without decoding the rest\n"
+        "  --index          Use the sidecar index <evtxfile>.idx for the filters above,\n"
+        "                   built on the first run (and again when the log changes)\n"
+        "  --follow         Decode the records in the file, then keep decoding the new\n"
+        "                   ones as they are written (until Ctrl-C), like tail -f\n"
+        "\n"
+        "Integrity check:\n"
+        "  --verify         Check the CRC32 checksums of the file header, the chunk\n"
+        "                   headers and the records of every chunk instead of decoding,\n"
+        "                   print the broken ones with their offsets (exit code 1)\n"
+        "\n"
+        "Recovery:\n"
+        "  --no-slack       Do not look for records after the last one of a chunk and in\n"
+        "                   the chunks past the chunk count of the file header (deleted or\n"
+        "                   overwritten records, flagged as recovered in the output).\n"
+        "                   Always off with --follow, -a, --record and --index\n"
+        "  --carve          The inputs are raw images (disk, partition, unallocated\n"
+        "                   space): decode the chunks and records found anywhere in\n"
+        "                   them, tagged with image@offset of their chunk\n"
+        "\n"
+        "Performance options:\n"
+        "  -j <N>           Decode chunks on N threads (output order is kept)\n"
+        "      --raw-walker Do not compile templates (slower, for comparison)\n"
+        "\n"
+        "Batch mode (more than one input, a directory, or -o):\n"
+        "  The chunks of all the files (*.evtx below a directory) are shared by the\n"
+        "  -j threads. The output is one stream where CSV and JSON records carry the\n"
+        "  input file in a Source field, or one file per input with:\n"
+        "  -o <dir>         Write the output of each input to a file in <dir>\n"
         "\n"
         "If no output option is specified, DEFAULT summary output is used.\n",
-        prog
+        prog, prog
     );
 }
 
 
-const char *check_cmd_argv(uint32_t *mode_ptr, int argc, char *argv[])
+// "N" or "N:M", record identifiers start at 1
+static int parse_record_range(const char *arg, uint64_t *first, uint64_t *last)
+{
+    char *end;
+    if (*arg < '0' || *arg > '9') return -1;
+    *first = strtoull(arg, &end, 10);
+    *last  = *first;
+
+    if (*end == ':') {
+        const char *p = end + 1;
+        if (*p < '0' || *p > '9') return -1;
+        *last = strtoull(p, &end, 10);
+    }
+    return (*end != '\0' || *first == 0 || *last < *first) ? -1 : 0;
+}
+
+// one bit per EventID, too large for the stack of main()
+static EVTX_EVTID_FILTER evtid_filter;
+
+// -o: batch mode, one output file per input
+static const char *output_dir;
+
+// --follow: a live log
+static int follow;
+
+// --carve: the inputs are raw images
+static int carve;
+
+// the input files and directories go to inputs (argc entries), returns their count, -1 on errors
+int check_cmd_argv(EVTX_OPTIONS *opts, int argc, char *argv[], const char **inputs)
 {
     uint32_t output_mode = 0;
-    const char *filename = NULL;
+    int input_count = 0;
+    int use_index = 0;
+    int slack = 1;
 
     for (int i = 1; i < argc; i++) {
 
@@ -50,65 +129,228 @@ const char *check_cmd_argv(uint32_t *mode_ptr, int argc, char *argv[])
         else if (!strcmp(argv[i], "-x") || !strcmp(argv[i], "--xml")) {
             SET_OUTMODE(output_mode, OUT_XML);
         }
+        else if (!strcmp(argv[i], "-J") || !strcmp(argv[i], "--json")) {
+            SET_OUTMODE(output_mode, OUT_JSON);
+        }
         else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--schema")) {
             SET_OUTMODE(output_mode, OUT_SCHEMA);
         }
+        else if (!strcmp(argv[i], "-a") || !strcmp(argv[i], "--arrow")) {
+            SET_OUTMODE(output_mode, OUT_ARROW);
+        }
         else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--debug")) {
             SET_OUTMODE(output_mode, OUT_DEBUG);
         }
+        else if (!strcmp(argv[i], "--stats")) {
+            SET_OUTMODE(output_mode, OUT_STATS);
+        }
+        else if (!strcmp(argv[i], "--record")) {
+            if (i + 1 >= argc || parse_record_range(argv[i + 1], &opts->record_first, &opts->record_last) != 0) {
+                fprintf(stderr, "ERROR: --record requires a record identifier N or a range N:M\n");
+                usage(argv[0]);
+                return -1;
+            }
+            i++;
+        }
+        else if (!strcmp(argv[i], "--follow")) {
+            follow = 1;
+        }
+        else if (!strcmp(argv[i], "--carve")) {
+            carve = 1;
+        }
+        else if (!strcmp(argv[i], "--no-slack")) {
+            slack = 0;
+        }
+        else if (!strcmp(argv[i], "--verify")) {
+            opts->verify = 1;
+        }
+        else if (!strcmp(argv[i], "--index")) {
+            use_index = 1;
+        }
+        else if (!strcmp(argv[i], "--raw-walker")) {
+            SET_OUTMODE(output_mode, OUT_RAW);
+        }
         else if (!strcmp(argv[i], "-e")) {
             if (i + 1 >= argc) {
                 fprintf(stderr, "ERROR: -e requires an EventID\n");
                 usage(argv[0]);
-                return NULL;
+                return -1;
+            }
+            // -e may be given more than once, the lists add up
+            if (evtid_filter_parse(&evtid_filter, argv[++i]) != 0) {
+                fprintf(stderr, "ERROR: invalid EventID list: %s\n", argv[i]);
+                usage(argv[0]);
+                return -1;
+            }
+            opts->evtid_filter = &evtid_filter;
+        }
+        else if (!strcmp(argv[i], "--since") || !strcmp(argv[i], "--until")) {
+            // compared with the FILETIME of the record header, see decode_evtx_record()
+            uint64_t *limit = (argv[i][2] == 's') ? &opts->since : &opts->until;
+            uint64_t span;
+            if (i + 1 >= argc || parse_filetime(argv[i + 1], limit, &span) != 0) {
+                fprintf(stderr, "ERROR: %s requires a time like 2026-01-14T21:00:00Z\n", argv[i]);
+                usage(argv[0]);
+                return -1;
             }
-            uint32_t evtid = (uint32_t)atoi(argv[++i]);
-            SET_EVTID(output_mode, evtid);
+            // --until 2026-01-14 is up to the last tick of that day, not its 00:00
+            if (limit == &opts->until) *limit += span - 1;
+            i++;
+        }
+        else if (!strcmp(argv[i], "-o")) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERROR: -o requires an output directory\n");
+                usage(argv[0]);
+                return -1;
+            }
+            output_dir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-j")) {
+            if (i + 1 >= argc || atoi(argv[i + 1]) < 1) {
+                fprintf(stderr, "ERROR: -j requires a number of threads\n");
+                usage(argv[0]);
+                return -1;
+            }
+            opts->jobs = atoi(argv[++i]);
         }
         else if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
             usage(argv[0]);
-            return NULL;
+            return -1;
         }
         else if (argv[i][0] == '-') {
             fprintf(stderr, "Unknown option: %s\n", argv[i]);
             usage(argv[0]);
-            return NULL;
+            return -1;
         }
         else {
-            /* positional argument = filename */
-            filename = argv[i];
+            /* positional arguments = input files and directories */
+            inputs[input_count++] = argv[i];
         }
     }
 
+    // records in chunk slack, on by default. not for a live log (the slack of its last
+    // chunk is where the next records are being written), not for Arrow (it has
+    // no column to flag them), and not with --record / --index: they go straight to
+    // the chunks and records of the header and the index, recovered ones are not there
+    if (slack && !follow && !CHECK_OUTMODE(output_mode, OUT_ARROW) &&
+            !opts->record_last && !use_index) {
+        SET_OUTMODE(output_mode, OUT_SLACK);
+    }
+
     /* set output_mode AFTER parsing all args */
-    *mode_ptr = output_mode;
+    opts->output_mode = output_mode;
 
-    return filename;
+    // the index lives next to the log: Security.evtx -> Security.evtx.idx
+    // (one log only, batch mode goes through the chunks)
+    if (use_index && input_count == 1) {
+        static char index_path[4096];
+        snprintf(index_path, sizeof(index_path), "%s" EVTX_INDEX_SUFFIX, inputs[0]);
+        opts->index_path = index_path;
+    }
+
+    return input_count;
 }
 
 
 
+// one log, the output goes to out
+static int decode_one_file(const char *filename, EVTX_OPTIONS *opts, OUT_SINK *out)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        perror("fopen");
+        return 1;
+    }
+
+    // the Arrow writer takes the records through the SAX callbacks
+    EVTX_ARROW *arrow = NULL;
+    if (CHECK_OUTMODE(opts->output_mode, OUT_ARROW)) {
+        arrow = evtx_arrow_new(out);
+        if (!arrow) {
+            fclose(fp);
+            return 1;
+        }
+        opts->sax = evtx_arrow_sax(arrow);
+    }
+
+    int rtn_code = decode_evtx_file(fp, opts, out);
+
+    evtx_arrow_finish(arrow);
+    fclose(fp);
+    return rtn_code;
+}
+
+
 int main(int argc, char **argv)
 {
-    uint32_t output_mode = 0;
-    const char *filename = check_cmd_argv(&output_mode, argc, argv);
+    EVTX_OPTIONS opts = { .output_mode = 0, .jobs = 1 };
+    const char **inputs = calloc((size_t)argc, sizeof(char *));
+    int input_count = inputs ? check_cmd_argv(&opts, argc, argv, inputs) : -1;
 
-    if (!filename) {
-        fprintf(stderr, "ERROR: no evtx file specified\n");
-        usage(argv[0]);
+    if (input_count <= 0) {
+        if (input_count == 0) {
+            fprintf(stderr, "ERROR: no evtx file specified\n");
+            usage(argv[0]);
+        }
+        free(inputs);
         return 1;
     }
 
-    FILE *fp = fopen(filename, "rb");
-    if (!fp) {
-        perror("fopen");
+    // all the output goes through one buffered sink on stdout
+    OUT_SINK out;
+    if (out_sink_init_fd(&out, STDOUT_FILENO) != 0) {
+        free(inputs);
         return 1;
     }
 
-    int rtn_code = decode_evtx_file(fp, output_mode);
+    int rtn_code;
+    struct stat st;
+    int batch = (input_count > 1 || output_dir || (stat(inputs[0], &st) == 0 && S_ISDIR(st.st_mode)));
 
-    fclose(fp);
+    // the Arrow writer only ends its stream at the end, a live log never ends
+    if (follow && (batch || CHECK_OUTMODE(opts.output_mode, OUT_ARROW))) {
+        fprintf(stderr, "ERROR: --follow takes one evtx file, and can not be used with -a\n");
+        out_sink_free(&out);
+        free(inputs);
+        return 1;
+    }
+
+    // the checksums go through batch mode, which spreads the chunks of all the inputs over -j
+    if (opts.verify && (follow || output_dir)) {
+        fprintf(stderr, "ERROR: --verify can not be used with --follow or -o\n");
+        out_sink_free(&out);
+        free(inputs);
+        return 1;
+    }
+
+    // an image is no EVTX file, only the output formats and the filters go with it
+    if (carve && (follow || opts.verify || output_dir || CHECK_OUTMODE(opts.output_mode, OUT_ARROW))) {
+        fprintf(stderr, "ERROR: --carve can not be used with --follow, --verify, -o or -a\n");
+        out_sink_free(&out);
+        free(inputs);
+        return 1;
+    }
+
+    if (carve) {
+        rtn_code = evtx_carve(inputs, input_count, &opts, &out);
+    } else if (follow) {
+        rtn_code = evtx_follow(inputs[0], &opts, &out);
+    } else if (batch || opts.verify) {
+        rtn_code = decode_evtx_batch(inputs, input_count, &opts, output_dir, &out);
+    } else {
+        rtn_code = decode_one_file(inputs[0], &opts, &out);
+    }
+
+    out_sink_free(&out);
+    free(inputs);
+
+    if (CHECK_OUTMODE(opts.output_mode, OUT_STATS)) {
+        uint64_t hits, misses;
+        evtx_template_cache_stats(&hits, &misses);
+        fprintf(stderr, "template cache: hits=%" PRIu64 " misses=%" PRIu64 "\n", hits, misses);
+    }
+
+    evtx_template_cache_free_all();
 
     return rtn_code;
 }
-
@@ -0,0 +1,252 @@
+/* out_sink.c
+ *
+ * buffered output sink, see out_sink.h
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "out_sink.h"
+
+
+#define OUT_SINK_MEMORY_FIRST   (16 * 1024)
+
+
+static int out_sink_init(OUT_SINK *s, int kind, size_t cap)
+{
+    memset(s, 0, sizeof(*s));
+    s->kind = kind;
+    s->fd   = -1;
+    s->buf  = malloc(cap);
+    if (!s->buf) {
+        perror("malloc(out_sink)");
+        s->error = 1;
+        return 1;
+    }
+    s->cap = cap;
+    return 0;
+}
+
+int out_sink_init_fd(OUT_SINK *s, int fd)
+{
+    int rtn_code = out_sink_init(s, OUT_SINK_FD, OUT_SINK_FLUSH_SIZE);
+    s->fd = fd;
+    return rtn_code;
+}
+
+int out_sink_init_file(OUT_SINK *s, FILE *fp)
+{
+    int rtn_code = out_sink_init(s, OUT_SINK_FILE, OUT_SINK_FLUSH_SIZE);
+    s->fp = fp;
+    return rtn_code;
+}
+
+int out_sink_init_memory(OUT_SINK *s)
+{
+    return out_sink_init(s, OUT_SINK_MEMORY, OUT_SINK_MEMORY_FIRST);
+}
+
+
+
+// write p[0..n) to the target of the sink, not for memory sinks
+static int out_sink_write_through(OUT_SINK *s, const char *p, size_t n)
+{
+    if (s->error) return -1;
+
+    if (s->kind == OUT_SINK_FILE) {
+        if (fwrite(p, 1, n, s->fp) != n) {
+            s->error = 1;
+            return -1;
+        }
+        return 0;
+    }
+
+    while (n > 0) {
+        ssize_t w = write(s->fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            s->error = 1;   // EPIPE etc., nobody reads the rest
+            return -1;
+        }
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+
+int out_sink_flush(OUT_SINK *s)
+{
+    if (s->kind == OUT_SINK_MEMORY) return 0;
+
+    int rtn_code = 0;
+    if (s->len > 0) {
+        rtn_code = out_sink_write_through(s, s->buf, s->len);
+        s->len = 0;
+    }
+    if (s->kind == OUT_SINK_FILE && !s->error && fflush(s->fp) != 0) {
+        s->error = 1;
+        rtn_code = -1;
+    }
+    return rtn_code;
+}
+
+
+void out_sink_free(OUT_SINK *s)
+{
+    out_sink_flush(s);
+    free(s->buf);
+    s->buf = NULL;
+    s->len = s->cap = 0;
+}
+
+
+char *out_sink_take(OUT_SINK *s, size_t *size)
+{
+    char *data = s->buf;
+    *size = s->len;
+
+    s->buf = NULL;
+    s->len = s->cap = 0;
+    return data;
+}
+
+
+
+int out_reserve_slow(OUT_SINK *s, size_t n)
+{
+    if (s->error) return -1;
+
+    if (s->kind != OUT_SINK_MEMORY) {
+        if (s->len > 0 && out_sink_write_through(s, s->buf, s->len) != 0) return -1;
+        s->len = 0;
+        if (n <= s->cap) return 0;
+    }
+
+    // memory sinks, or one piece larger than the whole buffer
+    size_t cap = s->cap ? s->cap : OUT_SINK_MEMORY_FIRST;
+    while (cap - s->len < n) cap *= 2;
+
+    char *p = realloc(s->buf, cap);
+    if (!p) {
+        perror("realloc(out_sink)");
+        s->error = 1;
+        return -1;
+    }
+    s->buf = p;
+    s->cap = cap;
+    return 0;
+}
+
+
+void out_write_slow(OUT_SINK *s, const void *p, size_t n)
+{
+    // a large piece goes straight to the target, no copy
+    if (s->kind != OUT_SINK_MEMORY && n >= s->cap) {
+        if (s->len > 0 && out_sink_write_through(s, s->buf, s->len) != 0) return;
+        s->len = 0;
+        out_sink_write_through(s, p, n);
+        return;
+    }
+
+    if (out_reserve_slow(s, n) != 0) return;
+    memcpy(&s->buf[s->len], p, n);
+    s->len += n;
+}
+
+
+
+void out_printf(OUT_SINK *s, const char *fmt, ...)
+{
+    if (out_reserve(s, 256) != 0) return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(&s->buf[s->len], s->cap - s->len, fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+
+    if ((size_t)n >= s->cap - s->len) {
+        // did not fit, make room for the whole text and format again
+        if (out_reserve(s, (size_t)n + 1) != 0) return;
+        va_start(ap, fmt);
+        vsnprintf(&s->buf[s->len], s->cap - s->len, fmt, ap);
+        va_end(ap);
+    }
+    s->len += (size_t)n;
+}
+
+
+
+void out_u64(OUT_SINK *s, uint64_t v)
+{
+    char tmp[20];
+    int n = sizeof(tmp);
+
+    do {
+        tmp[--n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+
+    out_write(s, &tmp[n], sizeof(tmp) - n);
+}
+
+
+void out_i64(OUT_SINK *s, int64_t v)
+{
+    if (v < 0) {
+        out_putc(s, '-');
+        out_u64(s, (uint64_t)0 - (uint64_t)v);
+    } else {
+        out_u64(s, (uint64_t)v);
+    }
+}
+
+
+void out_hex(OUT_SINK *s, uint64_t v, int width)
+{
+    static const char digits[] = "0123456789abcdef";
+    char tmp[16];
+    int n = sizeof(tmp);
+
+    if (width > 16) width = 16;
+    do {
+        tmp[--n] = digits[v & 0x0f];
+        v >>= 4;
+    } while (v);
+    while ((int)sizeof(tmp) - n < width) {
+        tmp[--n] = '0';
+    }
+
+    out_write(s, &tmp[n], sizeof(tmp) - n);
+}
+
+
+
+void out_xml_escaped(OUT_SINK *s, const char *p, size_t n)
+{
+    size_t run = 0;     // start of the text not written yet
+
+    for (size_t i = 0; i < n; i++) {
+        const char *entity;
+        switch (p[i]) {
+            case '&':  entity = "&amp;";  break;
+            case '<':  entity = "&lt;";   break;
+            case '>':  entity = "&gt;";   break;
+            case '"':  entity = "&quot;"; break;
+            case '\'': entity = "&apos;"; break;
+            default:   continue;
+        }
+        out_write(s, &p[run], i - run);
+        out_puts(s, entity);
+        run = i + 1;
+    }
+    out_write(s, &p[run], n - run);
+}
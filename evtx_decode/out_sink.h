@@ -0,0 +1,101 @@
+#ifndef OUT_SINK_H
+#define OUT_SINK_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/*
+ * Buffered output sink.
+ *
+ * Everything the decoder prints is appended to one large buffer, which is
+ * written out in big blocks when it gets full (or on out_sink_flush()).
+ * No stdio locking or formatting per fragment: strings and numbers are
+ * appended directly, out_printf() is left for the rare complex formats.
+ *
+ * Targets:
+ *   OUT_SINK_FD      write(2) to a file descriptor (stdout, a file, a pipe)
+ *   OUT_SINK_FILE    fwrite to a FILE *
+ *   OUT_SINK_MEMORY  keep everything in memory (chunk workers of -j, tests),
+ *                    take the result with out_sink_take()
+ */
+
+#define OUT_SINK_FD         1
+#define OUT_SINK_FILE       2
+#define OUT_SINK_MEMORY     3
+
+#define OUT_SINK_FLUSH_SIZE (256 * 1024)    /* fd / FILE: write out at this size */
+
+typedef struct _OUT_SINK {
+    char   *buf;
+    size_t  len;
+    size_t  cap;
+    int     kind;       // OUT_SINK_*
+    int     fd;
+    FILE   *fp;
+    int     error;      // a write failed, later output is dropped
+} OUT_SINK;
+
+
+/* lifecycle, all return 0 on success */
+int  out_sink_init_fd(OUT_SINK *s, int fd);
+int  out_sink_init_file(OUT_SINK *s, FILE *fp);
+int  out_sink_init_memory(OUT_SINK *s);
+int  out_sink_flush(OUT_SINK *s);           /* no-op for memory sinks */
+void out_sink_free(OUT_SINK *s);            /* flushes first */
+
+/* memory sink: hand the buffer over to the caller (free() it), the sink is empty again */
+char *out_sink_take(OUT_SINK *s, size_t *size);
+
+/* slow paths, see the inline helpers below */
+int  out_reserve_slow(OUT_SINK *s, size_t n);
+void out_write_slow(OUT_SINK *s, const void *p, size_t n);
+
+/* formatted output, for the few places which really need it */
+void out_printf(OUT_SINK *s, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/* numbers */
+void out_u64(OUT_SINK *s, uint64_t v);
+void out_i64(OUT_SINK *s, int64_t v);
+void out_hex(OUT_SINK *s, uint64_t v, int width);      /* lower case, zero padded to width */
+
+/* text with &, <, >, " and ' escaped for XML */
+void out_xml_escaped(OUT_SINK *s, const char *p, size_t n);
+
+
+/* make room for n more bytes, returns 0 on success */
+static inline int out_reserve(OUT_SINK *s, size_t n)
+{
+    if (s->cap - s->len >= n) return 0;
+    return out_reserve_slow(s, n);
+}
+
+static inline void out_write(OUT_SINK *s, const void *p, size_t n)
+{
+    if (s->cap - s->len >= n) {
+        memcpy(&s->buf[s->len], p, n);
+        s->len += n;
+        return;
+    }
+    out_write_slow(s, p, n);
+}
+
+static inline void out_puts(OUT_SINK *s, const char *str)
+{
+    out_write(s, str, strlen(str));
+}
+
+static inline void out_putc(OUT_SINK *s, char c)
+{
+    if (s->len < s->cap || out_reserve_slow(s, 1) == 0) {
+        s->buf[s->len++] = c;
+    }
+}
+
+static inline void out_u32(OUT_SINK *s, uint32_t v)
+{
+    out_u64(s, v);
+}
+
+#endif
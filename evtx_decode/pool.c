@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+
+/* how many finished-but-not-yet-written tasks we keep per worker */
+#define POOL_WINDOW_PER_JOB  4
+
+
+typedef struct _POOL_SLOT {
+    char   *data;       // captured output of the task
+    size_t  size;
+    int     done;
+} POOL_SLOT;
+
+typedef struct _POOL {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;       // a slot is done, or the window moved
+
+    uint32_t task_count;
+    uint32_t next_task;         // next task to hand out to a worker
+    uint32_t next_emit;         // next task to write out
+    uint32_t window;            // workers may run at most this far ahead of next_emit
+    POOL_SLOT *slots;           // ring buffer, task t uses slots[t % window]
+
+    const POOL_JOB *job;
+    int          failed;
+} POOL;
+
+
+
+static void *pool_worker(void *p)
+{
+    POOL *pool = (POOL *)p;
+    const POOL_JOB *job = pool->job;
+    void *worker = job->worker_init ? job->worker_init(job->arg) : NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        // do not run too far ahead of the sequencer, the output is kept in memory
+        while (pool->next_task < pool->task_count &&
+               pool->next_task >= pool->next_emit + pool->window) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        }
+        if (pool->next_task >= pool->task_count) {
+            break;
+        }
+        uint32_t t = pool->next_task++;
+        pthread_mutex_unlock(&pool->lock);
+
+        // capture everything this task prints
+        char  *data = NULL;
+        size_t size = 0;
+        OUT_SINK mem;
+        int ok = (out_sink_init_memory(&mem) == 0);
+        if (ok) {
+            job->task_fn(job->arg, worker, t, &mem);
+            ok = !mem.error;
+            data = out_sink_take(&mem, &size);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        POOL_SLOT *slot = &pool->slots[t % pool->window];
+        slot->data = data;
+        slot->size = size;
+        slot->done = 1;
+        if (!ok) pool->failed = 1;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (job->worker_free) job->worker_free(worker);
+    return NULL;
+}
+
+
+
+int pool_run_ordered(int jobs, uint32_t task_count, const POOL_JOB *job, OUT_SINK *out)
+{
+    if (jobs < 1) jobs = 1;
+    if ((uint32_t)jobs > task_count) jobs = (int)task_count;
+    if (jobs == 0) return 0;  // nothing to do
+
+    POOL pool;
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+    pool.task_count = task_count;
+    pool.window     = (uint32_t)jobs * POOL_WINDOW_PER_JOB;
+    pool.slots      = calloc(pool.window, sizeof(POOL_SLOT));
+    pool.job        = job;
+
+    pthread_t *threads = calloc((size_t)jobs, sizeof(pthread_t));
+    if (!pool.slots || !threads) {
+        perror("calloc(pool)");
+        free(pool.slots);
+        free(threads);
+        return 1;
+    }
+
+    int started = 0;
+    for (int i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, pool_worker, &pool) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        started++;
+    }
+    if (started == 0) {
+        free(pool.slots);
+        free(threads);
+        return 1;
+    }
+
+    // the sequencer: write the output of each task in task order
+    for (uint32_t t = 0; t < task_count; t++) {
+        pthread_mutex_lock(&pool.lock);
+        POOL_SLOT *slot = &pool.slots[t % pool.window];
+        while (!slot->done) {
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        }
+        char  *data = slot->data;
+        size_t size = slot->size;
+        memset(slot, 0, sizeof(*slot));
+        pool.next_emit = t + 1;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+
+        OUT_SINK *dst = job->task_out ? job->task_out(job->arg, t) : NULL;
+        if (data) {
+            out_write(dst ? dst : out, data, size);
+            free(data);
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+    free(pool.slots);
+    free(threads);
+
+    return pool.failed;
+}
@@ -0,0 +1,35 @@
+#ifndef EVTX_POOL_H
+#define EVTX_POOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "out_sink.h"
+
+/*
+ * A small thread pool for decoding independent pieces (chunks) in parallel.
+ *
+ * Each task prints to the memory sink it is given, and the calling thread
+ * writes the buffers to `out` strictly in task order. So the output is the
+ * same as running task 0, 1, 2, ... one after another.
+ */
+
+typedef void (*POOL_TASK_FN)(void *arg, void *worker, uint32_t task_index, OUT_SINK *out);
+
+typedef struct _POOL_JOB {
+    POOL_TASK_FN task_fn;
+    void  *arg;                             // shared by all tasks
+
+    // optional state of each worker thread (decoder context, arenas ...),
+    // created when the thread starts and given to every task it runs
+    void *(*worker_init)(void *arg);
+    void  (*worker_free)(void *worker);
+
+    // optional: where the output of a task goes (NULL: `out`), called by
+    // the writing thread in task order, e.g. one output file per input
+    OUT_SINK *(*task_out)(void *arg, uint32_t task_index);
+} POOL_JOB;
+
+/* run tasks 0 .. task_count-1 on `jobs` threads, returns 0 on success */
+int pool_run_ordered(int jobs, uint32_t task_count, const POOL_JOB *job, OUT_SINK *out);
+
+#endif
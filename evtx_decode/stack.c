@@ -3,140 +3,47 @@
 #include "stack.h"
 
 
-static ARENA *arena_new(void)
-{
-    ARENA *a = (ARENA *)calloc(1, sizeof(ARENA));
-    return a;   // head == NULL
-}
-
-
-static void *arena_alloc(ARENA *a, size_t size)
-{
-    if (!a || size == 0)
-        return NULL;
-
-    void *p = malloc(size);
-    if (!p)
-        return NULL;
-
-    ARENA_BLOCK *b = (ARENA_BLOCK *)malloc(sizeof(ARENA_BLOCK));
-    if (!b) {
-        free(p);
-        return NULL;
-    }
-
-    b->ptr  = p;
-    b->next = a->head;
-    a->head = b;
-
-    return p;
-}
-
-
-static char *arena_strdup(ARENA *a, const char *s)
-{
-    if (!a || !s)
-        return NULL;
-
-    size_t len = strlen(s) + 1;
-    char *p = (char *)arena_alloc(a, len);
-    if (!p)
-        return NULL;
-
-    memcpy(p, s, len);
-    return p;
-}
-
+#define STACK_FIRST_CAP     32      // deep enough for any event XML
 
 
-static void arena_free_all(ARENA *a)
+void stack_init(STACK *s, ARENA *arena)
 {
-    if (!a)
-        return;
-
-    ARENA_BLOCK *b = a->head;
-    while (b) {
-        ARENA_BLOCK *next = b->next;
-        free(b->ptr);
-        free(b);
-        b = next;
-    }
-
-    free(a);
-}
-
-
-
-
-
-
-
-
-STACK *stack_new(void)
-{
-    STACK *s = calloc(1, sizeof(STACK));
-    if (!s) return NULL;
-
-    s->arena = arena_new();   // ← ここで生成
-    if (!s->arena) {
-        free(s);
-        return NULL;
-    }
-
-    return s;
-}
-
-
-
-void stack_free(STACK *s)
-{
-    if (!s) return;
-
-    // ノード構造を解放
-    while (s->top) {
-        STACK_NODE *n = s->top;
-        s->top = n->next;
-        free(n);
-    }
-
-    // arena が管理する全メモリを一括解放
-    arena_free_all(s->arena);
-
-    free(s);
+    s->items = NULL;
+    s->depth = 0;
+    s->cap   = 0;
+    s->arena = arena;
 }
 
 
 
+// the stack keeps the pointer only, the string must outlive the stack
+// (element names are owned by the name pool of the chunk)
 void stack_push(STACK *s, const char *name)
 {
     if (!s || !name) return;
 
-    STACK_NODE *n = malloc(sizeof(STACK_NODE));
-    if (!n) return;
+    if (s->depth == s->cap) {
+        // 倍のサイズで取り直す、古い配列は arena の reset まで残る
+        int cap = s->cap ? s->cap * 2 : STACK_FIRST_CAP;
+        void **items = arena_alloc(s->arena, (size_t)cap * sizeof(void *));
+        if (!items) return;
+        if (s->depth > 0) memcpy(items, s->items, (size_t)s->depth * sizeof(void *));
+        s->items = items;
+        s->cap   = cap;
+    }
 
-    n->data = arena_strdup(s->arena, name);
-    n->next = s->top;
-    s->top  = n;
-    s->depth++;
+    s->items[s->depth++] = (void *)name;
 }
 
 char *stack_pop(STACK *s)
 {
-    if (!s || !s->top) return NULL;
-
-    STACK_NODE *n = s->top;
-    char *data = n->data;
-
-    s->top = n->next;
-    free(n);
-    s->depth--;
-
-    return data;
+    if (!s || s->depth == 0) return NULL;
+    return s->items[--s->depth];
 }
 
 
 void *stack_peek(STACK *s)
 {
-    if (!s || !s->top) return NULL;
-    return s->top->data;
+    if (!s || s->depth == 0) return NULL;
+    return s->items[s->depth - 1];
 }
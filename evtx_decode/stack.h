@@ -2,37 +2,23 @@
 #define EVTX_STACK_H
 
 #include <stddef.h>
+#include "arena.h"
 
-/* Using ARENA to hold all data pointers */
-typedef struct _ARENA_BLOCK {
-    void *ptr;
-    struct _ARENA_BLOCK *next;
-} ARENA_BLOCK;
-
-typedef struct _ARENA {
-    ARENA_BLOCK *head;
-} ARENA;
-
-
-
-typedef struct _STACK_NODE {
-    void *data;
-    struct _STACK_NODE *next;
-} STACK_NODE;
 
+/* a stack of pointers, the items are a contiguous array taken from an arena */
 typedef struct _STACK {
-    STACK_NODE *top;
-    ARENA *arena;
+    void **items;
     int    depth;
+    int    cap;
+    ARENA *arena;
 } STACK;
 
 
-/* lifecycle */
-STACK *stack_new(void);
-void   stack_free(STACK *s);
+/* lifecycle: the memory belongs to the arena, nothing to free */
+void   stack_init(STACK *s, ARENA *arena);
 
 /* operations */
-void   stack_push(STACK *s, const char *data);
+void   stack_push(STACK *s, const char *data);   /* not copied */
 char  *stack_pop(STACK *s);
 void  *stack_peek(STACK *s);
 
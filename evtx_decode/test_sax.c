@@ -0,0 +1,230 @@
+// test_sax.c
+//
+// Example consumer of the SAX interface (evtx_sax.h), a tiny indexer:
+// for every record print
+//
+//     EventRecordID  EventID  TimeCreated  Provider
+//
+// taken straight from the raw values, without building a tree or
+// formatting anything else. It also checks that every record has balanced
+// open/close events. With -q only the counts are printed, with the time
+// next to the time of the tree based XML output (-x) of the same file.
+//
+// Build the program (one command line)
+//    gcc -Wall -Wextra -O2 -std=c11 -D_DEFAULT_SOURCE -pthread -o test_sax test_sax.c
+//        hex_dump.c timestamp.c evtx_file.c evtx_chunk.c evtx_record.c evtx_binxml.c
+//        utf16le.c evtx_xmltree.c evtx_output.c stack.c pool.c evtx_template.c out_sink.c arena.c evtx_index.c evtx_arrow.c evtx_batch.c evtx_follow.c evtx_verify.c crc32.c evtx_carve.c
+//
+// Run
+//    ./test_sax [-q] system.evtx
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "evtx_file.h"
+#include "evtx_record.h"
+#include "evtx_output.h"
+#include "evtx_sax.h"
+#include "timestamp.h"
+#include "utf16le.h"
+
+
+// what the indexer wants from a record
+enum { F_NONE, F_RECORD_ID, F_EVENT_ID, F_TIME, F_PROVIDER };
+
+typedef struct {
+    int quiet;
+    int depth;                  // open elements
+    int field;                  // F_*: the next value belongs to this field
+    int text_field;             // F_*: field of the text of the open element
+    const char *element;        // name of the innermost open element
+
+    uint64_t record_id;
+    uint32_t event_id;
+    uint64_t time_created;
+    char     provider[256];
+
+    uint64_t records;
+    uint64_t values;
+    uint64_t errors;
+} INDEXER;
+
+
+static int on_record_begin(void *user, const EVTX_RECORD_HEADER *rh)
+{
+    INDEXER *ix = user;
+    (void)rh;
+    ix->depth = 0;
+    ix->field = F_NONE;
+    ix->record_id = 0;
+    ix->event_id = 0;
+    ix->time_created = 0;
+    ix->provider[0] = '\0';
+    return 0;
+}
+
+static void on_element_open(void *user, const char *name, uint32_t len)
+{
+    INDEXER *ix = user;
+    (void)len;
+    ix->depth++;
+    ix->element = name;
+
+    if (strcmp(name, "EventRecordID") == 0)   ix->text_field = F_RECORD_ID;
+    else if (strcmp(name, "EventID") == 0)    ix->text_field = F_EVENT_ID;
+    else                                      ix->text_field = F_NONE;
+    ix->field = F_NONE;
+}
+
+static void on_attribute(void *user, const char *name, uint32_t len)
+{
+    INDEXER *ix = user;
+    (void)len;
+
+    if (strcmp(ix->element, "TimeCreated") == 0 && strcmp(name, "SystemTime") == 0)  ix->field = F_TIME;
+    else if (strcmp(ix->element, "Provider") == 0 && strcmp(name, "Name") == 0)      ix->field = F_PROVIDER;
+    else                                                                              ix->field = F_NONE;
+}
+
+static void on_start_tag_end(void *user)
+{
+    INDEXER *ix = user;
+    // the attributes are done, now comes the text of the element
+    ix->field = ix->text_field;
+}
+
+static void on_value(void *user, uint8_t type, const void *ptr, uint32_t size)
+{
+    INDEXER *ix = user;
+    ix->values++;
+
+    switch (ix->field) {
+        case F_RECORD_ID:
+            if (type == 0x0a && size == 8) memcpy(&ix->record_id, ptr, 8);
+            break;
+        case F_EVENT_ID:
+            if (type == 0x06 && size == 2) { uint16_t v; memcpy(&v, ptr, 2); ix->event_id = v; }
+            break;
+        case F_TIME:
+            if (type == 0x11 && size == 8) memcpy(&ix->time_created, ptr, 8);
+            break;
+        case F_PROVIDER:
+            if (type == 0x01 && size / 2 < sizeof(ix->provider) / 3) {
+                utf16le_to_utf8((const uint16_t *)ptr, size / 2, ix->provider);
+            } else if (type == EVTX_SAX_TEXT_UTF8 && size < sizeof(ix->provider)) {
+                memcpy(ix->provider, ptr, size);
+                ix->provider[size] = '\0';
+            }
+            break;
+    }
+    ix->field = F_NONE;
+}
+
+static void on_element_close(void *user)
+{
+    INDEXER *ix = user;
+    ix->depth--;
+    ix->field = F_NONE;
+    ix->text_field = F_NONE;
+    if (ix->depth < 0) ix->errors++;
+}
+
+static void on_record_end(void *user, const EVTX_RECORD_HEADER *rh)
+{
+    INDEXER *ix = user;
+    ix->records++;
+
+    if (ix->depth != 0) {
+        fprintf(stderr, "ERROR: record %llu: %d elements not closed\n",
+                (unsigned long long)rh->record_identifier, ix->depth);
+        ix->errors++;
+    }
+
+    if (!ix->quiet) {
+        char t[64];
+        format_filetime(ix->time_created, t, sizeof(t));
+        printf("%llu\t%u\t%s\t%s\n", (unsigned long long)ix->record_id, ix->event_id, t, ix->provider);
+    }
+}
+
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int quiet = (argc > 2 && strcmp(argv[1], "-q") == 0);
+    const char *filename = argv[argc - 1];
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s [-q] evtxfile\n", argv[0]);
+        return 1;
+    }
+
+    INDEXER ix;
+    memset(&ix, 0, sizeof(ix));
+    ix.quiet = quiet;
+
+    EVTX_SAX sax = {
+        .user             = &ix,
+        .on_record_begin  = on_record_begin,
+        .on_element_open  = on_element_open,
+        .on_attribute     = on_attribute,
+        .on_start_tag_end = on_start_tag_end,
+        .on_value         = on_value,
+        .on_element_close = on_element_close,
+        .on_record_end    = on_record_end,
+    };
+
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        perror(filename);
+        return 1;
+    }
+
+    // nothing is printed through the sink with SAX, it is only there for the API
+    OUT_SINK out;
+    out_sink_init_fd(&out, STDOUT_FILENO);
+
+    EVTX_OPTIONS opts = { .jobs = 1, .sax = &sax };
+    double t0 = now_sec();
+    decode_evtx_file(fp, &opts, &out);
+    double t_sax = now_sec() - t0;
+    out_sink_free(&out);
+
+    if (quiet) {
+        // the same file through the tree, to /dev/null
+        int fd = open("/dev/null", O_WRONLY);
+        out_sink_init_fd(&out, fd);
+        EVTX_OPTIONS xml_opts = { .output_mode = OUT_XML, .jobs = 1 };
+
+        rewind(fp);
+        t0 = now_sec();
+        decode_evtx_file(fp, &xml_opts, &out);
+        out_sink_flush(&out);
+        double t_xml = now_sec() - t0;
+        out_sink_free(&out);
+        close(fd);
+
+        printf("%llu records, %llu values\n", (unsigned long long)ix.records, (unsigned long long)ix.values);
+        printf("sax      %8.3f ms\n", t_sax * 1e3);
+        printf("tree -x  %8.3f ms\n", t_xml * 1e3);
+    }
+    fclose(fp);
+
+    if (ix.errors) {
+        fprintf(stderr, "%llu errors\n", (unsigned long long)ix.errors);
+        return 1;
+    }
+    return 0;
+}
@@ -11,21 +11,36 @@
 //  - xml_dump_tree()           (pretty XML)
 //  - xml_dump_tree_compact()   (compact XML)
 //  - xml_dump_tree_text()      (flattened text)
+//  - xml_reset_tree()          (tree reused after a reset)
+//  - xml_build_*()             (tree built token by token, as from BinXML)
 //  - xml_free_tree()
 //
 // Build the program
-//    gcc -Wall -Wextra -g test_xml.c evtx_xmltree.c -o test_xml
+//    gcc -Wall -Wextra -g test_xml.c evtx_xmltree.c arena.c out_sink.c -o test_xml
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
 
 #include "evtx_xmltree.h"
 
+// 1 (and a message) when got is not the string expected
+static int check_str(const char *what, const char *got, const char *expected)
+{
+    if (got && strcmp(got, expected) == 0) return 0;
+    fprintf(stderr, "%s: \"%s\", expected \"%s\"\n", what, got ? got : "(null)", expected);
+    return 1;
+}
+
 int main(void)
 {
     printf("=== XML tree API test ===\n\n");
 
+    // the dumps write to a sink, flushed before each printf() below
+    OUT_SINK out;
+    out_sink_init_file(&out, stdout);
+
     // ------------------------------------------------------------
     // Build XML tree manually
     // ------------------------------------------------------------
@@ -37,38 +52,38 @@ int main(void)
     }
 
     // <Event xmlns="http://schemas.microsoft.com/win/2004/08/events/event">
-    XML_ELEMENT *event = xml_new_element("Event");
+    XML_ELEMENT *event = xml_new_element(tree, "Event");
 
-    XML_ATTRIBUTE *attr = xml_new_attribute("xmlns");
-    xml_set_attribute(attr, "http://schemas.microsoft.com/win/2004/08/events/event", 0x01);
-    xml_add_attribute(event, attr);
+    XML_ATTRIBUTE *attr = xml_new_attribute(tree, "xmlns");
+    xml_set_attribute(tree, attr, "http://schemas.microsoft.com/win/2004/08/events/event", 0x01);
+    xml_add_attribute(tree, event, attr);
 
     tree->root = event;
 
     // <System>
-    XML_ELEMENT *system = xml_new_element("System");
+    XML_ELEMENT *system = xml_new_element(tree, "System");
     xml_add_child(event, system);
 
     // <Provider Name="Microsoft-Windows-Servicing" Guid="{...}" />
-    XML_ELEMENT *provider = xml_new_element("Provider");
+    XML_ELEMENT *provider = xml_new_element(tree, "Provider");
 
-    XML_ATTRIBUTE *attr1 = xml_new_attribute("Name");
-    xml_set_attribute(attr1, "Microsoft-Windows-Servicing", 0x01);
-    xml_add_attribute(provider, attr1);
+    XML_ATTRIBUTE *attr1 = xml_new_attribute(tree, "Name");
+    xml_set_attribute(tree, attr1, "Microsoft-Windows-Servicing", 0x01);
+    xml_add_attribute(tree, provider, attr1);
 
-    XML_ATTRIBUTE *attr2 = xml_new_attribute("Guid");
-    xml_set_attribute(attr2, "{bd12f3b8-fc40-4a61-a307-b7a013a069c1}", 0x01);
-    xml_add_attribute(provider, attr2);
+    XML_ATTRIBUTE *attr2 = xml_new_attribute(tree, "Guid");
+    xml_set_attribute(tree, attr2, "{bd12f3b8-fc40-4a61-a307-b7a013a069c1}", 0x01);
+    xml_add_attribute(tree, provider, attr2);
 
     xml_add_child(system, provider);
 
     // <EventID>15</EventID>
-    XML_ELEMENT *eventid = xml_new_element("EventID");
-    xml_set_element(eventid, "15", 0x01);
+    XML_ELEMENT *eventid = xml_new_element(tree, "EventID");
+    xml_set_element(tree, eventid, "15", 0x01);
 
-    XML_ATTRIBUTE *attr9 = xml_new_attribute("TESTNULL");
-    xml_set_attribute(attr9, "(null)", 0x00);
-    xml_add_attribute(eventid, attr9);
+    XML_ATTRIBUTE *attr9 = xml_new_attribute(tree, "TESTNULL");
+    xml_set_attribute(tree, attr9, "(null)", 0x00);
+    xml_add_attribute(tree, eventid, attr9);
 
     xml_add_child(system, eventid);
 
@@ -78,13 +93,16 @@ int main(void)
     // ------------------------------------------------------------
 
     printf("---- Pretty XML ----\n");
-    xml_dump_tree(tree);
+    xml_dump_tree(&out, tree);
+    out_sink_flush(&out);
 
     printf("\n---- Compact XML ----\n");
-    xml_dump_tree_compact(tree);
+    xml_dump_tree_compact(&out, tree);
+    out_sink_flush(&out);
 
     printf("\n---- Flattened text ----\n");
-    xml_dump_tree_text(tree);
+    xml_dump_tree_text(&out, tree);
+    out_sink_flush(&out);
 
     // ------------------------------------------------------------
     // Test xml_find_child()
@@ -99,11 +117,111 @@ int main(void)
         printf("EventID not found\n");
     }
 
+    // ------------------------------------------------------------
+    // Test xml_reset_tree(): build the next "record" in the same tree
+    // ------------------------------------------------------------
+
+    printf("\n---- xml_reset_tree() test ----\n");
+
+    xml_reset_tree(tree);
+    if (tree->root) {
+        fprintf(stderr, "xml_reset_tree() left the root\n");
+        return 1;
+    }
+
+    XML_ELEMENT *event2 = xml_new_element(tree, "Event");
+    tree->root = event2;
+
+    // more attributes than the first array holds
+    for (int i = 0; i < 10; i++) {
+        char name[16], value[16];
+        snprintf(name, sizeof(name), "a%d", i);
+        snprintf(value, sizeof(value), "%d", i * i);
+        XML_ATTRIBUTE *a = xml_new_attribute(tree, name);
+        xml_set_attribute(tree, a, value, 0x01);
+        xml_add_attribute(tree, event2, a);
+    }
+    xml_dump_tree_compact(&out, tree);
+    out_sink_flush(&out);
+
+    if (event2->attr_count != 10) {
+        fprintf(stderr, "xml_add_attribute(): %u attributes, expected 10\n", event2->attr_count);
+        return 1;
+    }
+    for (int i = 0; i < 10; i++) {
+        char name[16], value[16];
+        snprintf(name, sizeof(name), "a%d", i);
+        snprintf(value, sizeof(value), "%d", i * i);
+        if (check_str("attribute name", event2->attrs[i].name, name) ||
+            check_str("attribute value", event2->attrs[i].value, value)) {
+            return 1;
+        }
+    }
+
+    // ------------------------------------------------------------
+    // Test xml_build_*(): the same calls the BinXML decoder makes
+    // ------------------------------------------------------------
+
+    printf("\n---- xml_build_*() test ----\n");
+
+    xml_reset_tree(tree);
+    xml_build_open(tree, "Event");
+    xml_build_close_start(tree);
+    xml_build_open(tree, "EventData");
+    xml_build_close_start(tree);
+
+    // <Data Name="TargetUserName">SYSTEM & "co"</Data>
+    xml_build_open(tree, "Data");
+    xml_build_attr(tree, "Name");
+    xml_build_value(tree, "TargetUserName", 14, 0x01);
+    xml_build_close_start(tree);
+    xml_build_value(tree, "SYSTEM", 6, 0x01);
+    xml_build_value(tree, " & \"co\"", 7, 0x01);      // appended
+    xml_build_close(tree);
+
+    // <Data Name="Empty" Opt=NULL/>: a NULL attribute is not printed
+    xml_build_open(tree, "Data");
+    xml_build_attr(tree, "Name");
+    xml_build_value(tree, "Empty", 5, 0x01);
+    xml_build_attr(tree, "Opt");
+    xml_build_value(tree, NULL, 0, 0x00);
+    xml_build_close(tree);
+
+    xml_build_close(tree);      // </EventData>
+    xml_build_close(tree);      // </Event>
+
+    xml_dump_tree(&out, tree);
+    xml_dump_tree_text(&out, tree);
+    out_sink_flush(&out);
+
+    if (tree->cursor) {
+        fprintf(stderr, "xml_build_close() did not get back to the top\n");
+        return 1;
+    }
+
+    XML_ELEMENT *data = tree->root ? xml_find_child(tree->root, "EventData") : NULL;
+    XML_ELEMENT *data1 = data ? data->first_child : NULL;
+    XML_ELEMENT *data2 = data1 ? data1->next_sibling : NULL;
+    if (!data2 || data1->attr_count != 1 || data2->attr_count != 2) {
+        fprintf(stderr, "xml_build_*() did not build <EventData> with two <Data>\n");
+        return 1;
+    }
+    if (check_str("Data text", data1->text, "SYSTEM & \"co\"") ||
+        check_str("Data@Name", data1->attrs[0].value, "TargetUserName") ||
+        check_str("Data@Name", data2->attrs[0].value, "Empty")) {
+        return 1;
+    }
+    if (data2->text || data2->attrs[1].value || data2->attrs[1].value_type != BINXML_VALUE_NULL) {
+        fprintf(stderr, "xml_build_value(NULL) did not leave Opt and the text NULL\n");
+        return 1;
+    }
+
     // ------------------------------------------------------------
     // Free everything
     // ------------------------------------------------------------
 
     xml_free_tree(tree);
+    out_sink_free(&out);
 
     printf("\n=== test finished successfully ===\n");
     return 0;
@@ -20,9 +20,114 @@
  */
 
 
+#include <string.h>
+
 #include "timestamp.h"
 
 
+// ------------------------------------------------------------
+// FILETIME -> text
+// ------------------------------------------------------------
+// no gmtime / strftime / printf: the date comes from the day number with a
+// few multiplications (days_to_civil), every pair of digits from a table.
+// the records of a log are written one after another, nearly all of them on
+// the same day as the one before: the "YYYY-MM-DDT" of the last day is kept
+
+#define FILETIME_TICKS_PER_SEC       10000000ULL
+#define FILETIME_TICKS_PER_DAY       (86400ULL * FILETIME_TICKS_PER_SEC)
+
+static const char digits2[201] =
+    "00010203040506070809" "10111213141516171819" "20212223242526272829"
+    "30313233343536373839" "40414243444546474849" "50515253545556575859"
+    "60616263646566676869" "70717273747576777879" "80818283848586878889"
+    "90919293949596979899";
+
+static inline void put2(char *p, unsigned v)
+{
+    memcpy(p, &digits2[v * 2], 2);
+}
+
+// the date of a day counted from 1601-01-01 (day 0).
+// counted from 0000-03-01 instead, a year ends with February, so the leap day
+// is the last one and the months of a year follow a linear rule: no branch
+// (the "civil_from_days" of Howard Hinnant, for unsigned days only)
+static void days_to_civil(uint64_t day, unsigned *year, unsigned *mon, unsigned *mday)
+{
+    uint64_t z   = day + 584694;                                    // days since 0000-03-01
+    uint64_t era = z / 146097;                                      // 400 year cycles
+    unsigned doe = (unsigned)(z - era * 146097);                    // [0, 146096]
+    unsigned yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;   // [0, 399]
+    unsigned doy = doe - (365 * yoe + yoe / 4 - yoe / 100);         // [0, 365]
+    unsigned mp  = (5 * doy + 2) / 153;                             // [0, 11], March = 0
+    unsigned m   = mp + 3 - 12 * (mp >= 10);
+
+    *mday = doy - (153 * mp + 2) / 5 + 1;
+    *mon  = m;
+    *year = (unsigned)(era * 400) + yoe + (m <= 2);
+}
+
+// "YYYY-MM-DDT" of day, returns its length (12 for a year after 9999)
+static size_t format_day(uint64_t day, char *p)
+{
+    unsigned year, mon, mday;
+    days_to_civil(day, &year, &mon, &mday);
+
+    size_t n = 0;
+    if (year > 9999) p[n++] = (char)('0' + year / 10000);   // FILETIME goes up to year 30828
+    put2(&p[n], year / 100 % 100);
+    put2(&p[n + 2], year % 100);
+    p[n + 4] = '-';
+    put2(&p[n + 5], mon);
+    p[n + 7] = '-';
+    put2(&p[n + 8], mday);
+    p[n + 10] = 'T';
+    return n + 11;
+}
+
+
+size_t filetime_to_iso(uint64_t filetime, char *buf, FILETIME_DAY_CACHE *cache)
+{
+    uint64_t day   = filetime / FILETIME_TICKS_PER_DAY;
+    uint64_t ticks = filetime % FILETIME_TICKS_PER_DAY;      // of the day
+    char *p = buf;
+
+    // always all 12 bytes of the prefix, a copy of fixed size is a couple of moves.
+    // the byte after an 11 character prefix is overwritten with the time below
+    if (cache->day != day + 1) {
+        cache->len = (uint8_t)format_day(day, cache->prefix);
+        cache->day = day + 1;
+    }
+    memcpy(p, cache->prefix, sizeof(cache->prefix));
+    p += cache->len;
+
+    unsigned secs = (unsigned)(ticks / FILETIME_TICKS_PER_SEC);
+    unsigned frac = (unsigned)(ticks % FILETIME_TICKS_PER_SEC);
+
+    put2(&p[0], secs / 3600);
+    p[2] = ':';
+    put2(&p[3], secs / 60 % 60);
+    p[5] = ':';
+    put2(&p[6], secs % 60);
+    p[8] = '.';
+    put2(&p[9],  frac / 100000);
+    put2(&p[11], frac / 1000 % 100);
+    put2(&p[13], frac / 10 % 100);
+    p[15] = (char)('0' + frac % 10);
+
+    return (size_t)(p + 16 - buf);
+}
+
+
+// the cache of the calling thread, for the callers which do not keep their own
+// (chunks are decoded in parallel, each thread goes through its own days)
+static _Thread_local FILETIME_DAY_CACHE thread_day_cache;
+
+FILETIME_DAY_CACHE *filetime_thread_cache(void)
+{
+    return &thread_day_cache;
+}
+
+
 /**
  * Converts a 64-bit FILETIME (100ns intervals since 1601-01-01)
  * to an ISO 8601 string: YYYY-MM-DDTHH:MM:SS.xxxxxxxZ
@@ -33,37 +138,108 @@ void format_filetime(
     char* buffer, 
     size_t buffer_size) 
 {
-    // 1. Number of 100ns intervals in a second
+    char text[FILETIME_ISO_MAX];
+    size_t len = filetime_to_iso(filetime, text, &thread_day_cache);
+    text[len++] = 'Z';
+
+    if (buffer_size == 0) return;
+    if (len > buffer_size - 1) len = buffer_size - 1;
+    memcpy(buffer, text, len);
+    buffer[len] = '\0';
+}
+
+
+// days since 1970-01-01 of a date in the proleptic Gregorian calendar
+static int64_t days_from_civil(int64_t y, unsigned m, unsigned d)
+{
+    y -= (m <= 2);
+    int64_t  era = (y >= 0 ? y : y - 399) / 400;
+    unsigned yoe = (unsigned)(y - era * 400);                       // [0, 399]
+    unsigned doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;  // [0, 365]
+    unsigned doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;           // [0, 146096]
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+
+// read n digits
+static int parse_digits(const char **p, int n, unsigned *value)
+{
+    unsigned v = 0;
+    for (int i = 0; i < n; i++) {
+        char c = (*p)[i];
+        if (c < '0' || c > '9') return -1;
+        v = v * 10 + (unsigned)(c - '0');
+    }
+    *p += n;
+    *value = v;
+    return 0;
+}
+
+
+/**
+ * The reverse of format_filetime(), always UTC:
+ *     YYYY-MM-DD
+ *     YYYY-MM-DDTHH:MM[:SS[.fffffff]][Z]     (a space instead of T is fine)
+ * *filetime is the first tick of the time given. span (may be NULL) gets how
+ * many ticks it covers: a day, a minute, a second, or down to 1 for 7 digits,
+ * so filetime + span - 1 is its last tick.
+ * Returns 0, or -1 if str is not such a time
+ */
+int parse_filetime(
+    const char *str,
+    uint64_t *filetime,
+    uint64_t *span)
+{
     const uint64_t TICKS_PER_SEC = 10000000ULL;
-    
-    // 2. Seconds between 1601-01-01 and 1970-01-01
-    const uint64_t EPOCH_DIFF = 11644473600ULL;
-
-    // Calculate total seconds and the remaining "ticks" (100ns units)
-    uint64_t total_seconds = filetime / TICKS_PER_SEC;
-    uint32_t remainder_ticks = (uint32_t)(filetime % TICKS_PER_SEC);
-    
-    // Adjust to Unix Epoch (1970)
-    time_t unix_time = (time_t)(total_seconds - EPOCH_DIFF);
-
-    // Convert to UTC struct tm
-    struct tm *utc_time = gmtime(&unix_time);
-
-    // Format the main date/time part
-    // %07u ensures we show all 7 digits of the 100ns precision
-    strftime(buffer, buffer_size, "%Y-%m-%dT%H:%M:%S", utc_time);
-    
-    // Append the sub-second precision and the 'Z' suffix
-    char sub_seconds[12];
-    snprintf(sub_seconds, sizeof(sub_seconds), ".%07uZ", remainder_ticks);
-    
-    // Concatenate
-    size_t len = 0;
-    while(buffer[len] != '\0') len++;
-    for(int i = 0; sub_seconds[i] != '\0' && len < buffer_size - 1; i++) {
-        buffer[len++] = sub_seconds[i];
+    const int64_t  EPOCH_DIFF = 11644473600LL;
+
+    unsigned year, mon, day, hour = 0, min = 0, sec = 0, ticks = 0;
+    uint64_t ticks_given = 86400 * TICKS_PER_SEC;
+    const char *p = str;
+
+    if (parse_digits(&p, 4, &year) || *p++ != '-' ||
+        parse_digits(&p, 2, &mon)  || *p++ != '-' ||
+        parse_digits(&p, 2, &day)) {
+        return -1;
     }
-    buffer[len] = '\0';
+
+    if (*p == 'T' || *p == ' ') {
+        p++;
+        if (parse_digits(&p, 2, &hour) || *p++ != ':' || parse_digits(&p, 2, &min)) {
+            return -1;
+        }
+        ticks_given = 60 * TICKS_PER_SEC;
+        if (*p == ':') {
+            p++;
+            if (parse_digits(&p, 2, &sec)) return -1;
+            ticks_given = TICKS_PER_SEC;
+
+            // up to 7 digits of 100ns, the rest is ignored
+            if (*p == '.') {
+                p++;
+                int n = 0;
+                for (; *p >= '0' && *p <= '9'; p++, n++) {
+                    if (n < 7) {
+                        ticks = ticks * 10 + (unsigned)(*p - '0');
+                        ticks_given /= 10;
+                    }
+                }
+                if (n == 0) return -1;
+                for (; n < 7; n++) ticks *= 10;
+            }
+        }
+        if (*p == 'Z') p++;
+    }
+
+    if (*p != '\0' || mon < 1 || mon > 12 || day < 1 || day > 31 ||
+        hour > 23 || min > 59 || sec > 60 || year < 1601) {
+        return -1;
+    }
+
+    int64_t seconds = days_from_civil(year, mon, day) * 86400 + hour * 3600 + min * 60 + sec;
+    *filetime = (uint64_t)(seconds + EPOCH_DIFF) * TICKS_PER_SEC + ticks;
+    if (span) *span = ticks_given;
+    return 0;
 }
 
 
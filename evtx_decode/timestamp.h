@@ -31,11 +31,42 @@
 extern "C" {
 #endif
 
+// the day of the last FILETIME formatted: its "YYYY-MM-DDT" is copied as long
+// as the day does not change. zero it before the first use
+typedef struct _FILETIME_DAY_CACHE {
+     uint64_t day;             // days since 1601-01-01 plus 1, 0 = nothing yet
+     uint8_t  len;             // of prefix: 11, 12 after the year 9999
+     char     prefix[12];      // "YYYY-MM-DDT"
+} FILETIME_DAY_CACHE;
+
+// "YYYY-MM-DDTHH:MM:SS.fffffff" is 27 characters, a buffer of this size takes
+// any FILETIME with a suffix like "Z"
+#define FILETIME_ISO_LEN     27
+#define FILETIME_ISO_MAX     40
+
+// write "YYYY-MM-DDTHH:MM:SS.fffffff" (UTC, 100ns digits) to buf, no NUL,
+// returns the length: FILETIME_ISO_LEN (one more for a year after 9999)
+size_t filetime_to_iso(
+     uint64_t filetime,
+     char *buf,
+     FILETIME_DAY_CACHE *cache);
+
+// the cache of the calling thread, for filetime_to_iso() without one of its own
+FILETIME_DAY_CACHE *filetime_thread_cache(void);
+
+// filetime_to_iso() with a 'Z', NUL terminated, cut to buffer_size
 void format_filetime(
      uint64_t filetime, 
      char* buffer, 
      size_t buffer_size);
 
+// "2026-01-14", "2026-01-14T21:00" or "2026-01-14T21:39:15.3995512Z" (UTC) to the
+// FILETIME of its first tick, span (may be NULL) gets the ticks it covers (a day for a date)
+int parse_filetime(
+     const char *str,
+     uint64_t *filetime,
+     uint64_t *span);
+
 #if defined( __cplusplus )
 }
 #endif
@@ -7,55 +7,215 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <iconv.h>
-#include <errno.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define UTF16LE_X86 1
+#include <immintrin.h>
+#endif
 
 #include "utf16le.h"
 
 
-void print_utf16le_string(uint16_t char_count, uint16_t *utf16le_data) {
-    if (!utf16le_data || char_count == 0) return;
 
-    // 1. Create conversion descriptor (From UTF-16LE to UTF-8)
-    iconv_t cd = iconv_open("UTF-8", "UTF-16LE");
-    if (cd == (iconv_t)-1) {
-        perror("iconv_open failed");
-        return;
+// ------------------------------------------------------------
+// UTF-16LE -> UTF-8
+// ------------------------------------------------------------
+// EVTX strings are mostly ASCII, so the vector versions check 8 (SSE2) or
+// 16 (AVX2) characters at once and narrow them to bytes when all of them
+// are in 0x01..0x7f. Anything else goes through the scalar code one
+// character at a time, then the vector loop resumes.
+//
+// All versions stop at the first U+0000 (strings in EVTX are usually NULL
+// terminated inside their size), and write U+FFFD for a lone surrogate.
+// dst must hold UTF16LE_UTF8_SIZE(count) bytes.
+
+// read one UTF-16LE unit, the data is not always 2-byte aligned in the chunk
+static inline uint16_t get_unit(const uint8_t *p, size_t i)
+{
+    return (uint16_t)(p[i * 2] | (p[i * 2 + 1] << 8));
+}
+
+
+// convert the character at src[*i] (a surrogate pair counts as one), return the bytes written
+// 0 means U+0000, the end of the string
+static inline size_t put_char(const uint8_t *src, size_t *i, size_t count, char *dst)
+{
+    uint32_t c = get_unit(src, *i);
+    (*i)++;
+
+    if (c < 0x80) {
+        if (c == 0) return 0;
+        dst[0] = (char)c;
+        return 1;
+    }
+    if (c < 0x800) {
+        dst[0] = (char)(0xc0 | (c >> 6));
+        dst[1] = (char)(0x80 | (c & 0x3f));
+        return 2;
     }
+    if (c >= 0xd800 && c <= 0xdfff) {
+        uint32_t low = (*i < count) ? get_unit(src, *i) : 0;
+        if (c <= 0xdbff && low >= 0xdc00 && low <= 0xdfff) {
+            (*i)++;
+            c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+            dst[0] = (char)(0xf0 | (c >> 18));
+            dst[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+            dst[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+            dst[3] = (char)(0x80 | (c & 0x3f));
+            return 4;
+        }
+        c = 0xfffd;     // lone surrogate
+    }
+    dst[0] = (char)(0xe0 | (c >> 12));
+    dst[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+    dst[2] = (char)(0x80 | (c & 0x3f));
+    return 3;
+}
 
-    // 2. Prepare buffers
-    // UTF-8 can take up to 3-4 bytes per character for Japanese
-    size_t in_bytes_left = char_count * 2;
-    size_t out_bytes_left = char_count * 4; 
-    char *out_buffer = malloc(out_bytes_left + 1);
-    if (!out_buffer) {
-        iconv_close(cd);
-        return;
+
+size_t utf16le_to_utf8_scalar(const uint16_t *utf16le_data, size_t count, char *dst)
+{
+    const uint8_t *src = (const uint8_t *)utf16le_data;
+    size_t out = 0;
+
+    for (size_t i = 0; i < count; ) {
+        size_t n = put_char(src, &i, count, &dst[out]);
+        if (n == 0) break;
+        out += n;
     }
 
-    char *in_ptr = (char *)utf16le_data;
-    char *out_ptr = out_buffer;
+    dst[out] = '\0';
+    return out;
+}
+
 
-    // 3. Perform conversion
-    if (iconv(cd, &in_ptr, &in_bytes_left, &out_ptr, &out_bytes_left) == (size_t)-1) {
-        // If conversion fails, fallback to simple ASCII or print error
-        fprintf(stderr, "\n[Conversion Error: %d]\n", errno);
-    } else {
-        *out_ptr = '\0'; // Null-terminate the UTF-8 string
-        printf("%s", out_buffer);
+#if defined(UTF16LE_X86)
+
+size_t utf16le_to_utf8_sse2(const uint16_t *utf16le_data, size_t count, char *dst)
+{
+    const uint8_t *src = (const uint8_t *)utf16le_data;
+    const __m128i ascii_mask = _mm_set1_epi16((short)0xff80);
+    const __m128i zero = _mm_setzero_si128();
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < count) {
+        if (i + 8 <= count) {
+            __m128i v = _mm_loadu_si128((const __m128i *)&src[i * 2]);
+            // all 8 in 0x01..0x7f: (v & 0xff80) == 0 and v != 0
+            __m128i is_ascii = _mm_cmpeq_epi16(_mm_and_si128(v, ascii_mask), zero);
+            __m128i is_nul   = _mm_cmpeq_epi16(v, zero);
+            if (_mm_movemask_epi8(_mm_andnot_si128(is_nul, is_ascii)) == 0xffff) {
+                _mm_storel_epi64((__m128i *)&dst[out], _mm_packus_epi16(v, v));
+                out += 8;
+                i += 8;
+                continue;
+            }
+        }
+
+        size_t n = put_char(src, &i, count, &dst[out]);
+        if (n == 0) break;
+        out += n;
     }
 
-    // 4. Cleanup
-    free(out_buffer);
-    iconv_close(cd);
+    dst[out] = '\0';
+    return out;
 }
 
 
+__attribute__((target("avx2")))
+size_t utf16le_to_utf8_avx2(const uint16_t *utf16le_data, size_t count, char *dst)
+{
+    const uint8_t *src = (const uint8_t *)utf16le_data;
+    const __m256i ascii_mask = _mm256_set1_epi16((short)0xff80);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t out = 0;
+    size_t i = 0;
+
+    while (i < count) {
+        if (i + 16 <= count) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)&src[i * 2]);
+            __m256i is_ascii = _mm256_cmpeq_epi16(_mm256_and_si256(v, ascii_mask), zero);
+            __m256i is_nul   = _mm256_cmpeq_epi16(v, zero);
+            if ((uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(is_nul, is_ascii)) == 0xffffffffu) {
+                // packus works per 128-bit lane, bring the two low halves together
+                __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0xd8);
+                _mm_storeu_si128((__m128i *)&dst[out], _mm256_castsi256_si128(packed));
+                out += 16;
+                i += 16;
+                continue;
+            }
+        }
 
+        size_t n = put_char(src, &i, count, &dst[out]);
+        if (n == 0) break;
+        out += n;
+    }
 
+    dst[out] = '\0';
+    return out;
+}
 
+#endif
+
+
+// chosen once at startup from the CPU features
+static size_t (*utf16le_impl)(const uint16_t *, size_t, char *) = utf16le_to_utf8_scalar;
+static const char *utf16le_impl_label = "scalar";
 
-void print_name_from_offset_FILE(FILE *fp, uint32_t chunk_base, uint32_t name_offset) {
+__attribute__((constructor))
+static void utf16le_select_impl(void)
+{
+#if defined(UTF16LE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        utf16le_impl = utf16le_to_utf8_avx2;
+        utf16le_impl_label = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        utf16le_impl = utf16le_to_utf8_sse2;
+        utf16le_impl_label = "sse2";
+    }
+#endif
+}
+
+
+size_t utf16le_to_utf8(const uint16_t *utf16le_data, size_t count, char *dst)
+{
+    return utf16le_impl(utf16le_data, count, dst);
+}
+
+
+const char *utf16le_impl_name(void)
+{
+    return utf16le_impl_label;
+}
+
+
+
+
+void print_utf16le_string(OUT_SINK *out, uint16_t char_count, uint16_t *utf16le_data) {
+    if (!utf16le_data || char_count == 0) return;
+
+    // most strings fit on the stack
+    char stack_buf[UTF16LE_UTF8_SIZE(256)];
+    char *buf = stack_buf;
+    if (UTF16LE_UTF8_SIZE(char_count) > sizeof(stack_buf)) {
+        buf = malloc(UTF16LE_UTF8_SIZE(char_count));
+        if (!buf) return;
+    }
+
+    size_t len = utf16le_to_utf8(utf16le_data, char_count, buf);
+    out_write(out, buf, len);
+
+    if (buf != stack_buf) free(buf);
+}
+
+
+
+
+
+
+void print_name_from_offset_FILE(OUT_SINK *out, FILE *fp, uint32_t chunk_base, uint32_t name_offset) {
     // 1. Move to the absolute position in the file
     // The offset is always relative to the start of the chunk (ElfChnk)
     fseek(fp, chunk_base + name_offset, SEEK_SET);
@@ -73,7 +233,7 @@ void print_name_from_offset_FILE(FILE *fp, uint32_t chunk_base, uint32_t name_of
         fread(name_buffer, char_count * 2, 1, fp);
         
         // 5. Use the new successful function!
-        print_utf16le_string(char_count, name_buffer);
+        print_utf16le_string(out, char_count, name_buffer);
         
         free(name_buffer);
     }
@@ -84,7 +244,7 @@ void print_name_from_offset_FILE(FILE *fp, uint32_t chunk_base, uint32_t name_of
 
 
 /// This function uses the memory-mapped chunk_buffer instead of FILE I/O
-void print_name_from_offset_BUFFER(uint8_t *chunk_buffer, uint32_t name_offset) 
+void print_name_from_offset_BUFFER(OUT_SINK *out, uint8_t *chunk_buffer, uint32_t name_offset) 
 {
     // 1. Calculate the start address of the Namestring structure
     // name_offset is relative to the start of the chunk
@@ -109,96 +269,36 @@ void print_name_from_offset_BUFFER(uint8_t *chunk_buffer, uint32_t name_offset)
     if (string_end_offset <= 0x10000) {
         // 6. Use your existing function to print the string
         // Since the data is already in memory, no need to malloc/free!
-        print_utf16le_string(char_count, name_ptr);
+        print_utf16le_string(out, char_count, name_ptr);
     } else {
-        printf("[Error: Namestring at 0x%04X exceeds chunk boundary]", name_offset);
-    }
-}
-
-
-
-static int utf16le_to_utf8(const uint16_t *src,
-                    uint16_t char_count,
-                    char *dst,
-                    size_t dst_size)
-{
-    if (!dst || dst_size == 0) return -1;
-
-    size_t out = 0;
-
-    for (uint16_t i = 0; i < char_count; i++) {
-        uint16_t wc = src[i];
-
-        /* ASCII fast path (most EVTX strings) */
-        if (wc < 0x80) {
-            if (out + 1 >= dst_size) break;
-            dst[out++] = (char)wc;
-        }
-        /* 2-byte UTF-8 */
-        else if (wc < 0x800) {
-            if (out + 2 >= dst_size) break;
-            dst[out++] = 0xC0 | (wc >> 6);
-            dst[out++] = 0x80 | (wc & 0x3F);
-        }
-        /* 3-byte UTF-8 (BMP) */
-        else {
-            if (out + 3 >= dst_size) break;
-            dst[out++] = 0xE0 | (wc >> 12);
-            dst[out++] = 0x80 | ((wc >> 6) & 0x3F);
-            dst[out++] = 0x80 | (wc & 0x3F);
-        }
+        out_printf(out, "[Error: Namestring at 0x%04X exceeds chunk boundary]", name_offset);
     }
-
-    dst[out] = '\0';
-
-    return (int)out;
 }
 
 
 
-
-static void get_utf16le_string(uint16_t char_count, uint16_t *utf16le_data,
+void get_utf16le_string(uint16_t char_count, uint16_t *utf16le_data,
                           char *out_string_buffer,
                           size_t out_size)
 {
     if (!utf16le_data || char_count == 0) return;
 
-    // 1. Create conversion descriptor (From UTF-16LE to UTF-8)
-    iconv_t cd = iconv_open("UTF-8", "UTF-16LE");
-    if (cd == (iconv_t)-1) {
-        perror("iconv_open failed");
-        return;
-    }
-
-    // 2. Prepare buffers
-    // UTF-8 can take up to 3-4 bytes per character for Japanese
-    size_t in_bytes_left = char_count * 2;
-    size_t out_bytes_left = char_count * 4; 
-    char *out_buffer = malloc(out_bytes_left + 1);
-    if (!out_buffer) {
-        iconv_close(cd);
+    if (out_size >= UTF16LE_UTF8_SIZE(char_count)) {
+        utf16le_to_utf8(utf16le_data, char_count, out_string_buffer);
         return;
     }
 
-    char *in_ptr = (char *)utf16le_data;
-    char *out_ptr = out_buffer;
+    // the caller buffer may still be enough for the real string
+    char *buf = malloc(UTF16LE_UTF8_SIZE(char_count));
+    if (!buf) return;
 
-    // 3. Perform conversion
-    if (iconv(cd, &in_ptr, &in_bytes_left, &out_ptr, &out_bytes_left) == (size_t)-1) {
-        // If conversion fails, fallback to simple ASCII or print error
-        fprintf(stderr, "\n[Conversion Error: %d]\n", errno);
+    size_t len = utf16le_to_utf8(utf16le_data, char_count, buf);
+    if (len < out_size) {
+        memcpy(out_string_buffer, buf, len + 1);
     } else {
-        *out_ptr = '\0'; // Null-terminate the UTF-8 string
-        if (strlen(out_buffer) < out_size) {
-            strcpy(out_string_buffer, out_buffer);
-        } else {
-            printf("ERROR: out_string_buffer is not enough: out_size=%zu\n", out_size);
-        }
+        fprintf(stderr, "ERROR: out_string_buffer is not enough: out_size=%zu\n", out_size);
     }
-
-    // 4. Cleanup
-    free(out_buffer);
-    iconv_close(cd);
+    free(buf);
 }
 
 
@@ -212,6 +312,10 @@ int get_name_from_offset(uint8_t *chunk_buffer,
     if (!chunk_buffer || !out_buf || out_size == 0)
         return -1;
 
+    // the entry header must be inside the 64KB chunk, and so must the string
+    if ((uint64_t)name_offset + 8 > 0x10000)
+        return -1;
+
     uint8_t *p = chunk_buffer + name_offset;
 
     /* skip entry header */
@@ -220,18 +324,19 @@ int get_name_from_offset(uint8_t *chunk_buffer,
 
     uint16_t char_count = *(uint16_t *)(p);  
     uint16_t *utf16le   = (uint16_t *)(p + 2);
+    if ((uint64_t)name_offset + 8 + char_count * 2 > 0x10000)
+        return -1;
 
-    // we use old version
-    //     return utf16le_to_utf8(utf16le, char_count, out_buf, out_size);
+    out_buf[0] = '\0';
     get_utf16le_string(char_count, utf16le, out_buf, out_size);
     return strlen(out_buf);
 }
 
-void print_name_from_offset(uint8_t *chunk_buffer, uint32_t offset)
+void print_name_from_offset(OUT_SINK *out, uint8_t *chunk_buffer, uint32_t offset)
 {
     char name_buf[1024];
     if (get_name_from_offset(chunk_buffer, offset, name_buf, sizeof(name_buf)) >0) {
-        printf("%s", name_buf);
+        out_puts(out, name_buf);
     }
 }
 
@@ -251,12 +356,16 @@ int main() {
         0x65E5, 0x672C, 0x8A9E
     };
     
-    print_utf16le_string(9, test1); // No warning!
-    printf("\n");
+    OUT_SINK out;
+    out_sink_init_file(&out, stdout);
+
+    print_utf16le_string(&out, 9, test1); // No warning!
+    out_putc(&out, '\n');
     
-    print_utf16le_string(3, test2); // No warning!
-    printf("\n");
+    print_utf16le_string(&out, 3, test2); // No warning!
+    out_putc(&out, '\n');
 
+    out_sink_free(&out);
 
     printf("-----------------------------\n");
     return 0;
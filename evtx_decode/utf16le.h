@@ -6,10 +6,30 @@
 #if !defined( UTF16LE_H )
 #define UTF16LE_H
 
+#include <stddef.h>
+#include <stdint.h>
+#include "out_sink.h"
 
 
-void print_utf16le_string(uint16_t char_count, uint16_t *utf16le_data);
-void print_name_from_offset(uint8_t *chunk_buffer, uint32_t name_offset);
+// bytes needed by utf16le_to_utf8() for count UTF-16 units, NULL included
+#define UTF16LE_UTF8_SIZE(count)    ((size_t)(count) * 3 + 1)
+
+// convert up to count units (stops at U+0000), dst is NULL terminated
+// lone surrogates become U+FFFD. returns the length of dst
+// uses AVX2 or SSE2 when the CPU has it, see utf16le_impl_name()
+size_t utf16le_to_utf8(const uint16_t *utf16le_data, size_t count, char *dst);
+const char *utf16le_impl_name(void);
+
+// the implementations, for the benchmark
+size_t utf16le_to_utf8_scalar(const uint16_t *utf16le_data, size_t count, char *dst);
+#if defined(__x86_64__) || defined(__i386__)
+size_t utf16le_to_utf8_sse2(const uint16_t *utf16le_data, size_t count, char *dst);
+size_t utf16le_to_utf8_avx2(const uint16_t *utf16le_data, size_t count, char *dst);
+#endif
+
+void print_utf16le_string(OUT_SINK *out, uint16_t char_count, uint16_t *utf16le_data);
+void get_utf16le_string(uint16_t char_count, uint16_t *utf16le_data, char *out, size_t out_size);
+void print_name_from_offset(OUT_SINK *out, uint8_t *chunk_buffer, uint32_t name_offset);
 int  get_name_from_offset(uint8_t *chunk_buffer, uint32_t name_offset, char *out, size_t out_size);
 
 
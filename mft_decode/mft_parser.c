@@ -4,9 +4,12 @@
 #include <string.h>
 #include <time.h>
 
+// Build the program (the time format is shared with evtx_decode)
+//    gcc -Wall -O2 -std=c11 -D_DEFAULT_SOURCE -o mft_parser mft_parser.c ../evtx_decode/timestamp.c
+#include "../evtx_decode/timestamp.h"
+
 #define MFT_RECORD_SIZE 1024 // Default size of an MFT record
 #define MFT_SIGNATURE 0x454C4946 // 'FILE' in Little-Endian
-#define EPOCH_DIFFERENCE 116444736000000000ULL // 100ns intervals between 1601 and 1970
 
 // --- 1. MFT Record Header Structure (48 bytes) ---
 typedef struct {
@@ -121,6 +124,9 @@ const AttributeType attribute_types[] = {
 
 // --- Utility Functions ---
 
+// the four times of $STANDARD_INFORMATION are mostly on the same day
+static FILETIME_DAY_CACHE time_cache;
+
 /**
  * @brief Converts raw NTFS time (100ns since 1601) to human-readable format with microsecond precision.
  */
@@ -130,32 +136,15 @@ void print_human_time(const char *label, uint64_t ntfs_time) {
         return;
     }
 
-    // 1. Calculate the total 100ns intervals since 1970
-    uint64_t total_100ns = ntfs_time - EPOCH_DIFFERENCE;
-    
-    // 2. Calculate the whole seconds part (10,000,000 * 100ns intervals per second)
-    time_t seconds = (time_t)(total_100ns / 10000000ULL);
-
-    // 3. Calculate the fractional part (remaining 100ns intervals)
-    uint64_t fractional_100ns = total_100ns % 10000000ULL;
+    // the FILETIME formatter of evtx_decode: YYYY-MM-DDTHH:MM:SS.1234567
+    char time_str[FILETIME_ISO_MAX + 8];
+    size_t len = filetime_to_iso(ntfs_time, time_str, &time_cache);
 
-    // Convert to UTC time structure
-    struct tm *tm_info = gmtime(&seconds);
-    
-    char buffer[100];
-    char time_str[130];
-    
-    // Format the standard date/time part
-    strftime(buffer, 100, "%Y-%m-%d %H:%M:%S", tm_info);
-    
-    // Append the fractional part with 6 digits (microsecond precision)
-    // We print 7 digits of the 100ns interval, then cap at 6 decimal places.
-    snprintf(time_str, sizeof(time_str), "%s.%07llu UTC", 
-             buffer, (unsigned long long)fractional_100ns);
-    
-    // Print the result, trimming the 7th digit to display 6 decimal places.
-    // E.g., 2025-11-18 01:08:02.1234567 UTC -> 2025-11-18 01:08:02.123456 UTC
-    time_str[strlen(buffer) + 7] = ' '; 
+    // a space instead of the T, and the 7th digit trimmed to display 6 decimal places.
+    // E.g., 2025-11-18 01:08:02.1234567 UTC -> 2025-11-18 01:08:02.123456  UTC
+    time_str[len - 17] = ' ';
+    time_str[len - 1] = ' ';
+    memcpy(&time_str[len], " UTC", 5);
 
     printf("    %-24s: %s\n", label, time_str);
 }